@@ -0,0 +1,173 @@
+#include "ConvexDecomposition.h"
+#include "Urho3D/Container/Sort.h"
+#include "Urho3D/Container/Swap.h"
+#include "Urho3D/Math/MathDefs.h"
+
+namespace
+{
+
+/// Triangle edge with its endpoints in a canonical order, so both sides of a diagonal compare equal.
+struct DiagonalEdge
+{
+    Vector2 min_;
+    Vector2 max_;
+    unsigned triangle_;
+};
+
+bool PointLess(const Vector2& a, const Vector2& b)
+{
+    return a.x_ < b.x_ || (a.x_ == b.x_ && a.y_ < b.y_);
+}
+
+bool EdgeLess(const DiagonalEdge& a, const DiagonalEdge& b)
+{
+    if(a.min_ != b.min_)
+        return PointLess(a.min_, b.min_);
+    if(a.max_ != b.max_)
+        return PointLess(a.max_, b.max_);
+    return a.triangle_ < b.triangle_;
+}
+
+float Cross(const Vector2& a, const Vector2& b, const Vector2& c)
+{
+    return (b.x_ - a.x_) * (c.y_ - b.y_) - (b.y_ - a.y_) * (c.x_ - b.x_);
+}
+
+unsigned FindRoot(PODVector<unsigned>& parent, unsigned i)
+{
+    while(parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/// Index of the directed edge from -> to in a loop, or M_MAX_UNSIGNED.
+unsigned FindEdge(const PODVector<Vector2>& loop, const Vector2& from, const Vector2& to)
+{
+    for(unsigned i = 0; i < loop.Size(); i++)
+    {
+        if(loop[i] == from && loop[(i + 1) % loop.Size()] == to)
+            return i;
+    }
+    return M_MAX_UNSIGNED;
+}
+
+}
+
+void MergeConvexPieces(const PODVector<EarTriangle>& triangles, ConvexPieces& pieces, unsigned maxVertices)
+{
+    unsigned numTriangles = triangles.Size();
+    if(!numTriangles)
+        return;
+
+    Vector<PODVector<Vector2> > loops(numTriangles);
+    PODVector<unsigned> parent(numTriangles);
+    PODVector<DiagonalEdge> edges;
+    edges.Reserve(numTriangles * 3);
+
+    float area = 0.0f;
+    for(unsigned i = 0; i < numTriangles; i++)
+    {
+        const EarTriangle& et = triangles[i];
+        PODVector<Vector2>& loop = loops[i];
+        loop.Push(et.p1_);
+        loop.Push(et.p2_);
+        loop.Push(et.p3_);
+        parent[i] = i;
+        area += Cross(et.p1_, et.p2_, et.p3_);
+
+        for(unsigned j = 0; j < 3; j++)
+        {
+            DiagonalEdge edge;
+            const Vector2& a = loop[j];
+            const Vector2& b = loop[(j + 1) % 3];
+            edge.min_ = PointLess(a, b) ? a : b;
+            edge.max_ = PointLess(a, b) ? b : a;
+            edge.triangle_ = i;
+            edges.Push(edge);
+        }
+    }
+    float orientation = area >= 0.0f ? 1.0f : -1.0f;
+
+    // Edges shared by two triangles end up next to each other, those are the diagonals
+    Sort(edges.Begin(), edges.End(), EdgeLess);
+
+    for(unsigned i = 0; i + 1 < edges.Size(); i++)
+    {
+        const DiagonalEdge& e1 = edges[i];
+        const DiagonalEdge& e2 = edges[i + 1];
+        if(e1.min_ != e2.min_ || e1.max_ != e2.max_)
+            continue;
+
+        unsigned a = FindRoot(parent, e1.triangle_);
+        unsigned b = FindRoot(parent, e2.triangle_);
+        if(a == b)
+            continue;
+
+        PODVector<Vector2>& loopA = loops[a];
+        PODVector<Vector2>& loopB = loops[b];
+        if(loopA.Size() + loopB.Size() - 2 > maxVertices + 2)
+            continue;
+
+        // Walk A from the far end of the diagonal back to its start, then the rest of B
+        Vector2 u = e1.min_;
+        Vector2 v = e1.max_;
+        unsigned ia = FindEdge(loopA, u, v);
+        if(ia == M_MAX_UNSIGNED)
+        {
+            Swap(u, v);
+            ia = FindEdge(loopA, u, v);
+        }
+        unsigned ib = FindEdge(loopB, v, u);
+        if(ia == M_MAX_UNSIGNED || ib == M_MAX_UNSIGNED)
+            continue;
+
+        PODVector<Vector2> merged;
+        merged.Reserve(loopA.Size() + loopB.Size() - 2);
+        for(unsigned k = 1; k <= loopA.Size(); k++)
+            merged.Push(loopA[(ia + k) % loopA.Size()]);
+        for(unsigned k = 2; k < loopB.Size(); k++)
+            merged.Push(loopB[(ib + k) % loopB.Size()]);
+
+        // Only the two ends of the diagonal can break convexity. Collinear ends are dropped, Box2D would weld them anyway.
+        bool convex = true;
+        unsigned count = merged.Size();
+        unsigned ends[2] = { loopA.Size() - 1, 0 };
+        PODVector<unsigned char> drop(count);
+        for(unsigned k = 0; k < count; k++)
+            drop[k] = 0;
+        for(unsigned k = 0; k < 2; k++)
+        {
+            unsigned j = ends[k];
+            float corner = Cross(merged[(j + count - 1) % count], merged[j], merged[(j + 1) % count]) * orientation;
+            if(corner < -M_EPSILON)
+                convex = false;
+            else if(corner <= M_EPSILON)
+                drop[j] = 1;
+        }
+        if(!convex)
+            continue;
+
+        PODVector<Vector2> piece;
+        piece.Reserve(count);
+        for(unsigned k = 0; k < count; k++)
+        {
+            if(!drop[k])
+                piece.Push(merged[k]);
+        }
+        if(piece.Size() > maxVertices || piece.Size() < 3)
+            continue;
+
+        loopA = piece;
+        loopB.Clear();
+        parent[b] = a;
+    }
+
+    for(unsigned i = 0; i < numTriangles; i++)
+    {
+        if(!loops[i].Empty())
+            pieces.AddPiece(&loops[i][0], loops[i].Size());
+    }
+}
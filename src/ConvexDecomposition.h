@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Math/Vector2.h"
+#include "PolygonTriangulator.h"
+
+using namespace Urho3D;
+
+/// Box2D polygon shapes hold at most b2_maxPolygonVertices corners.
+static const unsigned MAX_PIECE_VERTICES = 8;
+
+/// Convex pieces of one polygon in a single vertex buffer. Piece i starts at starts_[i] and ends where the next one
+/// starts, so a polygon holds two allocations however many pieces it has and reuses them on every bake.
+struct ConvexPieces
+{
+    void Clear()
+    {
+        vertices_.Clear();
+        starts_.Clear();
+    }
+    /// Start a new piece, its vertices are pushed to vertices_ after.
+    void BeginPiece() { starts_.Push(vertices_.Size()); }
+    /// Append a whole piece.
+    void AddPiece(const Vector2* vertices, unsigned count)
+    {
+        BeginPiece();
+        for(unsigned i = 0; i < count; i++)
+            vertices_.Push(vertices[i]);
+    }
+
+    unsigned Size() const { return starts_.Size(); }
+    bool Empty() const { return starts_.Empty(); }
+    const Vector2* GetVertices(unsigned i) const { return &vertices_[starts_[i]]; }
+    unsigned GetNumVertices(unsigned i) const { return (i + 1 < starts_.Size() ? starts_[i + 1] : vertices_.Size()) - starts_[i]; }
+
+    PODVector<Vector2> vertices_;
+    PODVector<unsigned> starts_;
+};
+
+/// Hertel-Mehlhorn decomposition. Merges the triangles of one polygon across their shared diagonals as long as
+/// the union stays convex and within maxVertices corners, and appends the pieces. Pieces keep the winding of the
+/// triangles.
+void MergeConvexPieces(const PODVector<EarTriangle>& triangles, ConvexPieces& pieces, unsigned maxVertices = MAX_PIECE_VERTICES);
@@ -0,0 +1,81 @@
+#include "EditorChunks.h"
+#include "Urho3D/Math/MathDefs.h"
+
+EditorChunks::EditorChunks(float chunkSize, int margin) :
+    chunkSize_(chunkSize),
+    margin_(margin),
+    enabled_(true),
+    minX_(0),
+    minY_(0),
+    maxX_(-1),
+    maxY_(-1)
+{
+}
+
+bool EditorChunks::Update(const Rect& view, PODVector<Rect>& loaded, PODVector<Rect>& unloaded)
+{
+    loaded.Clear();
+    unloaded.Clear();
+    if(!enabled_)
+        return false;
+
+    int viewMinX, viewMinY, viewMaxX, viewMaxY;
+    GetChunkRange(view, viewMinX, viewMinY, viewMaxX, viewMaxY);
+    if(viewMinX >= minX_ && viewMinY >= minY_ && viewMaxX <= maxX_ && viewMaxY <= maxY_)
+        return false;
+
+    // Re-center with the margin on every side, so turning back doesn't stream the same chunks right away
+    int newMinX = viewMinX - margin_;
+    int newMinY = viewMinY - margin_;
+    int newMaxX = viewMaxX + margin_;
+    int newMaxY = viewMaxY + margin_;
+    for(int x = minX_; x <= maxX_; x++)
+    {
+        for(int y = minY_; y <= maxY_; y++)
+        {
+            if(x < newMinX || x > newMaxX || y < newMinY || y > newMaxY)
+                unloaded.Push(GetChunkRect(x, y));
+        }
+    }
+    for(int x = newMinX; x <= newMaxX; x++)
+    {
+        for(int y = newMinY; y <= newMaxY; y++)
+        {
+            if(x < minX_ || x > maxX_ || y < minY_ || y > maxY_)
+                loaded.Push(GetChunkRect(x, y));
+        }
+    }
+
+    minX_ = newMinX;
+    minY_ = newMinY;
+    maxX_ = newMaxX;
+    maxY_ = newMaxY;
+    return true;
+}
+
+bool EditorChunks::IsResident(const Rect& bounds) const
+{
+    if(!enabled_)
+        return true;
+    int minX, minY, maxX, maxY;
+    GetChunkRange(bounds, minX, minY, maxX, maxY);
+    return minX <= maxX_ && maxX >= minX_ && minY <= maxY_ && maxY >= minY_;
+}
+
+unsigned EditorChunks::GetNumResident() const
+{
+    return maxX_ < minX_ ? 0 : (unsigned)((maxX_ - minX_ + 1) * (maxY_ - minY_ + 1));
+}
+
+void EditorChunks::GetChunkRange(const Rect& bounds, int& minX, int& minY, int& maxX, int& maxY) const
+{
+    minX = FloorToInt(bounds.min_.x_ / chunkSize_);
+    minY = FloorToInt(bounds.min_.y_ / chunkSize_);
+    maxX = FloorToInt(bounds.max_.x_ / chunkSize_);
+    maxY = FloorToInt(bounds.max_.y_ / chunkSize_);
+}
+
+Rect EditorChunks::GetChunkRect(int x, int y) const
+{
+    return Rect(Vector2(x * chunkSize_, y * chunkSize_), Vector2((x + 1) * chunkSize_, (y + 1) * chunkSize_));
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Math/Rect.h"
+
+using namespace Urho3D;
+
+/// Grid cells along a chunk side.
+static const int CHUNK_CELLS = 32;
+
+/// Square regions of the editor plane kept resident around the camera. Only objects that overlap a resident chunk
+/// get scene nodes, physics bodies, sprites and overlays; the rest is kept as editor data and picked up again when
+/// the camera comes back.
+class EditorChunks
+{
+public:
+    /// margin is the number of chunks kept resident around the ones in view.
+    EditorChunks(float chunkSize = CHUNK_CELLS * 0.7f, int margin = 1);
+
+    /// Stream towards a view. Returns true when the resident chunks changed, with the areas of the chunks that came
+    /// and went. Panning inside the resident chunks changes nothing.
+    bool Update(const Rect& view, PODVector<Rect>& loaded, PODVector<Rect>& unloaded);
+    /// Whether any part of a rect is in a resident chunk.
+    bool IsResident(const Rect& bounds) const;
+    /// Streaming off makes everything resident, for batch runs without a camera.
+    void SetEnabled(bool enable) { enabled_ = enable; }
+    bool IsEnabled() const { return enabled_; }
+    unsigned GetNumResident() const;
+
+private:
+    void GetChunkRange(const Rect& bounds, int& minX, int& minY, int& maxX, int& maxY) const;
+    Rect GetChunkRect(int x, int y) const;
+
+    float chunkSize_;
+    int margin_;
+    bool enabled_;
+    /// Resident chunk range, inclusive. Empty while maxX_ < minX_.
+    int minX_;
+    int minY_;
+    int maxX_;
+    int maxY_;
+};
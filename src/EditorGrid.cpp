@@ -0,0 +1,101 @@
+#include "EditorGrid.h"
+#include "Urho3D/Graphics/Technique.h"
+#include "Urho3D/Resource/ResourceCache.h"
+#include "Urho3D/Scene/Node.h"
+
+EditorGrid::EditorGrid(Context* context): Component(context),
+    spacing_(0.7f),
+    maxLines_(120.0f),
+    color_(0, 1, 1, 0.5f),
+    builtStep_(0.0f)
+{
+}
+
+void EditorGrid::RegisterObject(Context* context)
+{
+    context->RegisterFactory<EditorGrid>();
+}
+
+void EditorGrid::SetSpacing(float spacing)
+{
+    spacing_ = spacing;
+    builtStep_ = 0.0f;
+}
+
+void EditorGrid::SetColor(const Color& color)
+{
+    color_ = color;
+    builtStep_ = 0.0f;
+}
+
+void EditorGrid::OnNodeSet(Node* node)
+{
+    if(!node)
+        return;
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    material_ = new Material(context_);
+    material_->SetTechnique(0, cache->GetResource<Technique>("Techniques/NoTextureUnlitVColAlpha.xml"));
+    material_->SetCullMode(CULL_NONE);
+
+    geometry_ = node->CreateComponent<CustomGeometry>();
+    geometry_->SetNumGeometries(1);
+    geometry_->SetMaterial(material_);
+}
+
+void EditorGrid::Update(Camera* camera)
+{
+    if(!geometry_ || !camera)
+        return;
+
+    Vector3 center = camera->GetNode()->GetWorldPosition();
+    float halfHeight = camera->GetOrthoSize() * 0.5f / camera->GetZoom();
+    float halfWidth = halfHeight * camera->GetAspectRatio();
+    Rect view(Vector2(center.x_ - halfWidth, center.y_ - halfHeight), Vector2(center.x_ + halfWidth, center.y_ + halfHeight));
+
+    // Thin the lines by powers of two so the coarse grid still lands on the fine one
+    float step = spacing_;
+    float extent = Max(halfWidth, halfHeight) * 2.0f;
+    while(extent / step > maxLines_)
+        step *= 2.0f;
+
+    if(step == builtStep_ && builtArea_.IsInside(view.min_) != OUTSIDE && builtArea_.IsInside(view.max_) != OUTSIDE)
+        return;
+    Rebuild(view, step);
+}
+
+void EditorGrid::Rebuild(const Rect& view, float step)
+{
+    // Cover a view in every direction so panning doesn't rebuild every frame
+    Vector2 margin = view.Size();
+    int minX = FloorToInt((view.min_.x_ - margin.x_) / step);
+    int maxX = CeilToInt((view.max_.x_ + margin.x_) / step);
+    int minY = FloorToInt((view.min_.y_ - margin.y_) / step);
+    int maxY = CeilToInt((view.max_.y_ + margin.y_) / step);
+    float left = minX * step;
+    float right = maxX * step;
+    float bottom = minY * step;
+    float top = maxY * step;
+
+    geometry_->BeginGeometry(0, LINE_LIST);
+    /// Lineas verticales
+    for(int i = minX; i <= maxX; i++)
+    {
+        geometry_->DefineVertex(Vector3(i * step, bottom, 0));
+        geometry_->DefineColor(color_);
+        geometry_->DefineVertex(Vector3(i * step, top, 0));
+        geometry_->DefineColor(color_);
+    }
+    /// Lineas horizontales
+    for(int j = minY; j <= maxY; j++)
+    {
+        geometry_->DefineVertex(Vector3(left, j * step, 0));
+        geometry_->DefineColor(color_);
+        geometry_->DefineVertex(Vector3(right, j * step, 0));
+        geometry_->DefineColor(color_);
+    }
+    geometry_->Commit();
+
+    builtStep_ = step;
+    builtArea_ = Rect(Vector2(left, bottom), Vector2(right, top));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Urho3D/Core/Object.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/Graphics/Camera.h"
+#include "Urho3D/Graphics/CustomGeometry.h"
+#include "Urho3D/Graphics/Material.h"
+#include "Urho3D/Math/Rect.h"
+#include "Urho3D/Scene/Component.h"
+
+using namespace Urho3D;
+
+/// Editor grid kept in a CustomGeometry. The lines are only rebuilt when the camera leaves the area they cover or the
+/// zoom asks for a different line spacing, so the per frame cost doesn't depend on the map size.
+class EditorGrid: public Component
+{
+    URHO3D_OBJECT(EditorGrid, Component);
+public:
+    EditorGrid(Context* context);
+    static void RegisterObject(Context* context);
+
+    /// Set the spacing of the finest grid, in world units.
+    void SetSpacing(float spacing);
+    void SetColor(const Color& color);
+    /// Rebuild the lines if the camera view is no longer covered.
+    void Update(Camera* camera);
+
+protected:
+    virtual void OnNodeSet(Node* node);
+
+private:
+    void Rebuild(const Rect& view, float step);
+
+    /// Finest line spacing.
+    float spacing_;
+    /// Most lines across the view before the spacing doubles.
+    float maxLines_;
+    Color color_;
+    /// Spacing and area of the current geometry.
+    float builtStep_;
+    Rect builtArea_;
+    WeakPtr<CustomGeometry> geometry_;
+    SharedPtr<Material> material_;
+};
@@ -0,0 +1,234 @@
+#include "EditorSpatialIndex.h"
+#include "Urho3D/Math/MathDefs.h"
+
+EditorSpatialIndex::EditorSpatialIndex(float cellSize) :
+    cellSize_(cellSize)
+{
+}
+
+unsigned EditorSpatialIndex::Insert(EditorEntityKind kind, void* object, unsigned index, const Rect& bounds)
+{
+    unsigned handle;
+    if(!freeHandles_.Empty())
+    {
+        handle = freeHandles_.Back();
+        freeHandles_.Pop();
+    }
+    else
+    {
+        handle = entities_.Size();
+        entities_.Resize(handle + 1);
+        used_.Push(0);
+    }
+
+    EditorEntity& entity = entities_[handle];
+    entity.kind_ = kind;
+    entity.object_ = object;
+    entity.index_ = index;
+    entity.bounds_ = bounds;
+    used_[handle] = 1;
+    AddToCells(handle);
+    return handle;
+}
+
+void EditorSpatialIndex::Move(unsigned handle, const Rect& bounds)
+{
+    int oldMinX, oldMinY, oldMaxX, oldMaxY;
+    int newMinX, newMinY, newMaxX, newMaxY;
+    GetCellRange(entities_[handle].bounds_, oldMinX, oldMinY, oldMaxX, oldMaxY);
+    GetCellRange(bounds, newMinX, newMinY, newMaxX, newMaxY);
+
+    // Most moves stay inside the same cells
+    if(oldMinX == newMinX && oldMinY == newMinY && oldMaxX == newMaxX && oldMaxY == newMaxY)
+    {
+        entities_[handle].bounds_ = bounds;
+        return;
+    }
+
+    RemoveFromCells(handle);
+    entities_[handle].bounds_ = bounds;
+    AddToCells(handle);
+}
+
+void EditorSpatialIndex::Remove(unsigned handle)
+{
+    if(handle >= entities_.Size() || !used_[handle])
+        return;
+    RemoveFromCells(handle);
+    used_[handle] = 0;
+    entities_[handle].object_ = 0;
+    freeHandles_.Push(handle);
+}
+
+void EditorSpatialIndex::Clear()
+{
+    cells_.Clear();
+    entities_.Clear();
+    used_.Clear();
+    freeHandles_.Clear();
+}
+
+bool EditorSpatialIndex::QueryPoint(const Vector2& point, unsigned kindMask, unsigned& handle) const
+{
+    HashMap<long long, PODVector<unsigned> >::ConstIterator cell = cells_.Find(CellKey(FloorToInt(point.x_ / cellSize_), FloorToInt(point.y_ / cellSize_)));
+    if(cell == cells_.End())
+        return false;
+
+    bool found = false;
+    float bestDistance = M_INFINITY;
+    const PODVector<unsigned>& items = cell->second_;
+    for(unsigned i = 0; i < items.Size(); i++)
+    {
+        const EditorEntity& entity = entities_[items[i]];
+        if(!(kindMask & (1 << entity.kind_)) || entity.bounds_.IsInside(point) == OUTSIDE)
+            continue;
+        float distance = (entity.bounds_.Center() - point).LengthSquared();
+        if(distance < bestDistance)
+        {
+            bestDistance = distance;
+            handle = items[i];
+            found = true;
+        }
+    }
+    return found;
+}
+
+void EditorSpatialIndex::QueryRect(const Rect& rect, unsigned kindMask, PODVector<unsigned>& handles) const
+{
+    int minX, minY, maxX, maxY;
+    GetCellRange(rect, minX, minY, maxX, maxY);
+
+    // Big queries walk the occupied cells instead of every cell in the range
+    long long rangeCells = (long long)(maxX - minX + 1) * (maxY - minY + 1);
+    if(rangeCells > (long long)cells_.Size())
+    {
+        for(HashMap<long long, PODVector<unsigned> >::ConstIterator i = cells_.Begin(); i != cells_.End(); i++)
+        {
+            int x = (int)(i->first_ >> 32);
+            int y = (int)(unsigned)i->first_;
+            if(x >= minX && x <= maxX && y >= minY && y <= maxY)
+                QueryCell(x, y, i->second_, rect, minX, minY, kindMask, handles);
+        }
+        return;
+    }
+
+    for(int y = minY; y <= maxY; y++)
+    {
+        for(int x = minX; x <= maxX; x++)
+        {
+            HashMap<long long, PODVector<unsigned> >::ConstIterator cell = cells_.Find(CellKey(x, y));
+            if(cell != cells_.End())
+                QueryCell(x, y, cell->second_, rect, minX, minY, kindMask, handles);
+        }
+    }
+}
+
+bool EditorSpatialIndex::QueryNearest(const Vector2& point, unsigned kindMask, float maxDistance, unsigned& handle) const
+{
+    int cx = FloorToInt(point.x_ / cellSize_);
+    int cy = FloorToInt(point.y_ / cellSize_);
+    int maxRing = CeilToInt(maxDistance / cellSize_) + 1;
+
+    bool found = false;
+    float bestDistance = maxDistance * maxDistance;
+    for(int ring = 0; ring <= maxRing; ring++)
+    {
+        for(int y = cy - ring; y <= cy + ring; y++)
+        {
+            // Only the border of the ring, the inside was done already
+            int step = (y == cy - ring || y == cy + ring) ? 1 : Max(ring * 2, 1);
+            for(int x = cx - ring; x <= cx + ring; x += step)
+            {
+                HashMap<long long, PODVector<unsigned> >::ConstIterator cell = cells_.Find(CellKey(x, y));
+                if(cell == cells_.End())
+                    continue;
+                const PODVector<unsigned>& items = cell->second_;
+                for(unsigned i = 0; i < items.Size(); i++)
+                {
+                    const EditorEntity& entity = entities_[items[i]];
+                    if(!(kindMask & (1 << entity.kind_)))
+                        continue;
+                    float dx = Max(Max(entity.bounds_.min_.x_ - point.x_, point.x_ - entity.bounds_.max_.x_), 0.0f);
+                    float dy = Max(Max(entity.bounds_.min_.y_ - point.y_, point.y_ - entity.bounds_.max_.y_), 0.0f);
+                    float distance = dx * dx + dy * dy;
+                    if(distance <= bestDistance)
+                    {
+                        bestDistance = distance;
+                        handle = items[i];
+                        found = true;
+                    }
+                }
+            }
+        }
+
+        // Anything not seen yet lives in outer rings, at least ring cells away
+        float ringDistance = ring * cellSize_;
+        if(found && bestDistance <= ringDistance * ringDistance)
+            break;
+    }
+    return found;
+}
+
+void EditorSpatialIndex::QueryCell(int x, int y, const PODVector<unsigned>& items, const Rect& rect, int minX, int minY, unsigned kindMask, PODVector<unsigned>& handles) const
+{
+    for(unsigned i = 0; i < items.Size(); i++)
+    {
+        const EditorEntity& entity = entities_[items[i]];
+        if(!(kindMask & (1 << entity.kind_)))
+            continue;
+        const Rect& bounds = entity.bounds_;
+        if(bounds.max_.x_ < rect.min_.x_ || bounds.min_.x_ > rect.max_.x_ || bounds.max_.y_ < rect.min_.y_ || bounds.min_.y_ > rect.max_.y_)
+            continue;
+        int entityMinX, entityMinY, entityMaxX, entityMaxY;
+        GetCellRange(bounds, entityMinX, entityMinY, entityMaxX, entityMaxY);
+        if(x == Max(minX, entityMinX) && y == Max(minY, entityMinY))
+            handles.Push(items[i]);
+    }
+}
+
+void EditorSpatialIndex::GetCellRange(const Rect& bounds, int& minX, int& minY, int& maxX, int& maxY) const
+{
+    minX = FloorToInt(bounds.min_.x_ / cellSize_);
+    minY = FloorToInt(bounds.min_.y_ / cellSize_);
+    maxX = FloorToInt(bounds.max_.x_ / cellSize_);
+    maxY = FloorToInt(bounds.max_.y_ / cellSize_);
+}
+
+void EditorSpatialIndex::AddToCells(unsigned handle)
+{
+    int minX, minY, maxX, maxY;
+    GetCellRange(entities_[handle].bounds_, minX, minY, maxX, maxY);
+    for(int y = minY; y <= maxY; y++)
+    {
+        for(int x = minX; x <= maxX; x++)
+            cells_[CellKey(x, y)].Push(handle);
+    }
+}
+
+void EditorSpatialIndex::RemoveFromCells(unsigned handle)
+{
+    int minX, minY, maxX, maxY;
+    GetCellRange(entities_[handle].bounds_, minX, minY, maxX, maxY);
+    for(int y = minY; y <= maxY; y++)
+    {
+        for(int x = minX; x <= maxX; x++)
+        {
+            HashMap<long long, PODVector<unsigned> >::Iterator cell = cells_.Find(CellKey(x, y));
+            if(cell == cells_.End())
+                continue;
+            PODVector<unsigned>& items = cell->second_;
+            for(unsigned i = 0; i < items.Size(); i++)
+            {
+                if(items[i] == handle)
+                {
+                    // Order inside a cell doesn't matter
+                    items[i] = items.Back();
+                    items.Pop();
+                    break;
+                }
+            }
+            if(items.Empty())
+                cells_.Erase(cell);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Urho3D/Container/HashMap.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Math/Rect.h"
+
+using namespace Urho3D;
+
+/// Kind of editor object kept in the spatial index.
+enum EditorEntityKind
+{
+    ENTITY_VERTEX = 0,
+    ENTITY_PLATFORM,
+    ENTITY_MOVPLATFORM,
+    ENTITY_ENEMY,
+    ENTITY_PREFAB
+};
+
+/// Mask matching every kind.
+static const unsigned ENTITY_ALL = 0xffffffff;
+
+/// One pickable editor object. object_ and index_ identify it to the owner, e.g. a polygon and the vertex number.
+struct EditorEntity
+{
+    EditorEntityKind kind_;
+    void* object_;
+    unsigned index_;
+    Rect bounds_;
+};
+
+/// Uniform grid over the editor plane used for picking instead of physics queries. Objects larger than a cell are
+/// stored in every cell they overlap.
+class EditorSpatialIndex
+{
+public:
+    EditorSpatialIndex(float cellSize = 0.7f);
+
+    /// Add an object and return its handle.
+    unsigned Insert(EditorEntityKind kind, void* object, unsigned index, const Rect& bounds);
+    /// Update the bounds of an object.
+    void Move(unsigned handle, const Rect& bounds);
+    /// Remove an object. The handle may be reused by later inserts.
+    void Remove(unsigned handle);
+    /// Remove everything.
+    void Clear();
+
+    /// Return the object with the given handle.
+    EditorEntity& GetEntity(unsigned handle) { return entities_[handle]; }
+    /// Find the object of one of the kinds in kindMask whose bounds contain the point, closest center first.
+    bool QueryPoint(const Vector2& point, unsigned kindMask, unsigned& handle) const;
+    /// Append every object of the masked kinds whose bounds overlap the rect. Each object is reported once.
+    void QueryRect(const Rect& rect, unsigned kindMask, PODVector<unsigned>& handles) const;
+    /// Find the object of the masked kinds whose bounds are closest to the point, up to maxDistance away.
+    bool QueryNearest(const Vector2& point, unsigned kindMask, float maxDistance, unsigned& handle) const;
+    /// Number of objects in the index.
+    unsigned GetNumEntities() const { return entities_.Size() - freeHandles_.Size(); }
+
+private:
+    /// Range of cells covered by a rect.
+    void GetCellRange(const Rect& bounds, int& minX, int& minY, int& maxX, int& maxY) const;
+    /// Check one cell for QueryRect, reporting objects only from the first cell where they overlap the query.
+    void QueryCell(int x, int y, const PODVector<unsigned>& items, const Rect& rect, int minX, int minY, unsigned kindMask, PODVector<unsigned>& handles) const;
+    void AddToCells(unsigned handle);
+    void RemoveFromCells(unsigned handle);
+    long long CellKey(int x, int y) const { return ((long long)x << 32) | (unsigned)y; }
+
+    float cellSize_;
+    HashMap<long long, PODVector<unsigned> > cells_;
+    PODVector<EditorEntity> entities_;
+    PODVector<unsigned char> used_;
+    PODVector<unsigned> freeHandles_;
+};
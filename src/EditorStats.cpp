@@ -0,0 +1,90 @@
+#include "EditorStats.h"
+#include "Urho3D/Container/Sort.h"
+#include "Urho3D/IO/File.h"
+
+static const char* sectionNames[] = {
+    "update",
+    "grid",
+    "drawpolygon",
+    "process",
+    "physics",
+    "save",
+    "load",
+    "mousedown",
+    "mousemove",
+    "mouseup",
+    "stream",
+    "frame"
+};
+
+static const unsigned NUM_COLUMNS = MAX_STAT_SECTIONS + 1;
+
+EditorStats::EditorStats(unsigned historySize) :
+    historySize_(Max(historySize, 1U)),
+    frameCount_(0)
+{
+    history_.Resize(historySize_ * NUM_COLUMNS);
+    for(unsigned i = 0; i < MAX_STAT_SECTIONS; i++)
+        current_[i] = 0;
+}
+
+void EditorStats::NextFrame(float frameTime)
+{
+    float* row = &history_[(frameCount_ % historySize_) * NUM_COLUMNS];
+    for(unsigned i = 0; i < MAX_STAT_SECTIONS; i++)
+    {
+        row[i] = current_[i] / 1000.0f;
+        current_[i] = 0;
+    }
+    row[MAX_STAT_SECTIONS] = frameTime * 1000.0f;
+    frameCount_++;
+}
+
+void EditorStats::GetSummary(unsigned section, float& average, float& p99) const
+{
+    average = 0.0f;
+    p99 = 0.0f;
+    unsigned numFrames = GetNumFrames();
+    if(!numFrames)
+        return;
+
+    PODVector<float> samples(numFrames);
+    float total = 0.0f;
+    for(unsigned i = 0; i < numFrames; i++)
+    {
+        samples[i] = history_[i * NUM_COLUMNS + section];
+        total += samples[i];
+    }
+    Sort(samples.Begin(), samples.End());
+    average = total / numFrames;
+    p99 = samples[Min((unsigned)(numFrames * 0.99f), numFrames - 1)];
+}
+
+bool EditorStats::SaveCSV(Context* context, const String& fileName) const
+{
+    File file(context, fileName, FILE_WRITE);
+    if(!file.IsOpen())
+        return false;
+
+    String line = "frameindex";
+    for(unsigned i = 0; i < NUM_COLUMNS; i++)
+        line += String(",") + sectionNames[i];
+    file.WriteLine(line);
+
+    unsigned numFrames = GetNumFrames();
+    unsigned first = frameCount_ - numFrames;
+    for(unsigned i = 0; i < numFrames; i++)
+    {
+        const float* row = &history_[((first + i) % historySize_) * NUM_COLUMNS];
+        line = String(first + i);
+        for(unsigned j = 0; j < NUM_COLUMNS; j++)
+            line += "," + String(row[j]);
+        file.WriteLine(line);
+    }
+    return true;
+}
+
+const char* EditorStats::GetSectionName(unsigned section)
+{
+    return section < NUM_COLUMNS ? sectionNames[section] : "";
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Core/Profiler.h"
+#include "Urho3D/Core/Timer.h"
+#include "Urho3D/Math/MathDefs.h"
+
+using namespace Urho3D;
+
+/// Timed sections of an editor frame.
+enum EditorStatSection
+{
+    STAT_UPDATE = 0,
+    STAT_GRID,
+    STAT_DRAWPOLYGON,
+    STAT_PROCESS,
+    STAT_PHYSICS,
+    STAT_SAVE,
+    STAT_LOAD,
+    STAT_MOUSEDOWN,
+    STAT_MOUSEMOVE,
+    STAT_MOUSEUP,
+    STAT_STREAM,
+    MAX_STAT_SECTIONS
+};
+
+/// Per frame timings of the editor hot paths, kept for the last historySize frames.
+class EditorStats
+{
+public:
+    EditorStats(unsigned historySize = 600);
+
+    /// Close the current frame with its total time and start a new one.
+    void NextFrame(float frameTime);
+    /// Add time spent in a section to the current frame.
+    void AddSample(EditorStatSection section, long long usec) { current_[section] += usec; }
+
+    /// Average and 99th percentile of a section over the history, in milliseconds. Section MAX_STAT_SECTIONS is the
+    /// whole frame.
+    void GetSummary(unsigned section, float& average, float& p99) const;
+    /// Number of frames in the history.
+    unsigned GetNumFrames() const { return Min(frameCount_, historySize_); }
+    /// Write the history to CSV, oldest frame first. Returns false if the file couldn't be written.
+    bool SaveCSV(Context* context, const String& fileName) const;
+
+    static const char* GetSectionName(unsigned section);
+
+private:
+    /// Ring buffer of frames, MAX_STAT_SECTIONS + 1 columns in milliseconds with the frame time last.
+    PODVector<float> history_;
+    long long current_[MAX_STAT_SECTIONS];
+    unsigned historySize_;
+    unsigned frameCount_;
+};
+
+/// Times a scope into EditorStats.
+class EditorStatScope
+{
+public:
+    EditorStatScope(EditorStats& stats, EditorStatSection section) :
+        stats_(stats),
+        section_(section)
+    {
+    }
+    ~EditorStatScope() { stats_.AddSample(section_, timer_.GetUSec(false)); }
+
+private:
+    EditorStats& stats_;
+    EditorStatSection section_;
+    HiresTimer timer_;
+};
+
+/// Time a section for the editor HUD and the engine profiler.
+#define EDITOR_PROFILE(section) URHO3D_PROFILE(section); EditorStatScope editorStatScope_##section(stats_, STAT_##section)
@@ -0,0 +1,158 @@
+#include "EntityRegistry.h"
+#include "ObjectData.h"
+#include "PlatformData.h"
+#include "PrefabData.h"
+
+static const char* entityTypeNames[] = {
+    "platform",
+    "midleplatform",
+    "movplatform",
+    "enemy",
+    "npc",
+    "prefab"
+};
+
+static const unsigned INDEX_MASK = (1 << ENTITY_INDEX_BITS) - 1;
+
+const char* GetEntityTypeName(EntityType type)
+{
+    return type < MAX_ENTITY_TYPES ? entityTypeNames[type] : "";
+}
+
+EntityType GetEntityType(const String& name)
+{
+    for(unsigned i = 0; i < MAX_ENTITY_TYPES; i++)
+    {
+        if(name == entityTypeNames[i])
+            return (EntityType)i;
+    }
+    return MAX_ENTITY_TYPES;
+}
+
+template <class T> static void PushEntity(PODVector<T*>& entities, T* entity)
+{
+    entity->AddRef();
+    entity->index = entities.Size();
+    entities.Push(entity);
+}
+
+template <class T> static bool RemoveEntity(PODVector<T*>& entities, T* entity)
+{
+    if(entity->index >= entities.Size() || entities[entity->index] != entity)
+        return false;
+    T* last = entities.Back();
+    entities[entity->index] = last;
+    last->index = entity->index;
+    entities.Pop();
+    entity->index = M_MAX_UNSIGNED;
+    entity->ReleaseRef();
+    return true;
+}
+
+template <class T> static void ClearEntities(PODVector<T*>& entities)
+{
+    for(unsigned i = 0; i < entities.Size(); i++)
+        entities[i]->ReleaseRef();
+    entities.Clear();
+}
+
+EntityRegistry::~EntityRegistry()
+{
+    Clear();
+}
+
+void EntityRegistry::Add(PlatformData* platform)
+{
+    PushEntity(platforms_[platform->type], platform);
+}
+
+void EntityRegistry::Add(ObjectData* object)
+{
+    PushEntity(objects_[object->type - FIRST_OBJECT_TYPE], object);
+}
+
+void EntityRegistry::Add(PrefabInstance* instance)
+{
+    PushEntity(instances_, instance);
+}
+
+bool EntityRegistry::Remove(PlatformData* platform)
+{
+    return RemoveEntity(platforms_[platform->type], platform);
+}
+
+bool EntityRegistry::Remove(ObjectData* object)
+{
+    return RemoveEntity(objects_[object->type - FIRST_OBJECT_TYPE], object);
+}
+
+bool EntityRegistry::Remove(PrefabInstance* instance)
+{
+    return RemoveEntity(instances_, instance);
+}
+
+void EntityRegistry::Clear()
+{
+    for(unsigned i = 0; i < FIRST_OBJECT_TYPE; i++)
+        ClearEntities(platforms_[i]);
+    for(unsigned i = 0; i < ENTITY_TYPE_PREFAB - FIRST_OBJECT_TYPE; i++)
+        ClearEntities(objects_[i]);
+    ClearEntities(instances_);
+}
+
+unsigned EntityRegistry::GetNumPlatforms() const
+{
+    unsigned count = 0;
+    for(unsigned i = 0; i < FIRST_OBJECT_TYPE; i++)
+        count += platforms_[i].Size();
+    return count;
+}
+
+unsigned EntityRegistry::GetNumObjects() const
+{
+    unsigned count = 0;
+    for(unsigned i = 0; i < ENTITY_TYPE_PREFAB - FIRST_OBJECT_TYPE; i++)
+        count += objects_[i].Size();
+    return count;
+}
+
+unsigned EntityRegistry::GetReference(const PlatformData* platform)
+{
+    return (unsigned)platform->type << ENTITY_INDEX_BITS | platform->index;
+}
+
+unsigned EntityRegistry::GetReference(const ObjectData* object)
+{
+    return (unsigned)object->type << ENTITY_INDEX_BITS | object->index;
+}
+
+unsigned EntityRegistry::GetReference(const PrefabInstance* instance)
+{
+    return (unsigned)ENTITY_TYPE_PREFAB << ENTITY_INDEX_BITS | instance->index;
+}
+
+PlatformData* EntityRegistry::FindPlatform(unsigned reference) const
+{
+    unsigned type = reference >> ENTITY_INDEX_BITS;
+    unsigned index = reference & INDEX_MASK;
+    if(type >= FIRST_OBJECT_TYPE || index >= platforms_[type].Size())
+        return 0;
+    return platforms_[type][index];
+}
+
+ObjectData* EntityRegistry::FindObject(unsigned reference) const
+{
+    unsigned type = reference >> ENTITY_INDEX_BITS;
+    unsigned index = reference & INDEX_MASK;
+    if(type < FIRST_OBJECT_TYPE || type >= ENTITY_TYPE_PREFAB || index >= objects_[type - FIRST_OBJECT_TYPE].Size())
+        return 0;
+    return objects_[type - FIRST_OBJECT_TYPE][index];
+}
+
+PrefabInstance* EntityRegistry::FindInstance(unsigned reference) const
+{
+    unsigned index = reference & INDEX_MASK;
+    if(reference >> ENTITY_INDEX_BITS != ENTITY_TYPE_PREFAB || index >= instances_.Size())
+        return 0;
+    return instances_[index];
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+
+using namespace Urho3D;
+
+class PlatformData;
+class ObjectData;
+class PrefabInstance;
+
+/// Type tag of a placed platform, object or prefab instance. Platform tags equal their MapPlatformType.
+enum EntityType
+{
+    ENTITY_TYPE_PLATFORM = 0,
+    ENTITY_TYPE_MIDLEPLATFORM,
+    ENTITY_TYPE_MOVPLATFORM,
+    ENTITY_TYPE_ENEMY,
+    ENTITY_TYPE_NPC,
+    /// Prefab instances, after the object tags.
+    ENTITY_TYPE_PREFAB,
+    MAX_ENTITY_TYPES
+};
+
+/// Tags below this one are platforms, the rest up to ENTITY_TYPE_PREFAB objects.
+static const unsigned FIRST_OBJECT_TYPE = ENTITY_TYPE_ENEMY;
+/// Journal records refer to an entity by its type above ENTITY_INDEX_BITS and its registry index below.
+static const unsigned ENTITY_INDEX_BITS = 24;
+
+/// Name of a type in the map files, e.g. "movplatform" or "enemy".
+const char* GetEntityTypeName(EntityType type);
+/// Type with a name, MAX_ENTITY_TYPES if there is none.
+EntityType GetEntityType(const String& name);
+
+/// Platforms, objects and prefab instances of the map, in one dense list per type. Removing one moves the last of its type into its
+/// place, entities keep their position in the list so that takes no search. The registry holds a reference to every entity, only
+/// resident ones are also attached to a scene node.
+class EntityRegistry
+{
+public:
+    ~EntityRegistry();
+
+    /// Add an entity under its type and take a reference to it.
+    void Add(PlatformData* platform);
+    void Add(ObjectData* object);
+    void Add(PrefabInstance* instance);
+    /// Remove an entity and drop the reference, which destroys it unless its node still holds it. Returns false if it isn't
+    /// registered.
+    bool Remove(PlatformData* platform);
+    bool Remove(ObjectData* object);
+    bool Remove(PrefabInstance* instance);
+    /// Drop every entity. Resident ones live until their node is removed.
+    void Clear();
+
+    /// Platforms of a platform type.
+    const PODVector<PlatformData*>& GetPlatforms(EntityType type) const { return platforms_[type]; }
+    /// Objects of an object type.
+    const PODVector<ObjectData*>& GetObjects(EntityType type) const { return objects_[type - FIRST_OBJECT_TYPE]; }
+    const PODVector<PrefabInstance*>& GetInstances() const { return instances_; }
+    unsigned GetNumPlatforms() const;
+    unsigned GetNumObjects() const;
+
+    /// Journal reference of a registered entity.
+    static unsigned GetReference(const PlatformData* platform);
+    static unsigned GetReference(const ObjectData* object);
+    static unsigned GetReference(const PrefabInstance* instance);
+    /// Entity with a journal reference, null if there is none.
+    PlatformData* FindPlatform(unsigned reference) const;
+    ObjectData* FindObject(unsigned reference) const;
+    PrefabInstance* FindInstance(unsigned reference) const;
+
+private:
+    PODVector<PlatformData*> platforms_[FIRST_OBJECT_TYPE];
+    PODVector<ObjectData*> objects_[ENTITY_TYPE_PREFAB - FIRST_OBJECT_TYPE];
+    PODVector<PrefabInstance*> instances_;
+};
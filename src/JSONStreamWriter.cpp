@@ -0,0 +1,190 @@
+#include "JSONStreamWriter.h"
+#include "Urho3D/IO/Log.h"
+#include "Urho3D/Math/MathDefs.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+JSONStreamWriter::JSONStreamWriter(Serializer& dest, unsigned bufferSize) :
+    dest_(dest),
+    used_(0),
+    afterKey_(false),
+    ok_(true)
+{
+    buffer_.Resize(bufferSize < 64 ? 64 : bufferSize);
+}
+
+JSONStreamWriter::~JSONStreamWriter()
+{
+    Flush();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Begin('{');
+}
+
+void JSONStreamWriter::EndObject()
+{
+    End('}');
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Begin('[');
+}
+
+void JSONStreamWriter::EndArray()
+{
+    End(']');
+}
+
+void JSONStreamWriter::Key(const char* key)
+{
+    BeginValue();
+    WriteString(key, (unsigned)strlen(key));
+    Write(": ", 2);
+    afterKey_ = true;
+}
+
+void JSONStreamWriter::Value(float value)
+{
+    BeginValue();
+    // JSON has no NaN or infinity, the loader couldn't read them back
+    if(IsNaN(value) || IsNaN(value - value))
+    {
+        URHO3D_LOGWARNING("Writing a non finite float as 0");
+        Write('0');
+        return;
+    }
+    // Shortest text that reads back as the same float, so 18.2f stays "18.2"
+    char text[32];
+    for(int precision = 6; precision <= 9; precision++)
+    {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if(strtof(text, 0) == value)
+            break;
+    }
+    Write(text, (unsigned)strlen(text));
+}
+
+void JSONStreamWriter::Value(unsigned value)
+{
+    BeginValue();
+    char text[16];
+    snprintf(text, sizeof(text), "%u", value);
+    Write(text, (unsigned)strlen(text));
+}
+
+void JSONStreamWriter::Value(bool value)
+{
+    BeginValue();
+    if(value)
+        Write("true", 4);
+    else
+        Write("false", 5);
+}
+
+void JSONStreamWriter::Value(const String& value)
+{
+    BeginValue();
+    WriteString(value.CString(), value.Length());
+}
+
+void JSONStreamWriter::WriteString(const char* text, unsigned length)
+{
+    Write('"');
+    for(unsigned i = 0; i < length; i++)
+    {
+        char c = text[i];
+        if(c == '"' || c == '\\')
+        {
+            Write('\\');
+            Write(c);
+        }
+        else if((unsigned char)c < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", (unsigned)c);
+            Write(escape, 6);
+        }
+        else
+            Write(c);
+    }
+    Write('"');
+}
+
+bool JSONStreamWriter::Flush()
+{
+    if(used_)
+    {
+        if(dest_.Write(&buffer_[0], used_) != used_)
+            ok_ = false;
+        used_ = 0;
+    }
+    return ok_;
+}
+
+void JSONStreamWriter::BeginValue()
+{
+    if(afterKey_)
+    {
+        afterKey_ = false;
+        return;
+    }
+    if(counts_.Empty())
+        return;
+    if(counts_.Back()++)
+        Write(',');
+    NewLine();
+}
+
+void JSONStreamWriter::Begin(char bracket)
+{
+    BeginValue();
+    Write(bracket);
+    counts_.Push(0);
+}
+
+void JSONStreamWriter::End(char bracket)
+{
+    bool empty = !counts_.Back();
+    counts_.Pop();
+    if(!empty)
+        NewLine();
+    Write(bracket);
+    if(counts_.Empty())
+        Write('\n');
+}
+
+void JSONStreamWriter::NewLine()
+{
+    Write('\n');
+    for(unsigned i = 0; i < counts_.Size(); i++)
+        Write('\t');
+}
+
+void JSONStreamWriter::Write(const char* data, unsigned size)
+{
+    if(used_ + size > buffer_.Size())
+    {
+        Flush();
+        // Too big for the buffer even when empty, goes out as is
+        if(size > buffer_.Size())
+        {
+            if(dest_.Write(data, size) != size)
+                ok_ = false;
+            return;
+        }
+    }
+    memcpy(&buffer_[used_], data, size);
+    used_ += size;
+}
+
+void JSONStreamWriter::Write(char c)
+{
+    if(used_ == buffer_.Size())
+        Flush();
+    buffer_[used_++] = c;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/IO/Serializer.h"
+
+using namespace Urho3D;
+
+/// Writes JSON straight to a Serializer through a fixed size buffer, so saving a map never holds more than the
+/// buffer and the nesting stack in memory. Output is tab indented like JSONFile::Save.
+class JSONStreamWriter
+{
+public:
+    JSONStreamWriter(Serializer& dest, unsigned bufferSize = 65536);
+    /// Flush what is left in the buffer.
+    ~JSONStreamWriter();
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /// Name the next value of the current object.
+    void Key(const char* key);
+    void Value(float value);
+    void Value(unsigned value);
+    void Value(bool value);
+    void Value(const String& value);
+
+    /// Write the buffer out. Returns false if any write so far came up short.
+    bool Flush();
+    bool IsOk() const { return ok_; }
+
+private:
+    /// Comma and indentation before a new value or key.
+    void BeginValue();
+    void Begin(char bracket);
+    void End(char bracket);
+    void NewLine();
+    /// Quoted and escaped string, no separator.
+    void WriteString(const char* text, unsigned length);
+    void Write(const char* data, unsigned size);
+    void Write(char c);
+
+    Serializer& dest_;
+    PODVector<char> buffer_;
+    unsigned used_;
+    /// Number of values written so far at each open level.
+    PODVector<unsigned> counts_;
+    /// A key was written and its value is next.
+    bool afterKey_;
+    bool ok_;
+};
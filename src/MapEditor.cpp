@@ -13,6 +13,7 @@
 #include "Urho3D/UI/LineEdit.h"
 #include "Urho3D/Graphics/Renderer.h"
 #include "Urho3D/Resource/ResourceCache.h"
+#include "Urho3D/Resource/ResourceEvents.h"
 #include "Urho3D/Scene/Scene.h"
 #include "Urho3D/Urho2D/Sprite2D.h"
 #include "Urho3D/Graphics/DebugRenderer.h"
@@ -27,6 +28,12 @@
 #include "Urho3D/UI/DropDownList.h"
 #include "Urho3D/UI/ListView.h"
 #include "Urho3D/Resource/JSONFile.h"
+#include "Urho3D/Container/Sort.h"
+#include "Urho3D/IO/Log.h"
+#include "Urho3D/IO/FileSystem.h"
+#include "Urho3D/Core/ProcessUtils.h"
+#include "Urho3D/Core/StringUtils.h"
+#include "Urho3D/Core/WorkQueue.h"
 #include "Urho3D/Urho2D/TmxFile2D.h"
 #include "Urho3D/Urho2D/TileMap2D.h"
 #include "Urho3D/Urho2D/TileMapLayer2D.h"
@@ -38,56 +45,258 @@
 
 #include "PlatformData.h"
 #include "ObjectData.h"
+#include "PrefabData.h"
 
 // Librerias Box2D
 #include "Urho3D/Urho2D/CollisionBox2D.h"
-#include "Urho3D/Urho2D/CollisionCircle2D.h"
+#include "Urho3D/Urho2D/CollisionChain2D.h"
 #include "Urho3D/Urho2D/CollisionEdge2D.h"
 #include "Urho3D/Urho2D/CollisionPolygon2D.h"
 #include "Urho3D/Urho2D/RigidBody2D.h"
 
 #include "MapEditor.h"
 
+#include <cstring>
+
 URHO3D_DEFINE_APPLICATION_MAIN(MapEditor)
 
+/// Half size of a polygon vertex handle, for drawing and picking.
+static const float VERTEX_PICK_RADIUS = 0.1f;
+/// Distance the mouse moves before the lasso gets another point.
+static const float LASSO_STEP = 0.1f;
+/// Kinds a rectangle or lasso selects.
+static const unsigned SELECTABLE_KINDS = (1 << ENTITY_VERTEX) | (1 << ENTITY_PLATFORM) | (1 << ENTITY_MOVPLATFORM) | (1 << ENTITY_ENEMY) |
+    (1 << ENTITY_PREFAB);
+/// Journal size that starts a background save to compact it.
+static const unsigned JOURNAL_COMPACT_RECORDS = 4096;
+
 MapEditor::MapEditor(Context* context) :
     Sample(context),
     uiRoot_(GetSubsystem<UI>()->GetRoot()),
-    dragBeginPosition_(IntVector2::ZERO)
+    dragBeginPosition_(IntVector2::ZERO),
+    journal_(context),
+    compactAt_(JOURNAL_COMPACT_RECORDS),
+    fileList_(new VirtualList(context)),
+    polygonList_(new VirtualList(context))
 {
-	PolygonVertex::RegisterObject(context);
 	PlatformData::RegisterObject(context);
 	ObjectData::RegisterObject(context);
+	PrefabInstance::RegisterObject(context);
+	EditorGrid::RegisterObject(context);
+}
+
+MapEditor::~MapEditor()
+{
+    // Let a save or startup parse in flight finish, their jobs are owned here
+    if(saveItem_ || startupItem_)
+    {
+        UnsubscribeFromEvent(E_WORKITEMCOMPLETED);
+        GetSubsystem<WorkQueue>()->Complete(0);
+    }
+    delete saveJob_;
+    delete startupJob_;
+    delete overlay_;
+}
+
+void MapEditor::Setup()
+{
+    Sample::Setup();
+
+    const Vector<String>& arguments = GetArguments();
+    for(unsigned i = 0; i < arguments.Size(); i++)
+    {
+        String argument = arguments[i].ToLower();
+        if(argument == "-batch")
+            batchMode_ = true;
+        else if(argument == "-map" && i + 1 < arguments.Size())
+            mapDir_ = AddTrailingSlash(arguments[++i]);
+        else if(argument == "-out" && i + 1 < arguments.Size())
+            outputDir_ = AddTrailingSlash(arguments[++i]);
+        else if(argument == "-tmx" && i + 1 < arguments.Size())
+            tmxName_ = arguments[++i];
+        else if(argument == "-flatten")
+            flattenPrefabs_ = true;
+        else if(argument == "-convert" && i + 1 < arguments.Size())
+        {
+            convertTo_ = arguments[++i].ToLower();
+            batchMode_ = true;
+        }
+        else if(argument == "-tmxencode" && i + 1 < arguments.Size())
+        {
+            tmxEncoding_ = arguments[++i].ToLower();
+            batchMode_ = true;
+        }
+    }
+
+    // No window, no GPU, just load, process, save and exit
+    if(batchMode_)
+    {
+        engineParameters_["Headless"] = true;
+        chunks_.SetEnabled(false);
+        if(outputDir_.Empty())
+            outputDir_ = mapDir_;
+    }
+    // A flattened save drops the instances later journal records refer to, so the editor never flattens
+    else
+        flattenPrefabs_ = false;
 }
 
 void MapEditor::Start()
 {
+    if(batchMode_)
+    {
+        if(!tmxEncoding_.Empty())
+            RunTmxEncode();
+        else if(convertTo_.Empty())
+            RunBatch();
+        else
+            RunConvert();
+        return;
+    }
+
     // Execute base class startup
     Sample::Start();
 
-    // Create the scene content
-    CreateScene();
+    // Enable OS cursor
+    GetSubsystem<Input>()->SetMouseVisible(true);
 
-    CreatePreviewScene();
+    // The scene and window are built in FinishStartup once everything below has arrived
+    StartLoading();
+}
 
-    // Setup the viewport for displaying the scene
-    SetupViewport();
+template <class T> static void BackgroundLoad(ResourceCache* cache, const String& name, HashSet<String>& pending)
+{
+    // Already loaded resources are not queued and send no event
+    if(cache->BackgroundLoadResource<T>(name))
+        pending.Insert(name);
+}
 
-    // Enable OS cursor
-    GetSubsystem<Input>()->SetMouseVisible(true);
+static bool ExpandTmxFile(Context* context, Deserializer& source, VectorBuffer& dest)
+{
+    XMLFile tmx(context);
+    return tmx.Load(source) && ExpandTmx(tmx) && tmx.Save(dest, " ");
+}
+
+static void StartupWork(const WorkItem* item, unsigned threadIndex)
+{
+    StartupJob& job = *reinterpret_cast<StartupJob*>(item->aux_);
+    HiresTimer timer;
+    job.mapLoaded_ = LoadMapSnapshot(job.context_, job.mapDir_, job.snapshot_);
+    job.mapTime_ = timer.GetUSec(true) / 1000.0f;
 
-    // Load XML file containing default UI style sheet
+    if(!job.tmxName_.Empty())
+    {
+        SharedPtr<File> tmx = job.context_->GetSubsystem<ResourceCache>()->GetFile(job.tmxName_, false);
+        job.tmxExpanded_ = tmx && ExpandTmxFile(job.context_, *tmx, job.tmx_);
+        job.tmxTime_ = timer.GetUSec(true) / 1000.0f;
+    }
+
+    File file(job.context_, "Data/Scenes/map_editor.json");
+    job.menu_ = new JSONFile(job.context_);
+    if(!file.IsOpen() || !job.menu_->Load(file))
+        job.menu_.Reset();
+    job.menuTime_ = timer.GetUSec(true) / 1000.0f;
+}
+
+void MapEditor::StartLoading()
+{
+    startupTimer_.Reset();
+    SubscribeToEvent(E_RESOURCEBACKGROUNDLOADED, URHO3D_HANDLER(MapEditor, HandleStartupResource));
+    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(MapEditor, HandleWorkItemCompleted));
+
+    // Resources are read and parsed on the background loader thread, only their GPU upload is left to the frames
     ResourceCache* cache = GetSubsystem<ResourceCache>();
-    XMLFile* style = cache->GetResource<XMLFile>("UI/DefaultStyle.xml");
+    pendingResources_.Clear();
+    BackgroundLoad<XMLFile>(cache, "UI/DefaultStyle.xml", pendingResources_);
+    BackgroundLoad<XMLFile>(cache, "UI/map_editor.xml", pendingResources_);
+    BackgroundLoad<SpriteSheet2D>(cache, "Urho2D/tileset.xml", pendingResources_);
+    // TmxFile2D can't read compressed layers, those tile maps are expanded on the worker instead
+    SharedPtr<File> tmx = cache->GetFile(tmxName_, false);
+    bool expandTmx = tmx && IsTmxCompressed(*tmx);
+    tmx.Reset();
+    if(!expandTmx)
+        BackgroundLoad<TmxFile2D>(cache, tmxName_, pendingResources_);
+    BackgroundLoad<AnimationSet2D>(cache, "Urho2D/gladiador.scml", pendingResources_);
+    BackgroundLoad<Sprite2D>(cache, "Urho2D/backgroung.png", pendingResources_);
+    BackgroundLoad<Sprite2D>(cache, "Urho2D/object.png", pendingResources_);
+    BackgroundLoad<Sprite2D>(cache, "Urho2D/movplatform.png", pendingResources_);
+
+    // Meanwhile the map files and the menu JSON are parsed on a worker
+    startupJob_ = new StartupJob();
+    startupJob_->context_ = context_;
+    startupJob_->mapDir_ = mapDir_;
+    startupJob_->mapLoaded_ = false;
+    startupJob_->tmxName_ = expandTmx ? tmxName_ : String::EMPTY;
+    startupJob_->tmxExpanded_ = false;
+    startupJob_->mapTime_ = 0.0f;
+    startupJob_->tmxTime_ = 0.0f;
+    startupJob_->menuTime_ = 0.0f;
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    startupItem_ = queue->GetFreeItem();
+    startupItem_->priority_ = 0;
+    startupItem_->sendEvent_ = true;
+    startupItem_->workFunction_ = StartupWork;
+    startupItem_->aux_ = startupJob_;
+    queue->AddWorkItem(startupItem_);
+}
 
-    // Set the loaded style as default style
-    uiRoot_->SetDefaultStyle(style);
+void MapEditor::HandleStartupResource(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ResourceBackgroundLoaded;
+
+    // Textures of the sprite sheet and the tile map and the sprites of the animation set load as dependencies
+    // and send this too, only the queued resources count
+    const String& name = eventData[P_RESOURCENAME].GetString();
+    if(!pendingResources_.Erase(name))
+        return;
+    if(!eventData[P_SUCCESS].GetBool())
+        URHO3D_LOGWARNING("Could not load " + name);
+    if(!pendingResources_.Empty())
+        return;
+    resourcesTime_ = startupTimer_.GetUSec(false) / 1000.0f;
+    FinishStartup();
+}
+
+void MapEditor::FinishStartup()
+{
+    if(!pendingResources_.Empty() || startupItem_ || !startupJob_)
+        return;
 
-    // Initialize Window
+    HiresTimer timer;
+    float parsedTime = startupTimer_.GetUSec(false) / 1000.0f;
+    if(startupJob_->tmxExpanded_)
+        AddExpandedTmx(startupJob_->tmx_);
+    CreateScene();
+    CreatePreviewScene();
+    SetupViewport();
+    float sceneTime = timer.GetUSec(true) / 1000.0f;
+
+    uiRoot_->SetDefaultStyle(GetSubsystem<ResourceCache>()->GetResource<XMLFile>("UI/DefaultStyle.xml"));
+    if(startupJob_->menu_)
+        rootjson = startupJob_->menu_->GetRoot();
+    else
+        URHO3D_LOGWARNING("Could not load Data/Scenes/map_editor.json");
     InitWindow();
+    float windowTime = timer.GetUSec(true) / 1000.0f;
+
+    // Pick up where the last session left off, including edits it never saved
+    {
+        EDITOR_PROFILE(LOAD);
+        ApplyLoadedMap(startupJob_->snapshot_, startupJob_->mapLoaded_);
+    }
+    float mapTime = timer.GetUSec(true) / 1000.0f;
+
+    URHO3D_LOGINFO("Startup: resources " + String(resourcesTime_) + " ms, map parse " + String(startupJob_->mapTime_) +
+        " ms, tmx expand " + String(startupJob_->tmxTime_) + " ms and menu parse " + String(startupJob_->menuTime_) +
+        " ms on a worker, scene " + String(sceneTime) + " ms, window " + String(windowTime) + " ms, map apply " +
+        String(mapTime) + " ms, ready at " + String(parsedTime + sceneTime + windowTime + mapTime) + " ms");
+    delete startupJob_;
+    startupJob_ = 0;
+    UnsubscribeFromEvent(E_RESOURCEBACKGROUNDLOADED);
 
     // Hook up to the frame update events
     SubscribeToEvents();
+    firstFrame_ = true;
 }
 
 void MapEditor::CreatePreviewScene()
@@ -150,11 +359,13 @@ void MapEditor::CreateScene()
 
 
     nodeWall = scene_->CreateChild("NodoWall");
+    CreateGrids();
+    overlay_ = new PolygonOverlay(context_, scene_->CreateChild("PolygonOverlays"), VERTEX_PICK_RADIUS);
 
     SpriteSheet2D* SSTileSet = cache->GetResource<SpriteSheet2D>("Urho2D/tileset.xml");
     TileSetMap = SSTileSet->GetSpriteMapping();
 
-    TmxFile2D* tmxFile = cache->GetResource<TmxFile2D>("Urho2D/nivel1.tmx");
+    TmxFile2D* tmxFile = GetTmxFile();
     if (!tmxFile)
         return;
 
@@ -174,6 +385,156 @@ void MapEditor::CreateScene()
 	objectsprite->SetLayer(1000);
 }
 
+bool MapEditor::CreateBatchScene()
+{
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+    scene_ = new Scene(context_);
+    scene_->CreateComponent<Octree>();
+    scene_->CreateComponent<PhysicsWorld2D>();
+    nodeWall = scene_->CreateChild("NodoWall");
+    nodePlayer = scene_->CreateChild("NodoPlayer");
+
+    TmxFile2D* tmxFile = GetTmxFile();
+    if (!tmxFile)
+        return false;
+    tileMap = scene_->CreateChild("TileMap")->CreateComponent<TileMap2D>();
+    tileMap->SetTmxFile(tmxFile);
+    return true;
+}
+
+TmxFile2D* MapEditor::GetTmxFile()
+{
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    TmxFile2D* tmxFile = cache->GetExistingResource<TmxFile2D>(tmxName_);
+    if(tmxFile)
+        return tmxFile;
+
+    SharedPtr<File> file = cache->GetFile(tmxName_, false);
+    if(!file || !IsTmxCompressed(*file))
+        return cache->GetResource<TmxFile2D>(tmxName_);
+    file->Seek(0);
+    VectorBuffer expanded;
+    if(!ExpandTmxFile(context_, *file, expanded))
+        return 0;
+    return AddExpandedTmx(expanded);
+}
+
+TmxFile2D* MapEditor::AddExpandedTmx(VectorBuffer& expanded)
+{
+    // Named like the file so its tilesets resolve relative to it and GetResource finds it
+    SharedPtr<TmxFile2D> tmxFile(new TmxFile2D(context_));
+    tmxFile->SetName(tmxName_);
+    expanded.Seek(0);
+    if(!tmxFile->Load(expanded))
+        return 0;
+    GetSubsystem<ResourceCache>()->AddManualResource(tmxFile);
+    return tmxFile;
+}
+
+void MapEditor::RunBatch()
+{
+    HiresTimer timer;
+    if(!CreateBatchScene())
+    {
+        ErrorExit("Could not load tile map " + tmxName_);
+        return;
+    }
+    float sceneTime = timer.GetUSec(true) / 1000.0f;
+
+    if(!LoadMap())
+    {
+        ErrorExit("Could not load map from " + mapDir_);
+        return;
+    }
+    float loadTime = timer.GetUSec(true) / 1000.0f;
+
+    ProcessPolygons();
+    float processTime = timer.GetUSec(true) / 1000.0f;
+
+    if(!SaveMap())
+    {
+        ErrorExit("Could not save map to " + GetOutputDir());
+        return;
+    }
+    float saveTime = timer.GetUSec(true) / 1000.0f;
+
+    unsigned numVertices = 0;
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
+        numVertices += polygons[i]->vertices.Size();
+
+    PrintLine(mapDir_ + ": " + String(polygons.Size()) + " polygons, " + String(numVertices) + " vertices, " +
+        String(fixtureCount_) + " fixtures, " + String(entities_.GetNumPlatforms()) + " platforms, " + String(entities_.GetNumObjects()) + " objects, " +
+        String(entities_.GetInstances().Size()) + " prefab instances");
+    PrintLine("tmx " + String(sceneTime) + " ms, load " + String(loadTime) + " ms, process " + String(processTime) +
+        " ms, save " + String(saveTime) + " ms");
+    engine_->Exit();
+}
+
+void MapEditor::RunConvert()
+{
+    HiresTimer timer;
+    MapSnapshot snapshot;
+    bool ok;
+    if(convertTo_ == "bin")
+        ok = LoadMapJSON(context_, mapDir_, snapshot) && SaveMapBinary(context_, outputDir_ + "MapData.bin", snapshot);
+    else if(convertTo_ == "json")
+        ok = LoadMapBinary(mapDir_ + "MapData.bin", snapshot) && SaveMapJSON(context_, outputDir_, snapshot);
+    else
+    {
+        ErrorExit("Unknown map format " + convertTo_ + ", use bin or json");
+        return;
+    }
+
+    if(!ok)
+    {
+        ErrorExit("Could not convert " + mapDir_ + " to " + convertTo_);
+        return;
+    }
+    PrintLine("Converted " + mapDir_ + " to " + convertTo_ + " in " + String(timer.GetUSec(false) / 1000.0f) + " ms: " +
+        String(snapshot.polygons_.Size()) + " polygons, " + String(snapshot.pieces_.Size()) + " pieces");
+    engine_->Exit();
+}
+
+void MapEditor::RunTmxEncode()
+{
+    TmxEncoding encoding;
+    if(!ParseTmxEncoding(tmxEncoding_, encoding))
+    {
+        ErrorExit("Unknown tile encoding " + tmxEncoding_ + ", use xml, csv, base64 or zlib");
+        return;
+    }
+
+    // Every tile map under the resource directories, so one run brings all existing maps over
+    HiresTimer timer;
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    const Vector<String>& dirs = GetSubsystem<ResourceCache>()->GetResourceDirs();
+    unsigned numFiles = 0;
+    for(unsigned i = 0; i < dirs.Size(); i++)
+    {
+        Vector<String> files;
+        fileSystem->ScanDir(files, dirs[i], "*.tmx", SCAN_FILES, true);
+        for(unsigned j = 0; j < files.Size(); j++)
+        {
+            String fileName = dirs[i] + files[j];
+            unsigned oldSize = File(context_, fileName).GetSize();
+            unsigned numLayers;
+            if(!ReencodeTmx(context_, fileName, encoding, numLayers))
+            {
+                ErrorExit("Could not re-encode " + fileName);
+                return;
+            }
+            PrintLine(files[j] + ": " + String(numLayers) + " layers, " + String(oldSize) + " -> " +
+                String(File(context_, fileName).GetSize()) + " bytes");
+            numFiles++;
+        }
+    }
+    PrintLine("Re-encoded " + String(numFiles) + " tile maps to " + tmxEncoding_ + " in " +
+        String(timer.GetUSec(false) / 1000.0f) + " ms");
+    engine_->Exit();
+}
+
 void MapEditor::SetupViewport()
 {
     Renderer* renderer = GetSubsystem<Renderer>();
@@ -182,254 +543,776 @@ void MapEditor::SetupViewport()
     renderer->SetViewport(0, viewport);
 }
 
-void MapEditor::CreateGrids()
+Rect MapEditor::GetViewRect()
 {
-    DebugRenderer* debug = scene_->GetComponent<DebugRenderer>();
-    /// Lineas verticales
-    for (float i = 0; i <= 100; i+=0.7f)
-    {
-        debug->AddLine( Vector3(i, 0, 0),
-                        Vector3(i, 100, 0),
-                        Color(0, 1, 1, 0.5f),
-                        false );
-    }
-    /// Lineas horizontales
-    for (float j = 0; j <= 100; j+=0.7)
-    {
-        debug->AddLine( Vector3(0, j, 0),
-                        Vector3(100, j, 0),
-                        Color(0, 1, 1, 0.5f),
-                        false );
-    }
+    Vector3 center = cameraNode_->GetWorldPosition();
+    float halfHeight = camera_->GetOrthoSize() * 0.5f / camera_->GetZoom();
+    float halfWidth = halfHeight * camera_->GetAspectRatio();
+    return Rect(Vector2(center.x_ - halfWidth, center.y_ - halfHeight), Vector2(center.x_ + halfWidth, center.y_ + halfHeight));
 }
 
-void MapEditor::LoadMap()
+void MapEditor::UpdateChunks()
 {
-    nodeWall->RemoveAllChildren();
+    PODVector<Rect> loaded;
+    PODVector<Rect> unloaded;
+    if(!chunks_.Update(GetViewRect(), loaded, unloaded))
+        return;
 
-    JSONFile* data = new JSONFile(context_);
-    File datafile(context_, "Data/Scenes/MapNode.json");
-    data->Load(datafile);
-    JSONValue rootjson = data->GetRoot();
-    JSONArray platforms = rootjson.Get("platforms").GetArray();
+    EDITOR_PROFILE(STREAM);
+    StreamEntities(unloaded);
+    StreamEntities(loaded);
+    UpdatePolygonResidency();
+}
+
+void MapEditor::StreamEntities(const PODVector<Rect>& chunks)
+{
+    // Objects on a chunk border are reported by both chunks and only released when neither is resident
+    PODVector<unsigned> handles;
+    for(unsigned i = 0; i < chunks.Size(); i++)
+        spatialIndex_.QueryRect(chunks[i], (1 << ENTITY_PLATFORM) | (1 << ENTITY_MOVPLATFORM) | (1 << ENTITY_ENEMY) | (1 << ENTITY_PREFAB), handles);
 
-    PlatformsList.Clear();
-    for(int i = 0 ; i < platforms.Size() ; i++)
+    for(unsigned i = 0; i < handles.Size(); i++)
     {
-        JSONValue platformdata = platforms[i];
-        String type = platformdata.Get("type").GetString();
-        Vector2 p1(platformdata.Get("p1_x").GetFloat(),platformdata.Get("p1_y").GetFloat());
-        Vector2 p2(platformdata.Get("p2_x").GetFloat(),platformdata.Get("p2_y").GetFloat());
-        if(type == "movplatform")
+        const EditorEntity& entity = spatialIndex_.GetEntity(handles[i]);
+        bool resident = chunks_.IsResident(entity.bounds_);
+        if(entity.kind_ == ENTITY_ENEMY)
+        {
+            ObjectData* data = static_cast<ObjectData*>(entity.object_);
+            if(resident)
+                InstantiateObject(data);
+            else
+                ReleaseObject(data);
+        }
+        else if(entity.kind_ == ENTITY_PREFAB)
         {
-            CreateMovablePlatform(p1, p2);
+            PrefabInstance* instance = static_cast<PrefabInstance*>(entity.object_);
+            if(resident)
+                InstantiateInstance(instance);
+            else
+                ReleaseInstance(instance);
         }
         else
         {
-            CreatePlatform(p1, p2,type);
+            PlatformData* platData = static_cast<PlatformData*>(entity.object_);
+            if(resident)
+                InstantiatePlatform(platData);
+            else
+                ReleasePlatform(platData);
         }
     }
+}
+
+/// Bounding rect of a polygon outline.
+static Rect OutlineBounds(const PODVector<Vector2>& vertices)
+{
+    Rect bounds(vertices[0], vertices[0]);
+    for(unsigned i = 1; i < vertices.Size(); i++)
+    {
+        bounds.min_.x_ = Min(bounds.min_.x_, vertices[i].x_);
+        bounds.min_.y_ = Min(bounds.min_.y_, vertices[i].y_);
+        bounds.max_.x_ = Max(bounds.max_.x_, vertices[i].x_);
+        bounds.max_.y_ = Max(bounds.max_.y_, vertices[i].y_);
+    }
+    return bounds;
+}
 
-    ObjectList.Clear();
-    JSONArray objects = rootjson.Get("objects").GetArray();
-    for(int i = 0 ; i < objects.Size() ; i++)
+void MapEditor::UpdatePolygonResidency()
+{
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        JSONValue object = objects[i];
-        String type = object.Get("type").GetString();
-        if(type == "enemy")
+        PolygonData* polygon = polygons[i];
+        bool resident = polygon->vertices.Empty() || chunks_.IsResident(OutlineBounds(polygon->vertices));
+        if(resident == polygon->resident)
+            continue;
+
+        polygon->resident = resident;
+        if(resident)
+            CreatePolygonBody(polygon);
+        else
         {
-            Vector2 pos(object.Get("pos_x").GetFloat(),object.Get("pos_y").GetFloat());
-            CreateEnemy(pos);
+            // Baked pieces stay, the body and overlay are rebuilt from them when the polygon comes back
+            polygon->ReleasePhysics();
+            polygon->ReleaseOverlay();
+            polygon->overlayDirty = true;
         }
     }
+}
+
+void MapEditor::CreateGrids()
+{
+    grid_ = scene_->CreateChild("Grid")->CreateComponent<EditorGrid>();
+    grid_->SetSpacing(0.7f);
+    grid_->SetColor(Color(0, 1, 1, 0.5f));
+}
+
+bool MapEditor::LoadMap()
+{
+    EDITOR_PROFILE(LOAD);
+    MapSnapshot snapshot;
+    return ApplyLoadedMap(snapshot, LoadMapSnapshot(context_, mapDir_, snapshot));
+}
+
+bool MapEditor::ApplyLoadedMap(const MapSnapshot& snapshot, bool loaded)
+{
+    if(!loaded)
+    {
+        URHO3D_LOGWARNING("No map to load in " + mapDir_);
+        // A map that was never saved can still have a journal, it is replayed once on an empty editor
+        if(journal_.IsOpen())
+            return false;
+    }
+    // Closed while the snapshot and the journal are applied, so they are not recorded again
+    journal_.Close();
+    ApplySnapshot(snapshot);
+    ReplayJournal(snapshot);
+    UpdatePolygonResidency();
+    // Polygons restored from their baked pieces collide right away, without a process
+    ProcessPolygonPhysics();
+    return loaded;
+}
 
-    Vector2 posPlayer(rootjson.Get("playerPos_x").GetFloat(),rootjson.Get("playerPos_y").GetFloat());
-    nodePlayer->SetPosition2D(posPlayer);
+String MapEditor::GetJournalName()
+{
+    // Records only make sense on top of the snapshot they were made on
+    if(!outputDir_.Empty() && outputDir_ != mapDir_)
+        return String::EMPTY;
+    return GetOutputDir() + "MapJournal.bin";
+}
 
-    JSONFile* mapData = new JSONFile(context_);
-    File mapDatafile(context_, "Data/Scenes/MapData.json");
-    mapData->Load(mapDatafile);
-    JSONValue rootDataJson = mapData->GetRoot();
-    JSONArray polygonsJSON = rootDataJson.Get("polygons").GetArray();
+void MapEditor::ReplayJournal(const MapSnapshot& snapshot)
+{
+    String journalName = GetJournalName();
+    if(journalName.Empty())
+        return;
 
-    Vector<String> keys = PolygonMap.Keys();
-    for(int i = 0; i < keys.Size(); i++)
+    HiresTimer timer;
+    PODVector<JournalRecord> records;
+    journal_.Load(journalName, snapshot.journalGeneration_, snapshot.journalRecords_, records);
+    // Records name polygons by the ids they had when the snapshot was saved, on renumbered polygons they would edit
+    // the wrong ones
+    if(numRenumbered_ && !records.Empty())
     {
-        RemovePolygon(keys[i]);
+        URHO3D_LOGWARNING(String(numRenumbered_) + " polygons of the map have no saved id, dropping " + String(records.Size()) +
+            " edits from " + journalName);
+        journal_.Drop(snapshot.journalGeneration_);
+        records.Clear();
     }
-    while(!ListNodePolygonsPhysics.Empty())
+    for(unsigned i = 0; i < records.Size(); i++)
     {
-        Node* nodeRemove = ListNodePolygonsPhysics.Back();
-        if(nodeRemove)
+        if(!ReplayRecord(records[i]))
         {
-            nodeRemove->Remove();
-            ListNodePolygonsPhysics.Pop();
+            URHO3D_LOGWARNING("Journal record " + String(i) + " doesn't fit the map, skipping the last " + String(records.Size() - i) + " edits");
+            break;
         }
     }
-    PolygonMap.Clear();
-    ListPolygonTriangle.Clear();
-    PolygonCounter = 0;
-    for(int i = 0 ; i < polygonsJSON.Size() ; i++)
+    if(!records.Empty())
     {
-        JSONArray polygonVertexArray = polygonsJSON[i].GetArray();
-        Vector<PolygonVertex *>* polygon_ = new Vector<PolygonVertex *>();
-        PolygonMap.Insert(Pair<String, Vector<PolygonVertex *>*>("Polygon" + String(PolygonCounter), polygon_));
-        PolygonCounter++;
-        for(int j = 0; j < polygonVertexArray.Size(); j++)
-        {
-            Vector2 v(polygonVertexArray[j].Get("x_").GetFloat(), polygonVertexArray[j].Get("y_").GetFloat());
-            polygon_->Push(CreatePolygonVertex(v));
-        }
-        UnselectPolygon(CurrentPolygon);
-        CurrentPolygon = polygon_;
-        SelectPolygon(polygon_);
+        URHO3D_LOGINFO("Replayed " + String(records.Size()) + " edits from " + journalName + " in " + String(timer.GetUSec(false) / 1000.0f) + " ms");
+        LoadPolygonList();
     }
-    LoadPolygonList();
+
+    if(!batchMode_ && !journal_.Open())
+        URHO3D_LOGWARNING("Could not open " + journalName + ", edits are only kept by saving with F5");
+}
+
+bool MapEditor::ReplayRecord(const JournalRecord& record)
+{
+    PolygonData* polygon = 0;
+    PlatformData* platform = 0;
+    ObjectData* object = 0;
+    PrefabInstance* instance = 0;
+    if(record.op_ >= JOURNAL_REMOVEPOLYGON && record.op_ <= JOURNAL_REMOVEVERTEX)
+    {
+        polygon = GetPolygon(record.target_);
+        if(!polygon)
+            return false;
+    }
+    if(record.op_ >= JOURNAL_PREFABPLATFORM && record.op_ <= JOURNAL_PREFABVERTEX && record.target_ >= prefabs_.Size())
+        return false;
+
+    switch(record.op_)
+    {
+    case JOURNAL_CREATEPLATFORM:
+        if(record.index_ >= ENTITY_TYPE_MOVPLATFORM)
+            return false;
+        CreatePlatform(record.a_, record.b_, (EntityType)record.index_);
+        return true;
+    case JOURNAL_CREATEMOVPLATFORM:
+        CreateMovablePlatform(record.a_, record.b_);
+        currentpd = 0;
+        return true;
+    case JOURNAL_PLATFORMTARGET:
+        platform = entities_.FindPlatform(record.target_);
+        if(!platform || platform->type != ENTITY_TYPE_MOVPLATFORM)
+            return false;
+        MovePlatformTarget(platform, record.a_);
+        return true;
+    case JOURNAL_REMOVEPLATFORM:
+        platform = entities_.FindPlatform(record.target_);
+        if(!platform)
+            return false;
+        RemovePlatform(platform);
+        return true;
+    case JOURNAL_CREATEENEMY:
+        CreateEnemy(record.a_);
+        return true;
+    case JOURNAL_REMOVEOBJECT:
+        object = entities_.FindObject(record.target_);
+        if(!object)
+            return false;
+        RemoveObject(object);
+        return true;
+    case JOURNAL_MOVEPLAYER:
+        MovePlayer(record.a_);
+        return true;
+    case JOURNAL_ADDPOLYGON:
+        return record.target_ && AddPolygon(record.target_);
+    case JOURNAL_REMOVEPOLYGON:
+        return RemovePolygon(polygon);
+    case JOURNAL_POLYGONMODE:
+        SetPolygonMode(polygon, record.index_ == CHAINBODY ? CHAINBODY : SOLIDBODY);
+        return true;
+    case JOURNAL_ADDVERTEX:
+        if(record.index_ > polygon->vertices.Size())
+            return false;
+        AddPolygonVertex(polygon, record.index_, record.a_);
+        return true;
+    case JOURNAL_MOVEVERTEX:
+        if(record.index_ >= polygon->vertices.Size())
+            return false;
+        MovePolygonVertex(polygon, record.index_, record.a_);
+        return true;
+    case JOURNAL_REMOVEVERTEX:
+        if(record.index_ >= polygon->vertices.Size())
+            return false;
+        RemovePolygonVertex(polygon, record.index_);
+        return true;
+    case JOURNAL_MOVEPLATFORM:
+        platform = entities_.FindPlatform(record.target_);
+        if(!platform)
+            return false;
+        MovePlatform(platform, record.a_, record.b_);
+        RebuildMovedEntities();
+        return true;
+    case JOURNAL_MOVEOBJECT:
+        object = entities_.FindObject(record.target_);
+        if(!object)
+            return false;
+        MoveObject(object, record.a_);
+        return true;
+    case JOURNAL_BATCH:
+        return true;
+    case JOURNAL_ADDPREFAB:
+        // Prefabs are only ever appended, the index just checks the record belongs after the ones loaded
+        if(record.index_ != prefabs_.Size())
+            return false;
+        AddPrefab();
+        return true;
+    case JOURNAL_PREFABPLATFORM:
+        if(record.index_ >= FIRST_OBJECT_TYPE)
+            return false;
+        AddPrefabPlatform(record.target_, record.a_, record.b_, record.index_);
+        return true;
+    case JOURNAL_PREFABOBJECT:
+        if(record.index_ < FIRST_OBJECT_TYPE || record.index_ >= ENTITY_TYPE_PREFAB)
+            return false;
+        AddPrefabObject(record.target_, record.a_, (EntityType)record.index_);
+        return true;
+    case JOURNAL_PREFABPOLYGON:
+        AddPrefabPolygon(record.target_, record.index_ == CHAINBODY ? CHAINBODY : SOLIDBODY);
+        return true;
+    case JOURNAL_PREFABVERTEX:
+        if(prefabs_[record.target_].polygons_.Empty())
+            return false;
+        AddPrefabVertex(record.target_, record.a_);
+        return true;
+    case JOURNAL_STAMPPREFAB:
+        if(record.index_ >= prefabs_.Size())
+            return false;
+        StampPrefab(record.index_, record.a_);
+        return true;
+    case JOURNAL_MOVEINSTANCE:
+        instance = entities_.FindInstance(record.target_);
+        if(!instance)
+            return false;
+        MoveInstance(instance, record.a_);
+        RebuildMovedEntities();
+        return true;
+    case JOURNAL_REMOVEINSTANCE:
+        instance = entities_.FindInstance(record.target_);
+        if(!instance)
+            return false;
+        RemoveInstance(instance);
+        return true;
+    }
+    return false;
 }
 
-void MapEditor::SaveMap()
+void MapEditor::CompactJournal(const MapSnapshot& snapshot)
 {
-    JSONFile* data = new JSONFile(context_);
-    JSONValue* MapNodeJson = &data->GetRoot();
-    Vector2 playerPos = nodePlayer->GetPosition2D();
-    MapNodeJson->Set("playerPos_x", JSONValue(playerPos.x_));
-    MapNodeJson->Set("playerPos_y", JSONValue(playerPos.y_));
-    /*JSONValue characters = MapNodeJson.CreateChild("characters",JSON_ARRAY);
-    JSONValue character = characters.CreateChild(JSON_OBJECT);
-    character.SetString("name","Player");
-    character.SetString("source","April.scml");
-    character.SetBool("anim",true);
-    character.SetFloat("radio",0.16f);*/
+    if(GetJournalName().Empty())
+        return;
+    if(journal_.Compact(snapshot.journalGeneration_, snapshot.journalRecords_))
+        compactAt_ = JOURNAL_COMPACT_RECORDS;
+}
 
-    JSONArray triangleArray;// = MapNodeJson.CreateChild("triangles",JSON_ARRAY);
+void MapEditor::ApplySnapshot(const MapSnapshot& snapshot)
+{
+    for(unsigned type = 0; type < FIRST_OBJECT_TYPE; type++)
+    {
+        const PODVector<PlatformData*>& platforms = entities_.GetPlatforms((EntityType)type);
+        for(unsigned i = 0; i < platforms.Size(); i++)
+            spatialIndex_.Remove(platforms[i]->handle);
+    }
+    for(unsigned type = FIRST_OBJECT_TYPE; type < ENTITY_TYPE_PREFAB; type++)
+    {
+        const PODVector<ObjectData*>& objects = entities_.GetObjects((EntityType)type);
+        for(unsigned i = 0; i < objects.Size(); i++)
+            spatialIndex_.Remove(objects[i]->handle);
+    }
+    const PODVector<PrefabInstance*>& instances = entities_.GetInstances();
+    for(unsigned i = 0; i < instances.Size(); i++)
+        spatialIndex_.Remove(instances[i]->handle);
+    nodeWall->RemoveAllChildren();
+    entities_.Clear();
+    selection_.Clear();
+    selecting_ = false;
+    movingSelection_ = false;
 
-    for(RandomAccessIterator<Vector<EarTriangle*>*> i = ListPolygonTriangle.Begin(); i != ListPolygonTriangle.End(); i++)
+    for(unsigned i = 0; i < snapshot.platforms_.Size(); i++)
     {
-        Vector<EarTriangle*>* PolygonTriangles = *i;
-        JSONArray polygon;
-        for(RandomAccessIterator<EarTriangle*> j = PolygonTriangles->Begin(); j != PolygonTriangles->End(); j++)
+        const MapPlatform& platform = snapshot.platforms_[i];
+        if(platform.type_ == MAP_MOVPLATFORM)
         {
-            EarTriangle* et = *j;
-            JSONValue triangle;
-            triangle.Set("p1_x_", JSONValue(et->p1_.x_));
-            triangle.Set("p1_y_", JSONValue(et->p1_.y_));
-            triangle.Set("p2_x_", JSONValue(et->p2_.x_));
-            triangle.Set("p2_y_", JSONValue(et->p2_.y_));
-            triangle.Set("p3_x_", JSONValue(et->p3_.x_));
-            triangle.Set("p3_y_", JSONValue(et->p3_.y_));
-            polygon.Push(triangle);
+            CreateMovablePlatform(platform.p1_, platform.p2_);
+        }
+        else
+        {
+            CreatePlatform(platform.p1_, platform.p2_, platform.type_ == MAP_MIDLEPLATFORM ? ENTITY_TYPE_MIDLEPLATFORM : ENTITY_TYPE_PLATFORM);
         }
-        triangleArray.Push(JSONValue(polygon));
-        MapNodeJson->Set("triangles",JSONValue(triangleArray));
     }
+    currentpd = 0;
 
-    JSONArray platformArray;// = MapNodeJson.CreateChild("platforms",JSON_ARRAY);
-    for(RandomAccessIterator<PlatformData*> i = PlatformsList.Begin(); i != PlatformsList.End(); i++)
+    for(unsigned i = 0; i < snapshot.objects_.Size(); i++)
     {
-        PlatformData* platData = *i;
-        JSONValue platformDataJson;
-        platformDataJson.Set("p1_x_", JSONValue(platData->p1.x_));
-        platformDataJson.Set("p1_y_", JSONValue(platData->p1.y_));
-        platformDataJson.Set("p2_x_", JSONValue(platData->p1.x_));
-        platformDataJson.Set("p2_y_", JSONValue(platData->p1.y_));
-        platformDataJson.Set("type", JSONValue(platData->type));
-        platformArray.Push(platformDataJson);
+        const MapObject& object = snapshot.objects_[i];
+        if(GetEntityType(object.type_) == ENTITY_TYPE_ENEMY)
+            CreateEnemy(object.position_);
     }
 
-    JSONArray objectArray;// = MapNodeJson.CreateChild("objects",JSON_ARRAY);
-    for(RandomAccessIterator<ObjectData*> i = ObjectList.Begin(); i != ObjectList.End(); i++)
+    prefabs_.Clear();
+    prefabs_.Resize(snapshot.prefabs_.Size());
+    currentPrefab_ = M_MAX_UNSIGNED;
+    for(unsigned i = 0; i < snapshot.prefabs_.Size(); i++)
     {
-        ObjectData* objectData = *i;
-        JSONValue objDataJson;
-        objDataJson.Set("pos_x_", JSONValue(objectData->position.x_));
-        objDataJson.Set("pos_y_", JSONValue(objectData->position.y_));
-        objDataJson.Set("type", JSONValue(objectData->type));
-        objDataJson.Set("code", JSONValue(objectData->Code));
-        objectArray.Push(objDataJson);
-    }
+        const MapPrefab& mapPrefab = snapshot.prefabs_[i];
+        PrefabDefinition& prefab = prefabs_[i];
+        prefab.name_ = String(mapPrefab.name_, (unsigned)strnlen(mapPrefab.name_, sizeof(mapPrefab.name_)));
+        for(unsigned j = 0; j < mapPrefab.numPlatforms_; j++)
+            prefab.platforms_.Push(snapshot.prefabPlatforms_[mapPrefab.firstPlatform_ + j]);
+        for(unsigned j = 0; j < mapPrefab.numObjects_; j++)
+        {
+            // The type comes from the file as a string, anything that isn't an object type couldn't be journaled
+            // when the prefab is captured again
+            const MapObject& object = snapshot.prefabObjects_[mapPrefab.firstObject_ + j];
+            String typeName(object.type_, (unsigned)strnlen(object.type_, sizeof(object.type_)));
+            EntityType type = GetEntityType(typeName);
+            if(type < FIRST_OBJECT_TYPE || type >= ENTITY_TYPE_PREFAB)
+            {
+                URHO3D_LOGWARNING("Prefab " + prefab.name_ + " has an object of unknown type " + typeName + ", dropping it");
+                continue;
+            }
+            prefab.objects_.Push(object);
+        }
 
-    File file(context_,GetSubsystem<FileSystem>()->GetProgramDir() + "Data/Scenes/MapNode.json", FILE_WRITE);
-    data->Save(file);
+        // Pieces are reused when every outline still has the hash they were baked from, otherwise the prefab is
+        // baked again the first time it is placed
+        prefab.baked_ = true;
+        prefab.polygons_.Resize(mapPrefab.numPolygons_);
+        for(unsigned j = 0; j < mapPrefab.numPolygons_; j++)
+        {
+            const MapPolygon& mapPolygon = snapshot.prefabPolygons_[mapPrefab.firstPolygon_ + j];
+            PrefabPolygon& polygon = prefab.polygons_[j];
+            polygon.outline_.Resize(mapPolygon.numVertices_);
+            for(unsigned k = 0; k < mapPolygon.numVertices_; k++)
+                polygon.outline_[k] = snapshot.vertices_[mapPolygon.firstVertex_ + k];
+            polygon.mode_ = mapPolygon.mode_;
+            if(!mapPolygon.hash_ || mapPolygon.hash_ != GetOutlineHash(polygon.outline_.Buffer(), polygon.outline_.Size(), polygon.mode_))
+            {
+                prefab.baked_ = false;
+                continue;
+            }
+            for(unsigned k = 0; k < mapPolygon.numPieces_; k++)
+            {
+                const MapPiece& piece = snapshot.pieces_[mapPolygon.firstPiece_ + k];
+                polygon.pieces_.AddPiece(&snapshot.pieceVertices_[piece.firstVertex_], piece.numVertices_);
+            }
+        }
+    }
+    for(unsigned i = 0; i < snapshot.instances_.Size(); i++)
+    {
+        const MapInstance& instance = snapshot.instances_[i];
+        if(instance.prefab_ < prefabs_.Size())
+            StampPrefab(instance.prefab_, instance.offset_);
+    }
+    if(CurrentType == "Prefab")
+        LoadSelectedType(CurrentType);
 
-    /** Solo archivo de editor **/
+    nodePlayer->SetPosition2D(snapshot.playerPosition_);
 
-    JSONFile* mapData = new JSONFile(context_);
-    JSONValue* PolygonsJson = &mapData->GetRoot();
-    Vector<Vector<PolygonVertex *>* > polygons = PolygonMap.Values();
-    JSONArray jsonPolygonArray;
-    for(RandomAccessIterator<Vector<PolygonVertex *>*> ps = polygons.Begin(); ps != polygons.End(); ps++)
+    UnselectPolygon(CurrentPolygon);
+    CurrentPolygon = 0;
+    CurrentVertexPolygon = 0;
+    selectObject_ = false;
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        Vector<PolygonVertex *>* polygon = *ps;
-        JSONArray polygonJson;
-        for(RandomAccessIterator<PolygonVertex*> pvi = polygon->Begin(); pvi != polygon->End(); pvi++)
+        for(unsigned j = 0; j < polygons[i]->handles.Size(); j++)
+            spatialIndex_.Remove(polygons[i]->handles[j]);
+        delete polygons[i];
+    }
+    polygons_.Clear();
+    numRenumbered_ = 0;
+    unsigned numRestored = 0;
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+    {
+        const MapPolygon& polygon = snapshot.polygons_[i];
+        // Ids are kept so journal records made after this snapshot find their polygon, older maps get new ones
+        PolygonData* polygon_ = AddPolygon(polygon.id_);
+        if(!polygon_)
+        {
+            polygon_ = AddPolygon();
+            numRenumbered_++;
+        }
+        else if(!polygon.id_)
+            numRenumbered_++;
+        polygon_->vertices.Reserve(polygon.numVertices_);
+        for(unsigned j = 0; j < polygon.numVertices_; j++)
+            AddPolygonVertex(polygon_, j, snapshot.vertices_[polygon.firstVertex_ + j]);
+        polygon_->mode = (PolygonBodyMode)polygon.mode_;
+        // Pieces baked from this exact outline are reused, the rest stays dirty for the next process
+        if(polygon.hash_ && polygon.hash_ == GetOutlineHash(polygon_->vertices.Buffer(), polygon.numVertices_, polygon.mode_))
         {
-            PolygonVertex* pv = *pvi;
-            JSONValue jsonPv;
-            jsonPv.Set("x_",JSONValue(pv->GetVector().x_));
-            jsonPv.Set("y_",JSONValue(pv->GetVector().y_));
-            polygonJson.Push(jsonPv);
+            RestoreBake(polygon_, snapshot, polygon);
+            numRestored++;
         }
-        jsonPolygonArray.Push(JSONValue(polygonJson));
+        UnselectPolygon(CurrentPolygon);
+        CurrentPolygon = polygon_;
+        SelectPolygon(polygon_);
     }
-    PolygonsJson->Set("polygons",JSONValue(jsonPolygonArray));
-    File mapDataFile(context_,GetSubsystem<FileSystem>()->GetProgramDir() + "Data/Scenes/MapData.json", FILE_WRITE);
-    mapData->Save(mapDataFile);
+    if(!snapshot.polygons_.Empty())
+        URHO3D_LOGINFO("Restored " + String(numRestored) + " of " + String(snapshot.polygons_.Size()) + " polygons from their baked pieces");
+    LoadPolygonList();
 }
 
-void MapEditor::MoveCamera(float timeStep)
+void MapEditor::RestoreBake(PolygonData* polygon, const MapSnapshot& snapshot, const MapPolygon& mapPolygon)
 {
+    // Only the pieces are saved, the triangles behind them come back as fans over each convex piece
+    ConvexPieces pieces;
+    PODVector<EarTriangle> triangles;
+    for(unsigned i = 0; i < mapPolygon.numPieces_; i++)
+    {
+        const MapPiece& piece = snapshot.pieces_[mapPolygon.firstPiece_ + i];
+        const Vector2* points = &snapshot.pieceVertices_[piece.firstVertex_];
+        pieces.AddPiece(points, piece.numVertices_);
+        for(unsigned j = 2; j < piece.numVertices_; j++)
+            triangles.Push(EarTriangle(points[0], points[j - 1], points[j]));
+    }
+    polygon->SetTriangles(triangles, pieces);
+}
 
-    Input* input = GetSubsystem<Input>();
-    // Movement speed as world units per second
-    const float MOVE_SPEED = 4.0f;
+void MapEditor::TakeSnapshot(MapSnapshot& snapshot)
+{
+    snapshot.Clear();
+    snapshot.playerPosition_ = nodePlayer->GetPosition2D();
 
-    // Read WASD keys and move the camera scene node to the corresponding direction if they are pressed
-    if (input->GetKeyDown('W'))
-        cameraNode_->Translate(Vector3::UP * MOVE_SPEED * timeStep);
-    if (input->GetKeyDown('S'))
-        cameraNode_->Translate(Vector3::DOWN * MOVE_SPEED * timeStep);
-    if (input->GetKeyDown('A'))
-        cameraNode_->Translate(Vector3::LEFT * MOVE_SPEED * timeStep);
-    if (input->GetKeyDown('D'))
-        cameraNode_->Translate(Vector3::RIGHT * MOVE_SPEED * timeStep);
+    // Written a type at a time, loading recreates each type list in the same order so journal references still hold
+    snapshot.platforms_.Reserve(entities_.GetNumPlatforms());
+    for(unsigned type = 0; type < FIRST_OBJECT_TYPE; type++)
+    {
+        const PODVector<PlatformData*>& platforms = entities_.GetPlatforms((EntityType)type);
+        for(unsigned i = 0; i < platforms.Size(); i++)
+        {
+            MapPlatform platform;
+            platform.p1_ = platforms[i]->p1;
+            platform.p2_ = platforms[i]->p2;
+            platform.type_ = type;
+            snapshot.platforms_.Push(platform);
+        }
+    }
 
-    if (input->GetKeyDown(KEY_PAGEUP))
+    snapshot.objects_.Reserve(entities_.GetNumObjects());
+    for(unsigned type = FIRST_OBJECT_TYPE; type < ENTITY_TYPE_PREFAB; type++)
     {
-        Camera* camera = cameraNode_->GetComponent<Camera>();
-        camera->SetZoom(camera->GetZoom() * 1.01f);
+        const PODVector<ObjectData*>& objects = entities_.GetObjects((EntityType)type);
+        for(unsigned i = 0; i < objects.Size(); i++)
+        {
+            MapObject object;
+            object.position_ = objects[i]->position;
+            memset(object.type_, 0, sizeof(object.type_));
+            memset(object.code_, 0, sizeof(object.code_));
+            strncpy(object.type_, GetEntityTypeName((EntityType)type), sizeof(object.type_) - 1);
+            strncpy(object.code_, objects[i]->Code.CString(), sizeof(object.code_) - 1);
+            snapshot.objects_.Push(object);
+        }
     }
 
-    if (input->GetKeyDown(KEY_PAGEDOWN))
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        Camera* camera = cameraNode_->GetComponent<Camera>();
-        camera->SetZoom(camera->GetZoom() * 0.99f);
+        // Pieces of a polygon edited since the last process are stale and must not be reused on load
+        PolygonData* polygon = polygons[i];
+        unsigned hash = polygon->dirty ? 0 : GetOutlineHash(polygon->vertices.Buffer(), polygon->vertices.Size(), polygon->mode);
+        snapshot.AddPolygon(polygon->vertices, polygon->pieces, polygon->mode, hash, polygon->id);
     }
-}
 
-void MapEditor::SubscribeToEvents()
-{
-    // Subscribe HandleUpdate() function for processing update events
-    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(MapEditor, HandleUpdate));
+    // Definitions are written even when flattening, so the editor keeps them after a batch save
+    for(unsigned i = 0; i < prefabs_.Size(); i++)
+    {
+        const PrefabDefinition& prefab = prefabs_[i];
+        MapPrefab mapPrefab;
+        memset(mapPrefab.name_, 0, sizeof(mapPrefab.name_));
+        strncpy(mapPrefab.name_, prefab.name_.CString(), sizeof(mapPrefab.name_) - 1);
+        mapPrefab.firstPlatform_ = snapshot.prefabPlatforms_.Size();
+        mapPrefab.numPlatforms_ = prefab.platforms_.Size();
+        snapshot.prefabPlatforms_.Push(prefab.platforms_);
+        mapPrefab.firstObject_ = snapshot.prefabObjects_.Size();
+        mapPrefab.numObjects_ = prefab.objects_.Size();
+        snapshot.prefabObjects_.Push(prefab.objects_);
+        mapPrefab.firstPolygon_ = snapshot.prefabPolygons_.Size();
+        mapPrefab.numPolygons_ = prefab.polygons_.Size();
+        for(unsigned j = 0; j < prefab.polygons_.Size(); j++)
+        {
+            // A prefab nobody placed since the load may still be unbaked, its pieces are saved as stale
+            const PrefabPolygon& polygon = prefab.polygons_[j];
+            unsigned hash = prefab.baked_ ? GetOutlineHash(polygon.outline_.Buffer(), polygon.outline_.Size(), polygon.mode_) : 0;
+            snapshot.AddPrefabPolygon(polygon.outline_, polygon.pieces_, polygon.mode_, hash);
+        }
+        snapshot.prefabs_.Push(mapPrefab);
+    }
 
-    // Subscribe to mouse click
-    SubscribeToEvent(E_MOUSEBUTTONDOWN, URHO3D_HANDLER(MapEditor, HandleMouseButtonDown));
+    const PODVector<PrefabInstance*>& instances = entities_.GetInstances();
+    if(!flattenPrefabs_)
+    {
+        snapshot.instances_.Resize(instances.Size());
+        for(unsigned i = 0; i < instances.Size(); i++)
+        {
+            snapshot.instances_[i].prefab_ = instances[i]->prefab;
+            snapshot.instances_[i].offset_ = instances[i]->offset;
+        }
+    }
+    else
+    {
+        // Every instance becomes plain platforms, objects and polygons, the pieces are moved instead of rebaked
+        PODVector<Vector2> outline;
+        ConvexPieces pieces;
+        for(unsigned i = 0; i < instances.Size(); i++)
+        {
+            const PrefabDefinition& prefab = GetBakedPrefab(instances[i]->prefab);
+            Vector2 offset = instances[i]->offset;
+            for(unsigned j = 0; j < prefab.platforms_.Size(); j++)
+            {
+                MapPlatform platform = prefab.platforms_[j];
+                platform.p1_ += offset;
+                platform.p2_ += offset;
+                snapshot.platforms_.Push(platform);
+            }
+            for(unsigned j = 0; j < prefab.objects_.Size(); j++)
+            {
+                MapObject object = prefab.objects_[j];
+                object.position_ += offset;
+                snapshot.objects_.Push(object);
+            }
+            for(unsigned j = 0; j < prefab.polygons_.Size(); j++)
+            {
+                const PrefabPolygon& polygon = prefab.polygons_[j];
+                outline.Resize(polygon.outline_.Size());
+                for(unsigned k = 0; k < outline.Size(); k++)
+                    outline[k] = polygon.outline_[k] + offset;
+                pieces = polygon.pieces_;
+                for(unsigned k = 0; k < pieces.vertices_.Size(); k++)
+                    pieces.vertices_[k] += offset;
+                snapshot.AddPolygon(outline, pieces, polygon.mode_, GetOutlineHash(outline.Buffer(), outline.Size(), polygon.mode_), 0);
+            }
+        }
+    }
 
-    SubscribeToEvent(E_MOUSEMOVE, URHO3D_HANDLER(MapEditor, HandleMouseMove));
-    SubscribeToEvent(E_MOUSEBUTTONUP, URHO3D_HANDLER(MapEditor, HandleMouseButtonUp));
+    // Everything recorded so far is in the snapshot, the journal is compacted once it is written
+    snapshot.journalGeneration_ = journal_.GetGeneration();
+    snapshot.journalRecords_ = journal_.GetNumRecords();
 }
 
-void MapEditor::HandleUpdate(StringHash eventType, VariantMap& eventData)
+static void WriteSaveJob(SaveJob& job)
 {
-    using namespace Update;
+    HiresTimer timer;
+    if(!SaveMapJSON(job.context_, job.dir_, job.snapshot_))
+        job.error_ = "Could not write the JSON map to " + job.dir_;
+    job.jsonTime_ = timer.GetUSec(true) / 1000.0f;
+    if(job.error_.Empty() && !SaveMapBinary(job.context_, job.dir_ + "MapData.bin", job.snapshot_))
+        job.error_ = "Could not write " + job.dir_ + "MapData.bin";
+    job.binaryTime_ = timer.GetUSec(true) / 1000.0f;
+}
+
+static void SaveWork(const WorkItem* item, unsigned threadIndex)
+{
+    WriteSaveJob(*reinterpret_cast<SaveJob*>(item->aux_));
+}
+
+static bool LogSaveJob(const SaveJob& job)
+{
+    if(!job.error_.Empty())
+    {
+        URHO3D_LOGWARNING(job.error_);
+        return false;
+    }
+    URHO3D_LOGINFO("Saved " + String(job.snapshot_.polygons_.Size()) + " polygons: snapshot " + String(job.snapshotTime_) +
+        " ms, json " + String(job.jsonTime_) + " ms, binary " + String(job.binaryTime_) + " ms");
+    return true;
+}
+
+bool MapEditor::SaveMap()
+{
+    EDITOR_PROFILE(SAVE);
+    HiresTimer timer;
+    SaveJob job;
+    job.context_ = context_;
+    job.dir_ = GetOutputDir();
+    TakeSnapshot(job.snapshot_);
+    job.snapshotTime_ = timer.GetUSec(false) / 1000.0f;
+    WriteSaveJob(job);
+    if(!LogSaveJob(job))
+        return false;
+    CompactJournal(job.snapshot_);
+    return true;
+}
+
+void MapEditor::SaveMapAsync()
+{
+    if(saveJob_)
+    {
+        savePending_ = true;
+        return;
+    }
+
+    EDITOR_PROFILE(SAVE);
+    saveTimer_.Reset();
+    // Only the snapshot is taken here, the worker never touches the scene or the polygon map
+    saveJob_ = new SaveJob();
+    saveJob_->context_ = context_;
+    saveJob_->dir_ = GetOutputDir();
+    TakeSnapshot(saveJob_->snapshot_);
+    saveJob_->snapshotTime_ = saveTimer_.GetUSec(false) / 1000.0f;
+
+    // Without worker threads the queue runs the item on the main thread at the start of a frame
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    saveItem_ = queue->GetFreeItem();
+    saveItem_->priority_ = 0;
+    saveItem_->sendEvent_ = true;
+    saveItem_->workFunction_ = SaveWork;
+    saveItem_->aux_ = saveJob_;
+    queue->AddWorkItem(saveItem_);
+    SetSaveStatus("Guardando...");
+}
+
+void MapEditor::HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+
+    void* item = eventData[P_ITEM].GetVoidPtr();
+    if(startupItem_ && item == startupItem_.Get())
+    {
+        startupItem_.Reset();
+        FinishStartup();
+        return;
+    }
+    if(!saveItem_ || item != saveItem_.Get())
+        return;
+
+    float saveTime = saveTimer_.GetUSec(false) / 1000.0f;
+    if(LogSaveJob(*saveJob_))
+    {
+        // Edits made while the save ran are past the snapshot and stay in the journal
+        CompactJournal(saveJob_->snapshot_);
+        SetSaveStatus("Guardados " + String(saveJob_->snapshot_.polygons_.Size()) + " poligonos en " + String((int)saveTime) + " ms");
+    }
+    else
+        SetSaveStatus("Error al guardar, ver el log");
+
+    delete saveJob_;
+    saveJob_ = 0;
+    saveItem_.Reset();
+    if(savePending_)
+    {
+        savePending_ = false;
+        SaveMapAsync();
+    }
+}
+
+void MapEditor::SetSaveStatus(const String& status)
+{
+    Text* savetext = window_ ? static_cast<Text*>(window_->GetChild("SaveText", true)) : 0;
+    if(savetext)
+        savetext->SetText(status);
+}
+
+String MapEditor::GetOutputDir()
+{
+    if(!outputDir_.Empty())
+        return outputDir_;
+    return IsAbsolutePath(mapDir_) ? mapDir_ : GetSubsystem<FileSystem>()->GetProgramDir() + mapDir_;
+}
+
+void MapEditor::MoveCamera(float timeStep)
+{
+    // WASD typed into a list filter doesn't move the camera
+    if (GetSubsystem<UI>()->GetFocusElement())
+        return;
 
-    PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
     Input* input = GetSubsystem<Input>();
+    // Movement speed as world units per second
+    const float MOVE_SPEED = 4.0f;
 
-    if (input->GetKeyPress(KEY_SPACE))
-        drawDebug_ = !drawDebug_;
+    // Read WASD keys and move the camera scene node to the corresponding direction if they are pressed
+    if (input->GetKeyDown('W'))
+        cameraNode_->Translate(Vector3::UP * MOVE_SPEED * timeStep);
+    if (input->GetKeyDown('S'))
+        cameraNode_->Translate(Vector3::DOWN * MOVE_SPEED * timeStep);
+    if (input->GetKeyDown('A'))
+        cameraNode_->Translate(Vector3::LEFT * MOVE_SPEED * timeStep);
+    if (input->GetKeyDown('D'))
+        cameraNode_->Translate(Vector3::RIGHT * MOVE_SPEED * timeStep);
 
-    if (drawDebug_)
-        physicsWorld->DrawDebugGeometry();
+    if (input->GetKeyDown(KEY_PAGEUP))
+    {
+        Camera* camera = cameraNode_->GetComponent<Camera>();
+        camera->SetZoom(camera->GetZoom() * 1.01f);
+    }
+
+    if (input->GetKeyDown(KEY_PAGEDOWN))
+    {
+        Camera* camera = cameraNode_->GetComponent<Camera>();
+        camera->SetZoom(camera->GetZoom() * 0.99f);
+    }
+}
+
+void MapEditor::SubscribeToEvents()
+{
+    // Subscribe HandleUpdate() function for processing update events
+    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(MapEditor, HandleUpdate));
+    SubscribeToEvent(E_ENDFRAME, URHO3D_HANDLER(MapEditor, HandleEndFrame));
+    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(MapEditor, HandleWorkItemCompleted));
+
+    // Subscribe to mouse click
+    SubscribeToEvent(E_MOUSEBUTTONDOWN, URHO3D_HANDLER(MapEditor, HandleMouseButtonDown));
+
+    SubscribeToEvent(E_MOUSEMOVE, URHO3D_HANDLER(MapEditor, HandleMouseMove));
+    SubscribeToEvent(E_MOUSEBUTTONUP, URHO3D_HANDLER(MapEditor, HandleMouseButtonUp));
+}
+
+void MapEditor::HandleShortcutKeys()
+{
+    Input* input = GetSubsystem<Input>();
 
     if(input->GetKeyPress('T'))
         currentKeyFunction = TRASLATE;
@@ -443,26 +1326,133 @@ void MapEditor::HandleUpdate(StringHash eventType, VariantMap& eventData)
     if(input->GetKeyPress('Z'))
         currentKeyFunction = NONE;
 
+    if(input->GetKeyPress('Q'))
+        currentKeyFunction = SELECT;
+
+    if(currentKeyFunction == SELECT)
+    {
+        if(input->GetKeyPress(KEY_DELETE))
+            DeleteSelection();
+        if(input->GetKeyPress('C'))
+            DuplicateSelection();
+        if(input->GetKeyPress('F'))
+            CapturePrefab();
+    }
+
+    if (input->GetKeyPress('P'))
+    {
+        parallelProcess_ = !parallelProcess_;
+        URHO3D_LOGINFO(parallelProcess_ ? "Parallel polygon processing enabled" : "Parallel polygon processing disabled");
+    }
+}
+
+void MapEditor::HandleUpdate(StringHash eventType, VariantMap& eventData)
+{
+    using namespace Update;
+
+    float timeStep = eventData[P_TIMESTEP].GetFloat();
+    frameTime_ = timeStep;
+    EDITOR_PROFILE(UPDATE);
+
+    if(firstFrame_)
+    {
+        firstFrame_ = false;
+        URHO3D_LOGINFO("Startup: first interactive frame at " + String(startupTimer_.GetUSec(false) / 1000.0f) + " ms");
+    }
+
+    PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
+    Input* input = GetSubsystem<Input>();
+
+    // Letters typed into a list filter are not editor shortcuts, the function keys still are
+    bool typing = GetSubsystem<UI>()->GetFocusElement() != 0;
+    if (!typing && input->GetKeyPress(KEY_SPACE))
+        drawDebug_ = !drawDebug_;
+
+    if (drawDebug_)
+        physicsWorld->DrawDebugGeometry();
+
+    if (!typing)
+        HandleShortcutKeys();
+
     if (input->GetKeyPress(KEY_F5))
-        SaveMap();
+        SaveMapAsync();
+    // Compaction is a background save, a failed one is retried after another batch of edits
+    if (!saveJob_ && journal_.GetNumRecords() >= compactAt_)
+    {
+        compactAt_ = journal_.GetNumRecords() + JOURNAL_COMPACT_RECORDS;
+        SaveMapAsync();
+    }
+    if (saveJob_)
+        SetSaveStatus("Guardando... " + String((int)(saveTimer_.GetUSec(false) / 1000)) + " ms");
     if (input->GetKeyPress(KEY_F7))
         LoadMap();
 
-    float timeStep = eventData[P_TIMESTEP].GetFloat();
+    if (input->GetKeyPress(KEY_F3))
+        statsText_->SetVisible(!statsText_->IsVisible());
+    if (input->GetKeyPress(KEY_F4))
+    {
+        if(stats_.SaveCSV(context_, "editor_stats.csv"))
+            URHO3D_LOGINFO("Saved " + String(stats_.GetNumFrames()) + " frames of editor stats to editor_stats.csv");
+        else
+            URHO3D_LOGWARNING("Could not write editor_stats.csv");
+    }
 
     MoveCamera(timeStep*2);
+    UpdateChunks();
 
-    CreateGrids();
+    if (autoProcess_)
+        ProcessPolygons();
+
+    {
+        EDITOR_PROFILE(GRID);
+        grid_->Update(camera_);
+    }
     DrawPolygon();
+    DrawInstances();
 
     if (drawRectangle)
         DrawRectangle( Rect(dragPointBegin, dragPointEnd) );
+    if (selecting_ || !selection_.Empty())
+        DrawSelection();
+
+    statsRefresh_ -= timeStep;
+    if(statsText_->IsVisible() && statsRefresh_ <= 0.0f)
+    {
+        statsRefresh_ = 0.25f;
+        UpdateStatsText();
+    }
+}
+
+void MapEditor::HandleEndFrame(StringHash eventType, VariantMap& eventData)
+{
+    // Mouse events, the update, physics and rendering of this frame are all timed by now, so a CSV row describes one frame
+    stats_.NextFrame(frameTime_);
+}
+
+void MapEditor::UpdateStatsText()
+{
+    String text;
+    for(unsigned i = 0; i <= MAX_STAT_SECTIONS; i++)
+    {
+        float average, p99;
+        stats_.GetSummary(i, average, p99);
+        text += ToString("%-12s avg %6.2f ms  p99 %6.2f ms\n", EditorStats::GetSectionName(i), average, p99);
+    }
+
+    Renderer* renderer = GetSubsystem<Renderer>();
+    text += "entities " + String(spatialIndex_.GetNumEntities()) + "  nodes " + String(scene_->GetNumChildren(true)) +
+        "  polygons " + String(polygons_.Size()) + "  polygon fixtures " + String(fixtureCount_) + "  chunks " +
+        String(chunks_.GetNumResident()) + "\n";
+    text += "batches " + String(renderer->GetNumBatches()) + "  primitives " + String(renderer->GetNumPrimitives()) +
+        "  (F4 saves CSV)";
+    statsText_->SetText(text);
 }
 
 
 void MapEditor::HandleMouseButtonDown(StringHash eventType, VariantMap& eventData)
 {
     using namespace MouseButtonDown;
+    EDITOR_PROFILE(MOUSEDOWN);
 
     dragPointEnd = GetDiscreetPosition();
     dragPointBegin = Vector2(dragPointEnd.x_, dragPointEnd.y_+0.7f);
@@ -470,6 +1460,14 @@ void MapEditor::HandleMouseButtonDown(StringHash eventType, VariantMap& eventDat
     if (GetSubsystem<UI>()->GetFocusElement())
         return;
 
+    if (currentKeyFunction == SELECT)
+    {
+        // Right and middle clicks never start a drag
+        if (eventData[P_BUTTON].GetInt() == MOUSEB_LEFT)
+            BeginSelectionDrag();
+        return;
+    }
+
     switch (currentFunction)
     {
         case DRAWBODY:
@@ -482,21 +1480,22 @@ void MapEditor::HandleMouseButtonDown(StringHash eventType, VariantMap& eventDat
                     CreateEnemy(GetDiscreetPosition()+Vector2(0.35f,0.35f));
                 if(currentKeyFunction == REMOVE)
                 {
-                    PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
-                    RigidBody2D* rigidBody = physicsWorld->GetRigidBody(GetMousePositionXY());
-                    if (rigidBody)
-                    {
-                        Node* removenode = rigidBody->GetNode();
-                        if(removenode->GetName() == "enemy")
-                        {
-                            ObjectData* data = removenode->GetComponent<ObjectData>();
-                            ObjectList.Remove(data);
-                        }
-                        removenode->Remove();
-                    }
+                    ObjectData* removeobject = static_cast<ObjectData*>(PickEntity(GetMousePositionXY(), ENTITY_ENEMY));
+                    if(removeobject)
+                        RemoveObject(removeobject);
                 }
             }
             break;
+        case DRAWPREFAB:
+            if(currentKeyFunction == ADD && currentPrefab_ < prefabs_.Size())
+                StampPrefab(currentPrefab_, GetDiscreetPosition());
+            if(currentKeyFunction == REMOVE)
+            {
+                PrefabInstance* removeinstance = static_cast<PrefabInstance*>(PickEntity(GetMousePositionXY(), ENTITY_PREFAB));
+                if(removeinstance)
+                    RemoveInstance(removeinstance);
+            }
+            break;
     }
 
     /*SubscribeToEvent(E_MOUSEMOVE, HANDLER(MapEditor, HandleMouseMove));
@@ -506,6 +1505,15 @@ void MapEditor::HandleMouseButtonDown(StringHash eventType, VariantMap& eventDat
 
 void MapEditor::HandleMouseMove(StringHash eventType, VariantMap& eventData)
 {
+    EDITOR_PROFILE(MOUSEMOVE);
+    if (currentKeyFunction == SELECT)
+    {
+        // The selection itself only moves on release, DrawSelection previews it meanwhile
+        Vector2 position = GetMousePositionXY();
+        if(selecting_ && !lasso_.Empty() && (position - lasso_.Back()).LengthSquared() > LASSO_STEP * LASSO_STEP)
+            lasso_.Push(position);
+        return;
+    }
     switch (currentFunction)
     {
         case DRAWBODY:
@@ -513,10 +1521,7 @@ void MapEditor::HandleMouseMove(StringHash eventType, VariantMap& eventData)
             {
             case MOVPLATFORM:
                 if(currentpd)
-                {
-                    currentpd->imagereference->SetPosition2D(GetDiscreetPosition()+Vector2(0.7f,+0.6f));
-                    currentpd->p2 = GetDiscreetPosition()+Vector2(0.7f,+0.6f);
-                }
+                    MovePlatformTarget(currentpd, GetDiscreetPosition()+Vector2(0.7f,+0.6f));
                 break;
             case MIDLEPLATFORM:
             case PLATFORM:
@@ -525,7 +1530,7 @@ void MapEditor::HandleMouseMove(StringHash eventType, VariantMap& eventData)
             case VERTEXPOLYGON:
                 if(currentKeyFunction == TRASLATE)
                     if(selectObject_)
-                        CurrentVertex->SetVector(GetDiscreetPosition());
+                        MovePolygonVertex(CurrentVertexPolygon, CurrentVertex, GetDiscreetPosition());
                 break;
             }
             break;
@@ -535,7 +1540,7 @@ void MapEditor::HandleMouseMove(StringHash eventType, VariantMap& eventData)
             if(currentCharType == PLAYER)
             {
                 if(currentKeyFunction == TRASLATE)
-                    nodePlayer->SetPosition2D(GetDiscreetPosition()+Vector2(0.35f,0.35f));
+                    MovePlayer(GetDiscreetPosition()+Vector2(0.35f,0.35f));
             }
             break;
     }
@@ -543,15 +1548,32 @@ void MapEditor::HandleMouseMove(StringHash eventType, VariantMap& eventData)
 
 void MapEditor::HandleMouseButtonUp(StringHash eventType, VariantMap& eventData)
 {
+    using namespace MouseButtonUp;
+    EDITOR_PROFILE(MOUSEUP);
+    if (currentKeyFunction == SELECT)
+    {
+        if (eventData[P_BUTTON].GetInt() != MOUSEB_LEFT)
+            return;
+        // Released over the UI, the drag is dropped instead of moving or selecting anything
+        if (GetSubsystem<UI>()->GetFocusElement())
+        {
+            selecting_ = false;
+            movingSelection_ = false;
+            lasso_.Clear();
+            return;
+        }
+        EndSelectionDrag();
+        return;
+    }
     if (!GetSubsystem<UI>()->GetFocusElement())
     {
         if(currentKeyFunction == ADD)
         {
             drawRectangle = false;
             if(currentBodyType == PLATFORM)
-                CreatePlatform(dragPointBegin, dragPointEnd, "platform");
+                CreatePlatform(dragPointBegin, dragPointEnd, ENTITY_TYPE_PLATFORM);
             if(currentBodyType == MIDLEPLATFORM)
-                CreatePlatform(dragPointBegin, dragPointEnd, "midleplatform");
+                CreatePlatform(dragPointBegin, dragPointEnd, ENTITY_TYPE_MIDLEPLATFORM);
         }
     }
     currentpd = 0;
@@ -567,9 +1589,9 @@ void MapEditor::HandleMouseButtonUp(StringHash eventType, VariantMap& eventData)
 
 void MapEditor::bodyFunctions()
 {
-    Node* nodevertex;
-    PolygonVertex * cvertex;
-    Node* removenode;
+    PlatformData* removeplatform;
+    PolygonData* pickpolygon;
+    unsigned pickvertex;
 
     switch (currentBodyType)
     {
@@ -580,19 +1602,9 @@ void MapEditor::bodyFunctions()
         }
         if(currentKeyFunction == REMOVE)
         {
-            PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
-            RigidBody2D* rigidBody = physicsWorld->GetRigidBody(GetMousePositionXY());
-            if (rigidBody)
-            {
-                removenode = rigidBody->GetNode();
-                if(removenode->GetName() == "movplatform")
-                {
-                    PlatformData* platdata = removenode->GetComponent<PlatformData>();
-                    platdata->imagereference->Remove();
-                    PlatformsList.Remove(platdata);
-                    removenode->Remove();
-                }
-            }
+            removeplatform = static_cast<PlatformData*>(PickEntity(GetMousePositionXY(), ENTITY_MOVPLATFORM));
+            if(removeplatform)
+                RemovePlatform(removeplatform);
         }
         break;
     case MIDLEPLATFORM:
@@ -603,92 +1615,45 @@ void MapEditor::bodyFunctions()
         }
         if(currentKeyFunction == REMOVE)
         {
-            PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
-            RigidBody2D* rigidBody = physicsWorld->GetRigidBody(GetMousePositionXY());
-            if (rigidBody)
-            {
-                removenode = rigidBody->GetNode();
-                if(removenode->GetName() == "wall")
-                {
-                    PlatformData* platdata = removenode->GetComponent<PlatformData>();
-                    PlatformsList.Remove(platdata);
-                    platdata->imagereference->Remove();
-                    removenode->Remove();
-                }
-            }
+            removeplatform = static_cast<PlatformData*>(PickEntity(GetMousePositionXY(), ENTITY_PLATFORM));
+            if(removeplatform)
+                RemovePlatform(removeplatform);
         }
         break;
     case POLYGONBODY:
         if(currentKeyFunction == ADD)
         {
-            PolygonMap.Insert(Pair<String, Vector<PolygonVertex *>*>("Polygon" + String(PolygonCounter), CreatePolygon()));
-            PolygonCounter++;
-            LoadPolygonList();
+            CreatePolygon();
         }
         if(currentKeyFunction == REMOVE)
         {
-            PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
-            RigidBody2D* rigidBody = physicsWorld->GetRigidBody(GetMousePositionXY());
-            if (rigidBody)
-            {
-                PolygonVertex * p = rigidBody->GetComponent<PolygonVertex>();
-                RemovePolygon(p);
-            }
+            if(PickPolygonVertex(GetMousePositionXY(), pickpolygon, pickvertex))
+                RemovePolygon(pickpolygon);
         }
         break;
     case VERTEXPOLYGON:
-        PhysicsWorld2D* physicsWorld = scene_->GetComponent<PhysicsWorld2D>();
-        RigidBody2D* rigidBody = physicsWorld->GetRigidBody(GetMousePositionXY());
         switch (currentKeyFunction)
         {
         case NONE:
-            if(rigidBody)
+            if(PickPolygonVertex(GetMousePositionXY(), pickpolygon, pickvertex))
             {
-                if(selectObject_)
-                    CurrentVertex->setUnselect();
-                CurrentVertex = rigidBody->GetComponent<PolygonVertex>();
-                if(CurrentVertex)
-                {
-                    CurrentVertex->setSelect();
-                    selectObject_ = true;
-                }
+                CurrentVertexPolygon = pickpolygon;
+                CurrentVertex = pickvertex;
+                selectObject_ = true;
             }
-            else{
+            else
                 selectObject_ = false;
-                if(CurrentVertex)
-                    CurrentVertex->setUnselect();
-            }
             break;
         case REMOVE:
-            if(rigidBody)
+            if(PickPolygonVertex(GetMousePositionXY(), pickpolygon, pickvertex))
             {
-                CurrentVertex = rigidBody->GetComponent<PolygonVertex>();
-                if(CurrentVertex)
-                {
-                    if(CurrentPolygon)
-                    {
-                        if(CurrentPolygon->Remove(*(CurrentPolygon->Find(CurrentVertex))))
-                        {
-                            removenode = rigidBody->GetNode();
-                            removenode->Remove();
-                            selectObject_ = false;
-                        }
-                    }
-                }
+                RemovePolygonVertex(pickpolygon, pickvertex);
+                selectObject_ = false;
             }
             break;
         case ADD:
-            if(CurrentPolygon)
-            {
-                if(selectObject_)
-                {
-                    nodevertex = scene_->CreateChild("vertex");
-                    cvertex = nodevertex->CreateComponent<PolygonVertex>();
-                    cvertex->SetVector(GetDiscreetPosition());
-                    insertVertex(CurrentPolygon, cvertex);
-                }
-
-            }
+            if(selectObject_)
+                insertVertex(CurrentVertexPolygon, GetDiscreetPosition());
             break;
         case TRASLATE:
             if(!selectObject_)
@@ -702,193 +1667,917 @@ void MapEditor::bodyFunctions()
     }
 }
 
-void MapEditor::DrawRectangle(Rect rect)
+void MapEditor::DrawRectangle(Rect rect)
+{
+    DebugRenderer* debug = scene_->GetComponent<DebugRenderer>();
+
+    Vector3 point1(rect.min_, 0);
+    Vector3 point3(rect.max_, 0);
+    Vector3 point2(point1.x_, point3.y_, 0);
+    Vector3 point4(point3.x_, point1.y_, 0);
+    Color color(1, 0, 0, 1);
+
+    debug->AddLine( point1, point2, color, false );
+    debug->AddLine( point2, point3, color, false );
+    debug->AddLine( point3, point4, color, false );
+    debug->AddLine( point4, point1, color, false );
+}
+
+/// Take the data component of a released entity off its node and remove the node with everything built on it.
+static void DetachEntity(Component* data)
+{
+    Node* node = data->GetNode();
+    if(!node)
+        return;
+    node->RemoveComponent(data);
+    node->Remove();
+}
+
+/// Area an object covers, for picking and streaming.
+static Rect ObjectBounds(const Vector2& position)
+{
+    return Rect(position - Vector2(0.2f, 0.2f), position + Vector2(0.2f, 0.2f));
+}
+
+ObjectData* MapEditor::CreateEnemy(Vector2 p1)
+{
+    // Only the registry holds the data until the enemy gets a node in a resident chunk
+    ObjectData* data = new ObjectData(context_);
+    data->type = ENTITY_TYPE_ENEMY;
+    data->Code = "t01";
+    data->SetPostion(p1);
+    Rect bounds = ObjectBounds(p1);
+    data->handle = spatialIndex_.Insert(ENTITY_ENEMY, data, 0, bounds);
+
+    entities_.Add(data);
+    journal_.Append(JOURNAL_CREATEENEMY, 0, 0, p1);
+    if(chunks_.IsResident(bounds))
+        InstantiateObject(data);
+    return data;
+}
+
+void MapEditor::InstantiateObject(ObjectData* data)
+{
+    if(data->resident)
+        return;
+    data->resident = true;
+    Node* node = nodeWall->CreateChild("enemy");
+    node->AddComponent(data, 0, REPLICATED);
+    node->SetPosition2D(data->position);
+    CreateObjectSprite(node);
+}
+
+void MapEditor::CreateObjectSprite(Node* node)
+{
+    Sprite2D* vertexsprite = GetSubsystem<ResourceCache>()->GetResource<Sprite2D>("Urho2D/object.png");
+    if (!vertexsprite)
+        return;
+	StaticSprite2D* staticSprite = node->CreateComponent<StaticSprite2D>();
+	staticSprite->SetSprite(vertexsprite);
+	staticSprite->SetLayer(60000);
+	staticSprite->SetColor(Color(Color::RED,1));
+}
+
+void MapEditor::ReleaseObject(ObjectData* data)
+{
+    if(!data->resident)
+        return;
+    data->resident = false;
+    DetachEntity(data);
+}
+
+void MapEditor::MovePlayer(Vector2 position)
+{
+    if(nodePlayer->GetPosition2D() == position)
+        return;
+    nodePlayer->SetPosition2D(position);
+    journal_.Append(JOURNAL_MOVEPLAYER, 0, 0, position);
+}
+
+/// Area a platform covers, for picking and streaming.
+static Rect PlatformBounds(const Vector2& p1, const Vector2& p2, unsigned type)
+{
+    if(type == ENTITY_TYPE_MOVPLATFORM)
+        return Rect(p1 - Vector2(0.7f, 0.1f), p1 + Vector2(0.7f, 0.1f));
+    float mwith = fabs(p2.x_ - p1.x_)/2;
+    float mheigth = 0.35f;
+    Vector2 pos((p2.x_ + p1.x_)/2, (p2.y_ + p1.y_)/2);
+    return Rect(pos - Vector2(mwith, mheigth), pos + Vector2(mwith, mheigth));
+}
+
+static Rect PlatformBounds(const PlatformData* platData)
+{
+    return PlatformBounds(platData->p1, platData->p2, platData->type);
+}
+
+PlatformData* MapEditor::CreatePlatform(Vector2 p1, Vector2 p2, EntityType typePlatform)
+{
+    if(p2.x_ == p1.x_)
+        return 0;
+    PlatformData* platData = new PlatformData(context_);
+    platData->p1 = p1;
+    platData->p2 = p2;
+    platData->type = typePlatform;
+    Rect bounds = PlatformBounds(platData);
+    platData->handle = spatialIndex_.Insert(ENTITY_PLATFORM, platData, 0, bounds);
+    entities_.Add(platData);
+    journal_.Append(JOURNAL_CREATEPLATFORM, 0, typePlatform, p1, p2);
+    if(chunks_.IsResident(bounds))
+        InstantiatePlatform(platData);
+    return platData;
+}
+
+PlatformData* MapEditor::CreateMovablePlatform(Vector2 p1, Vector2 p2)
+{
+    PlatformData* platdata = new PlatformData(context_);
+    platdata->type = ENTITY_TYPE_MOVPLATFORM;
+    platdata->p1 = p1;
+    platdata->p2 = p2;
+    Rect bounds = PlatformBounds(platdata);
+    platdata->handle = spatialIndex_.Insert(ENTITY_MOVPLATFORM, platdata, 0, bounds);
+
+    entities_.Add(platdata);
+    currentpd = platdata;
+    journal_.Append(JOURNAL_CREATEMOVPLATFORM, 0, 0, p1, p2);
+    if(chunks_.IsResident(bounds))
+        InstantiatePlatform(platdata);
+    return platdata;
+}
+
+void MapEditor::InstantiatePlatform(PlatformData* platData)
+{
+    if(platData->resident)
+        return;
+    platData->resident = true;
+    bool movable = platData->type == ENTITY_TYPE_MOVPLATFORM;
+    Node* node = nodeWall->CreateChild(movable ? "movplatform" : "wall");
+    node->AddComponent(platData, 0, REPLICATED);
+    node->SetPosition2D(movable ? platData->p1 : (platData->p1 + platData->p2) / 2);
+    platData->imagereference = CreatePlatformBodies(node, platData->p1, platData->p2, platData->type);
+}
+
+Node* MapEditor::CreatePlatformBodies(Node* node, Vector2 p1, Vector2 p2, EntityType type)
+{
+    // Reference nodes go next to the platform node, under nodeWall or the instance it belongs to
+    if(type == ENTITY_TYPE_MOVPLATFORM)
+    {
+        ResourceCache* cache = GetSubsystem<ResourceCache>();
+        PODVector<Vector2> vertices;
+        vertices.Push(Vector2(-0.7f,0.1f));
+        vertices.Push(Vector2(0.7f,0.1f));
+        vertices.Push(Vector2(0.7f,-0.1f));
+        vertices.Push(Vector2(-0.7f,-0.1f));
+
+        Sprite2D* movplatformsprite = cache->GetResource<Sprite2D>("Urho2D/movplatform.png");
+        if (!movplatformsprite)
+            return 0;
+
+        StaticSprite2D* movplatformstaticSprite = node->CreateComponent<StaticSprite2D>();
+        movplatformstaticSprite->SetSprite(movplatformsprite);
+
+        RigidBody2D* platfotmbody = node->CreateComponent<RigidBody2D>();
+        platfotmbody->SetBodyType(BT_KINEMATIC);
+        platfotmbody->SetFixedRotation(true);
+
+        CollisionPolygon2D* box = node->CreateComponent<CollisionPolygon2D>();
+        box->SetVertices(vertices);
+        box->SetDensity(1.0f);
+        box->SetFriction(0.5f);
+        box->SetRestitution(0.0f);
+        box->SetCategoryBits(32768);
+
+        Node* movplatformreference = node->GetParent()->CreateChild("reference");
+
+        StaticSprite2D* platformref = movplatformreference->CreateComponent<StaticSprite2D>();
+        platformref->SetSprite(movplatformsprite);
+        movplatformreference->SetWorldPosition2D(p2);
+        return movplatformreference;
+    }
+
+    float mwith = fabs(p2.x_ - p1.x_)/2;
+    float mheigth = 0.35f;
+
+    RigidBody2D* body = node->CreateComponent<RigidBody2D>();
+    body->SetBodyType(BT_STATIC);
+
+    PODVector<Vector2> vertices;
+    if(type == ENTITY_TYPE_PLATFORM)
+    {
+        vertices.Push(Vector2(-mwith,mheigth/2));
+        vertices.Push(Vector2(mwith,mheigth/2));
+        vertices.Push(Vector2(mwith,-mheigth));
+        vertices.Push(Vector2(-mwith,-mheigth));
+    }
+    else{
+        vertices.Push(Vector2(-mwith,mheigth/2));
+        vertices.Push(Vector2(mwith,mheigth/2));
+        vertices.Push(Vector2(mwith,0));
+        vertices.Push(Vector2(-mwith,0));
+    }
+
+    CollisionPolygon2D* box = node->CreateComponent<CollisionPolygon2D>();
+    box->SetVertices(vertices);
+    box->SetDensity(1.0f);
+    box->SetFriction(0.0f);
+    box->SetRestitution(0.1f);
+    box->SetCategoryBits(32768);
+
+    Node* pnode  = node->GetParent()->CreateChild("platform");
+    pnode->SetWorldPosition2D(node->GetWorldPosition2D());
+    RigidBody2D* pbody = pnode->CreateComponent<RigidBody2D>();
+    pbody->SetBodyType(BT_STATIC);
+
+    PODVector<Vector2> pvertices;
+    pvertices.Push(Vector2(-mwith,mheigth));
+    pvertices.Push(Vector2(mwith,mheigth));
+    pvertices.Push(Vector2(mwith,mheigth/2));
+    pvertices.Push(Vector2(-mwith,mheigth/2));
+
+    CollisionPolygon2D* pbox = pnode->CreateComponent<CollisionPolygon2D>();
+    pbox->SetVertices(pvertices);
+    pbox->SetDensity(1.0f);
+    pbox->SetFriction(0.5f);
+    pbox->SetRestitution(0.1f);
+    pbox->SetCategoryBits(32768);
+    return pnode;
+}
+
+void MapEditor::ReleasePlatform(PlatformData* platData)
+{
+    if(!platData->resident)
+        return;
+    platData->resident = false;
+
+    // The bodies and sprite go with the node, the registry keeps the PlatformData for picking, saving and the journal
+    if(platData->imagereference)
+        platData->imagereference->Remove();
+    platData->imagereference = 0;
+    DetachEntity(platData);
+}
+
+void MapEditor::MovePlatformTarget(PlatformData* platform, Vector2 p2)
+{
+    if(platform->p2 == p2)
+        return;
+    if(platform->imagereference)
+        platform->imagereference->SetPosition2D(p2);
+    platform->p2 = p2;
+    journal_.Append(JOURNAL_PLATFORMTARGET, EntityRegistry::GetReference(platform), 0, p2);
+}
+
+void* MapEditor::PickEntity(Vector2 position, EditorEntityKind kind)
+{
+    unsigned handle;
+    if(!spatialIndex_.QueryPoint(position, 1 << kind, handle))
+        return 0;
+    return spatialIndex_.GetEntity(handle).object_;
+}
+
+void MapEditor::RemovePlatform(PlatformData* platdata)
+{
+    journal_.Append(JOURNAL_REMOVEPLATFORM, EntityRegistry::GetReference(platdata));
+    selection_.Remove(platdata->handle);
+    spatialIndex_.Remove(platdata->handle);
+    movedPlatforms_.Remove(platdata);
+    if(platdata->imagereference)
+        platdata->imagereference->Remove();
+    DetachEntity(platdata);
+    entities_.Remove(platdata);
+}
+
+void MapEditor::RemoveObject(ObjectData* data)
+{
+    journal_.Append(JOURNAL_REMOVEOBJECT, EntityRegistry::GetReference(data));
+    selection_.Remove(data->handle);
+    spatialIndex_.Remove(data->handle);
+    DetachEntity(data);
+    entities_.Remove(data);
+}
+
+void MapEditor::MovePlatform(PlatformData* platData, Vector2 p1, Vector2 p2)
+{
+    // Box2D would follow the node with every move, the bodies are dropped and RebuildMovedEntities makes new ones
+    if(platData->resident)
+    {
+        ReleasePlatform(platData);
+        movedPlatforms_.Push(platData);
+    }
+    platData->p1 = p1;
+    platData->p2 = p2;
+    spatialIndex_.Move(platData->handle, PlatformBounds(platData));
+    journal_.Append(JOURNAL_MOVEPLATFORM, EntityRegistry::GetReference(platData), 0, p1, p2);
+}
+
+void MapEditor::RebuildMovedEntities()
+{
+    for(unsigned i = 0; i < movedPlatforms_.Size(); i++)
+    {
+        if(chunks_.IsResident(PlatformBounds(movedPlatforms_[i])))
+            InstantiatePlatform(movedPlatforms_[i]);
+    }
+    movedPlatforms_.Clear();
+    for(unsigned i = 0; i < movedInstances_.Size(); i++)
+    {
+        if(chunks_.IsResident(GetInstanceBounds(movedInstances_[i])))
+            InstantiateInstance(movedInstances_[i]);
+    }
+    movedInstances_.Clear();
+}
+
+void MapEditor::MoveObject(ObjectData* data, Vector2 position)
+{
+    data->SetPostion(position);
+    spatialIndex_.Move(data->handle, ObjectBounds(position));
+    journal_.Append(JOURNAL_MOVEOBJECT, EntityRegistry::GetReference(data), 0, position);
+}
+
+/// Even-odd test of a point against the closed lasso outline.
+static bool InsideLasso(const PODVector<Vector2>& lasso, const Vector2& point)
+{
+    bool inside = false;
+    for(unsigned i = 0, j = lasso.Size() - 1; i < lasso.Size(); j = i++)
+    {
+        const Vector2& a = lasso[i];
+        const Vector2& b = lasso[j];
+        if((a.y_ > point.y_) != (b.y_ > point.y_) && point.x_ < (b.x_ - a.x_) * (point.y_ - a.y_) / (b.y_ - a.y_) + a.x_)
+            inside = !inside;
+    }
+    return inside;
+}
+
+void MapEditor::BeginSelectionDrag()
+{
+    Vector2 position = GetMousePositionXY();
+
+    // Pressing on a selected entity drags the whole selection, anywhere else starts a new rectangle or lasso
+    PODVector<unsigned> handles;
+    spatialIndex_.QueryRect(Rect(position, position), SELECTABLE_KINDS, handles);
+    for(unsigned i = 0; i < handles.Size(); i++)
+    {
+        if(selection_.Contains(handles[i]))
+        {
+            movingSelection_ = true;
+            moveStart_ = GetDiscreetPosition();
+            return;
+        }
+    }
+
+    selecting_ = true;
+    selectStart_ = position;
+    lasso_.Clear();
+    if(GetSubsystem<Input>()->GetQualifierDown(QUAL_SHIFT))
+        lasso_.Push(position);
+}
+
+void MapEditor::EndSelectionDrag()
+{
+    if(movingSelection_)
+    {
+        movingSelection_ = false;
+        MoveSelection(GetDiscreetPosition() - moveStart_);
+        return;
+    }
+    if(!selecting_)
+        return;
+    selecting_ = false;
+
+    Vector2 position = GetMousePositionXY();
+    Rect area(selectStart_, selectStart_);
+    if(lasso_.Size() < 3)
+    {
+        lasso_.Clear();
+        area.Merge(position);
+    }
+    else
+    {
+        for(unsigned i = 1; i < lasso_.Size(); i++)
+            area.Merge(lasso_[i]);
+    }
+
+    // Ctrl adds to the selection
+    bool add = GetSubsystem<Input>()->GetQualifierDown(QUAL_CTRL);
+    if(!add)
+        selection_.Clear();
+    PODVector<unsigned> handles;
+    spatialIndex_.QueryRect(area, SELECTABLE_KINDS, handles);
+    for(unsigned i = 0; i < handles.Size(); i++)
+    {
+        if(!lasso_.Empty() && !InsideLasso(lasso_, spatialIndex_.GetEntity(handles[i]).bounds_.Center()))
+            continue;
+        if(!add || !selection_.Contains(handles[i]))
+            selection_.Push(handles[i]);
+    }
+    lasso_.Clear();
+}
+
+void MapEditor::MoveSelection(Vector2 delta)
+{
+    if(selection_.Empty() || delta == Vector2::ZERO)
+        return;
+
+    journal_.BeginBatch();
+    for(unsigned i = 0; i < selection_.Size(); i++)
+    {
+        const EditorEntity& entity = spatialIndex_.GetEntity(selection_[i]);
+        if(entity.kind_ == ENTITY_VERTEX)
+        {
+            PolygonData* polygon = static_cast<PolygonData*>(entity.object_);
+            MovePolygonVertex(polygon, entity.index_, polygon->vertices[entity.index_] + delta);
+        }
+        else if(entity.kind_ == ENTITY_ENEMY)
+        {
+            ObjectData* data = static_cast<ObjectData*>(entity.object_);
+            MoveObject(data, data->position + delta);
+        }
+        else if(entity.kind_ == ENTITY_PREFAB)
+        {
+            PrefabInstance* instance = static_cast<PrefabInstance*>(entity.object_);
+            MoveInstance(instance, instance->offset + delta);
+        }
+        else
+        {
+            PlatformData* platData = static_cast<PlatformData*>(entity.object_);
+            MovePlatform(platData, platData->p1 + delta, platData->p2 + delta);
+        }
+    }
+    journal_.EndBatch();
+    // Polygons are only marked dirty, the next process rebakes each of them once
+    RebuildMovedEntities();
+}
+
+void MapEditor::DeleteSelection()
+{
+    if(selection_.Empty())
+        return;
+
+    // Removing entities frees their handles, so the targets are collected first
+    PODVector<PlatformData*> platforms;
+    PODVector<ObjectData*> objects;
+    PODVector<PrefabInstance*> instances;
+    HashMap<PolygonData*, PODVector<unsigned> > vertices;
+    for(unsigned i = 0; i < selection_.Size(); i++)
+    {
+        const EditorEntity& entity = spatialIndex_.GetEntity(selection_[i]);
+        if(entity.kind_ == ENTITY_VERTEX)
+            vertices[static_cast<PolygonData*>(entity.object_)].Push(entity.index_);
+        else if(entity.kind_ == ENTITY_ENEMY)
+            objects.Push(static_cast<ObjectData*>(entity.object_));
+        else if(entity.kind_ == ENTITY_PREFAB)
+            instances.Push(static_cast<PrefabInstance*>(entity.object_));
+        else
+            platforms.Push(static_cast<PlatformData*>(entity.object_));
+    }
+    selection_.Clear();
+
+    journal_.BeginBatch();
+    for(unsigned i = 0; i < platforms.Size(); i++)
+        RemovePlatform(platforms[i]);
+    for(unsigned i = 0; i < objects.Size(); i++)
+        RemoveObject(objects[i]);
+    for(unsigned i = 0; i < instances.Size(); i++)
+        RemoveInstance(instances[i]);
+    for(HashMap<PolygonData*, PODVector<unsigned> >::Iterator i = vertices.Begin(); i != vertices.End(); ++i)
+    {
+        PolygonData* polygon = i->first_;
+        PODVector<unsigned>& indices = i->second_;
+        // A polygon left with less than a triangle goes as a whole
+        if(polygon->vertices.Size() < indices.Size() + 3)
+        {
+            RemovePolygon(polygon);
+            continue;
+        }
+        Sort(indices.Begin(), indices.End());
+        for(unsigned j = indices.Size(); j > 0; j--)
+            RemovePolygonVertex(polygon, indices[j - 1]);
+    }
+    journal_.EndBatch();
+}
+
+void MapEditor::DuplicateSelection()
+{
+    if(selection_.Empty())
+        return;
+
+    // Copies land one grid step down and right. Polygons are copied when all their vertices are selected, lone
+    // vertices have nothing to be copied into
+    Vector2 offset(0.7f, -0.7f);
+    PODVector<PlatformData*> platforms;
+    PODVector<ObjectData*> objects;
+    PODVector<PrefabInstance*> instances;
+    HashMap<PolygonData*, unsigned> polygons;
+    for(unsigned i = 0; i < selection_.Size(); i++)
+    {
+        const EditorEntity& entity = spatialIndex_.GetEntity(selection_[i]);
+        if(entity.kind_ == ENTITY_VERTEX)
+            polygons[static_cast<PolygonData*>(entity.object_)]++;
+        else if(entity.kind_ == ENTITY_ENEMY)
+            objects.Push(static_cast<ObjectData*>(entity.object_));
+        else if(entity.kind_ == ENTITY_PREFAB)
+            instances.Push(static_cast<PrefabInstance*>(entity.object_));
+        else
+            platforms.Push(static_cast<PlatformData*>(entity.object_));
+    }
+
+    // The copies become the selection, ready to be dragged into place
+    PODVector<unsigned> copies;
+    journal_.BeginBatch();
+    for(unsigned i = 0; i < platforms.Size(); i++)
+    {
+        PlatformData* platData = platforms[i];
+        PlatformData* copy;
+        if(platData->type == ENTITY_TYPE_MOVPLATFORM)
+            copy = CreateMovablePlatform(platData->p1 + offset, platData->p2 + offset);
+        else
+            copy = CreatePlatform(platData->p1 + offset, platData->p2 + offset, platData->type);
+        if(copy)
+            copies.Push(copy->handle);
+    }
+    currentpd = 0;
+    for(unsigned i = 0; i < objects.Size(); i++)
+        copies.Push(CreateEnemy(objects[i]->position + offset)->handle);
+    for(unsigned i = 0; i < instances.Size(); i++)
+        copies.Push(StampPrefab(instances[i]->prefab, instances[i]->offset + offset)->handle);
+    for(HashMap<PolygonData*, unsigned>::ConstIterator i = polygons.Begin(); i != polygons.End(); ++i)
+    {
+        PolygonData* polygon = i->first_;
+        if(i->second_ < polygon->vertices.Size())
+            continue;
+        PolygonData* copy = AddPolygon();
+        polygonList_->Add(PolygonRegistry::GetName(copy->id), copy->id);
+        for(unsigned j = 0; j < polygon->vertices.Size(); j++)
+            AddPolygonVertex(copy, j, polygon->vertices[j] + offset);
+        SetPolygonMode(copy, polygon->mode);
+        copies.Push(copy->handles);
+    }
+    journal_.EndBatch();
+    selection_ = copies;
+}
+
+/// Outline of a rect for DrawSelection.
+static void AddRect(DebugRenderer* debug, const Rect& rect, const Color& color)
 {
-    DebugRenderer* debug = scene_->GetComponent<DebugRenderer>();
-
     Vector3 point1(rect.min_, 0);
     Vector3 point3(rect.max_, 0);
     Vector3 point2(point1.x_, point3.y_, 0);
     Vector3 point4(point3.x_, point1.y_, 0);
-    Color color(1, 0, 0, 1);
-
-    debug->AddLine( point1, point2, color, false );
-    debug->AddLine( point2, point3, color, false );
-    debug->AddLine( point3, point4, color, false );
-    debug->AddLine( point4, point1, color, false );
+    debug->AddLine(point1, point2, color, false);
+    debug->AddLine(point2, point3, color, false);
+    debug->AddLine(point3, point4, color, false);
+    debug->AddLine(point4, point1, color, false);
 }
 
-void MapEditor::CreateEnemy(Vector2 p1)
+void MapEditor::DrawSelection()
 {
-    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    DebugRenderer* debug = scene_->GetComponent<DebugRenderer>();
+    Color color(1.0f, 0.8f, 0.0f);
 
-    Node* enemynode = nodeWall->CreateChild("enemy");
+    // A dragged selection is drawn where it would land
+    Vector2 offset = movingSelection_ ? GetDiscreetPosition() - moveStart_ : Vector2::ZERO;
+    for(unsigned i = 0; i < selection_.Size(); i++)
+    {
+        const Rect& bounds = spatialIndex_.GetEntity(selection_[i]).bounds_;
+        AddRect(debug, Rect(bounds.min_ + offset, bounds.max_ + offset), color);
+    }
 
-    Sprite2D* vertexsprite = cache->GetResource<Sprite2D>("Urho2D/object.png");
-    if (!vertexsprite)
+    if(!selecting_)
         return;
-	StaticSprite2D* staticSprite = enemynode->CreateComponent<StaticSprite2D>();
-	staticSprite->SetSprite(vertexsprite);
-	staticSprite->SetLayer(60000);
-	staticSprite->SetColor(Color(Color::RED,1));
+    Vector2 position = GetMousePositionXY();
+    if(lasso_.Empty())
+    {
+        Rect area(selectStart_, selectStart_);
+        area.Merge(position);
+        AddRect(debug, area, color);
+        return;
+    }
+    for(unsigned i = 1; i < lasso_.Size(); i++)
+        debug->AddLine(Vector3(lasso_[i - 1], 0), Vector3(lasso_[i], 0), color, false);
+    debug->AddLine(Vector3(lasso_.Back(), 0), Vector3(position, 0), color, false);
+    debug->AddLine(Vector3(position, 0), Vector3(lasso_[0], 0), color, false);
+}
+
+/// Static body of a polygon on a new "Wall" child of parent, a chain loop around the outline or one fixture per
+/// convex piece. Returns null if there is nothing to collide with.
+static Node* CreateWallBody(Node* parent, const PODVector<Vector2>& vertices, unsigned mode, const ConvexPieces& pieces)
+{
+    if(mode == CHAINBODY)
+    {
+        // Box2D chains reject repeated consecutive points
+        PODVector<Vector2> outline;
+        for(unsigned i = 0; i < vertices.Size(); i++)
+        {
+            if(outline.Empty() || outline.Back() != vertices[i])
+                outline.Push(vertices[i]);
+        }
+        while(outline.Size() > 1 && outline.Back() == outline.Front())
+            outline.Pop();
+        if(outline.Size() < 3)
+            return 0;
+
+        Node* chainnode = parent->CreateChild("Wall");
+        RigidBody2D* body = chainnode->CreateComponent<RigidBody2D>();
+        body->SetBodyType(BT_STATIC);
 
-    RigidBody2D* bodysprite = enemynode->CreateComponent<RigidBody2D>();
-    bodysprite->SetBodyType(BT_STATIC);
+        CollisionChain2D* chain = chainnode->CreateComponent<CollisionChain2D>();
+        chain->SetLoop(true);
+        chain->SetVertices(outline);
+        chain->SetFriction(0.0f);
+        chain->SetRestitution(0.1f);
+        chain->SetCategoryBits(32768);
+        return chainnode;
+    }
 
-    CollisionCircle2D* circle = enemynode->CreateComponent<CollisionCircle2D>();
-    circle->SetRadius(0.2f);
+    if(pieces.Empty())
+        return 0;
 
-    ObjectData* data = enemynode->CreateComponent<ObjectData>();
-    data->type = "enemy";
-    data->Code = "t01";
-    data->SetPostion(p1);
+    Node* polygonnode = parent->CreateChild("Wall");
+    RigidBody2D* body = polygonnode->CreateComponent<RigidBody2D>();
+    body->SetBodyType(BT_STATIC);
 
-    ObjectList.Push(data);
+    // One scratch buffer for every fixture, SetVertices copies it
+    PODVector<Vector2> piecevertices;
+    for(unsigned j = 0; j < pieces.Size(); j++)
+    {
+        const Vector2* points = pieces.GetVertices(j);
+        piecevertices.Resize(pieces.GetNumVertices(j));
+        for(unsigned k = 0; k < piecevertices.Size(); k++)
+            piecevertices[k] = points[k];
+        CollisionPolygon2D* piece = polygonnode->CreateComponent<CollisionPolygon2D>();
+        piece->SetVertices(piecevertices);
+        piece->SetDensity(1.0f);
+        piece->SetFriction(0.0f);
+        piece->SetRestitution(0.1f);
+        piece->SetCategoryBits(32768);
+    }
+    return polygonnode;
 }
 
-void MapEditor::CreatePlatform(Vector2 p1, Vector2 p2, String typePlatform)
+void MapEditor::CapturePrefab()
 {
-    float mwith = fabs(p2.x_ - p1.x_)/2;
-    if(mwith == 0)
+    if(selection_.Empty())
         return;
-    float mheigth = 0.35f;
-    Vector2 pos((p2.x_ + p1.x_)/2, (p2.y_ + p1.y_)/2);
-
-    Node* node  = nodeWall->CreateChild("wall");
-    node->SetPosition2D(pos);
-
-    PlatformData* platData = node->CreateComponent<PlatformData>();
-    platData->p1 = p1;
-    platData->p2 = p2;
-    platData->type = typePlatform;
-    PlatformsList.Push(platData);
-
-    RigidBody2D* body = node->CreateComponent<RigidBody2D>();
-    body->SetBodyType(BT_STATIC);
 
-    PODVector<Vector2> vertices;
-    if(typePlatform == "platform")
+    Rect area = spatialIndex_.GetEntity(selection_[0]).bounds_;
+    PODVector<PlatformData*> platforms;
+    PODVector<ObjectData*> objects;
+    PODVector<PrefabInstance*> instances;
+    HashMap<PolygonData*, unsigned> polygons;
+    for(unsigned i = 0; i < selection_.Size(); i++)
     {
-        vertices.Push(Vector2(-mwith,mheigth/2));
-        vertices.Push(Vector2(mwith,mheigth/2));
-        vertices.Push(Vector2(mwith,-mheigth));
-        vertices.Push(Vector2(-mwith,-mheigth));
+        const EditorEntity& entity = spatialIndex_.GetEntity(selection_[i]);
+        area.Merge(entity.bounds_);
+        if(entity.kind_ == ENTITY_VERTEX)
+            polygons[static_cast<PolygonData*>(entity.object_)]++;
+        else if(entity.kind_ == ENTITY_ENEMY)
+            objects.Push(static_cast<ObjectData*>(entity.object_));
+        else if(entity.kind_ == ENTITY_PREFAB)
+            instances.Push(static_cast<PrefabInstance*>(entity.object_));
+        else
+            platforms.Push(static_cast<PlatformData*>(entity.object_));
     }
-    else{
-        vertices.Push(Vector2(-mwith,mheigth/2));
-        vertices.Push(Vector2(mwith,mheigth/2));
-        vertices.Push(Vector2(mwith,0));
-        vertices.Push(Vector2(-mwith,0));
+    PODVector<PolygonData*> wholePolygons;
+    for(HashMap<PolygonData*, unsigned>::ConstIterator i = polygons.Begin(); i != polygons.End(); ++i)
+    {
+        if(i->second_ == i->first_->vertices.Size())
+            wholePolygons.Push(i->first_);
     }
+    // Lone vertices can't go into a prefab
+    if(platforms.Empty() && objects.Empty() && instances.Empty() && wholePolygons.Empty())
+        return;
 
-    CollisionPolygon2D* box = node->CreateComponent<CollisionPolygon2D>();
-    box->SetVertices(vertices);
-    box->SetDensity(1.0f);
-    box->SetFriction(0.0f);
-    box->SetRestitution(0.1f);
-    box->SetCategoryBits(32768);
+    // The origin sits on the grid, so stamps placed at GetDiscreetPosition line up like the originals. Selected
+    // instances are not nested, their contents are copied in
+    Vector2 origin(floor(area.min_.x_ / 0.7f) * 0.7f, floor(area.min_.y_ / 0.7f) * 0.7f);
+    journal_.BeginBatch();
+    unsigned prefab = AddPrefab();
+    for(unsigned i = 0; i < platforms.Size(); i++)
+        AddPrefabPlatform(prefab, platforms[i]->p1 - origin, platforms[i]->p2 - origin, platforms[i]->type);
+    for(unsigned i = 0; i < objects.Size(); i++)
+        AddPrefabObject(prefab, objects[i]->position - origin, objects[i]->type);
+    for(unsigned i = 0; i < instances.Size(); i++)
+    {
+        const PrefabDefinition& source = prefabs_[instances[i]->prefab];
+        Vector2 shift = instances[i]->offset - origin;
+        for(unsigned j = 0; j < source.platforms_.Size(); j++)
+            AddPrefabPlatform(prefab, source.platforms_[j].p1_ + shift, source.platforms_[j].p2_ + shift, source.platforms_[j].type_);
+        for(unsigned j = 0; j < source.objects_.Size(); j++)
+            AddPrefabObject(prefab, source.objects_[j].position_ + shift, GetEntityType(source.objects_[j].type_));
+        for(unsigned j = 0; j < source.polygons_.Size(); j++)
+        {
+            AddPrefabPolygon(prefab, source.polygons_[j].mode_);
+            for(unsigned k = 0; k < source.polygons_[j].outline_.Size(); k++)
+                AddPrefabVertex(prefab, source.polygons_[j].outline_[k] + shift);
+        }
+    }
+    for(unsigned i = 0; i < wholePolygons.Size(); i++)
+    {
+        AddPrefabPolygon(prefab, wholePolygons[i]->mode);
+        for(unsigned j = 0; j < wholePolygons[i]->vertices.Size(); j++)
+            AddPrefabVertex(prefab, wholePolygons[i]->vertices[j] - origin);
+    }
+    journal_.EndBatch();
 
-    Node* pnode  = nodeWall->CreateChild("platform");
-    pnode->SetPosition2D(pos);
-    RigidBody2D* pbody = pnode->CreateComponent<RigidBody2D>();
-    pbody->SetBodyType(BT_STATIC);
+    const PrefabDefinition& definition = GetBakedPrefab(prefab);
+    URHO3D_LOGINFO("Captured " + definition.name_ + ": " + String(definition.platforms_.Size()) + " platforms, " +
+        String(definition.objects_.Size()) + " objects, " + String(definition.polygons_.Size()) + " polygons");
+}
 
-    PODVector<Vector2> pvertices;
-    pvertices.Push(Vector2(-mwith,mheigth));
-    pvertices.Push(Vector2(mwith,mheigth));
-    pvertices.Push(Vector2(mwith,mheigth/2));
-    pvertices.Push(Vector2(-mwith,mheigth/2));
+unsigned MapEditor::AddPrefab()
+{
+    unsigned index = prefabs_.Size();
+    prefabs_.Resize(index + 1);
+    prefabs_[index].name_ = "Prefab" + String(index);
+    journal_.Append(JOURNAL_ADDPREFAB, 0, index);
+    if(CurrentType == "Prefab")
+        fileList_->Add(prefabs_[index].name_, index);
+    return index;
+}
 
-    CollisionPolygon2D* pbox = pnode->CreateComponent<CollisionPolygon2D>();
-    pbox->SetVertices(pvertices);
-    pbox->SetDensity(1.0f);
-    pbox->SetFriction(0.5f);
-    pbox->SetRestitution(0.1f);
-    pbox->SetCategoryBits(32768);
+void MapEditor::AddPrefabPlatform(unsigned prefab, Vector2 p1, Vector2 p2, unsigned type)
+{
+    MapPlatform platform;
+    platform.p1_ = p1;
+    platform.p2_ = p2;
+    platform.type_ = type;
+    prefabs_[prefab].platforms_.Push(platform);
+    journal_.Append(JOURNAL_PREFABPLATFORM, prefab, type, p1, p2);
+}
 
-    platData->imagereference = pnode;
+void MapEditor::AddPrefabObject(unsigned prefab, Vector2 position, EntityType type)
+{
+    MapObject object;
+    object.position_ = position;
+    memset(object.type_, 0, sizeof(object.type_));
+    memset(object.code_, 0, sizeof(object.code_));
+    strncpy(object.type_, GetEntityTypeName(type), sizeof(object.type_) - 1);
+    strncpy(object.code_, "t01", sizeof(object.code_) - 1);
+    prefabs_[prefab].objects_.Push(object);
+    journal_.Append(JOURNAL_PREFABOBJECT, prefab, type, position);
 }
 
-void MapEditor::CreateMovablePlatform(Vector2 p1, Vector2 p2)
+void MapEditor::AddPrefabPolygon(unsigned prefab, unsigned mode)
 {
-    ResourceCache* cache = GetSubsystem<ResourceCache>();
-    PODVector<Vector2> vertices;
-    vertices.Push(Vector2(-0.7f,0.1f));
-    vertices.Push(Vector2(0.7f,0.1f));
-    vertices.Push(Vector2(0.7f,-0.1f));
-    vertices.Push(Vector2(-0.7f,-0.1f));
+    PrefabPolygon polygon;
+    polygon.mode_ = mode;
+    prefabs_[prefab].polygons_.Push(polygon);
+    prefabs_[prefab].baked_ = false;
+    journal_.Append(JOURNAL_PREFABPOLYGON, prefab, mode);
+}
 
-    Node* movplatformnode  = nodeWall->CreateChild("movplatform");
-    movplatformnode->SetPosition2D(p1);
+void MapEditor::AddPrefabVertex(unsigned prefab, Vector2 position)
+{
+    prefabs_[prefab].polygons_.Back().outline_.Push(position);
+    prefabs_[prefab].baked_ = false;
+    journal_.Append(JOURNAL_PREFABVERTEX, prefab, 0, position);
+}
 
-    Sprite2D* movplatformsprite = cache->GetResource<Sprite2D>("Urho2D/movplatform.png");
-    if (!movplatformsprite)
-        return;
+PrefabDefinition& MapEditor::GetBakedPrefab(unsigned prefab)
+{
+    PrefabDefinition& definition = prefabs_[prefab];
+    if(!definition.baked_)
+        definition.Bake();
+    return definition;
+}
 
-    StaticSprite2D* movplatformstaticSprite = movplatformnode->CreateComponent<StaticSprite2D>();
-    movplatformstaticSprite->SetSprite(movplatformsprite);
+/// Area the contents of a prefab cover around its origin.
+static Rect PrefabBounds(const PrefabDefinition& prefab)
+{
+    Rect bounds;
+    for(unsigned i = 0; i < prefab.platforms_.Size(); i++)
+        bounds.Merge(PlatformBounds(prefab.platforms_[i].p1_, prefab.platforms_[i].p2_, prefab.platforms_[i].type_));
+    for(unsigned i = 0; i < prefab.objects_.Size(); i++)
+        bounds.Merge(ObjectBounds(prefab.objects_[i].position_));
+    for(unsigned i = 0; i < prefab.polygons_.Size(); i++)
+    {
+        if(!prefab.polygons_[i].outline_.Empty())
+            bounds.Merge(OutlineBounds(prefab.polygons_[i].outline_));
+    }
+    return bounds;
+}
 
-    RigidBody2D* platfotmbody = movplatformnode->CreateComponent<RigidBody2D>();
-    platfotmbody->SetBodyType(BT_KINEMATIC);
-    platfotmbody->SetFixedRotation(true);
+PrefabInstance* MapEditor::StampPrefab(unsigned prefab, Vector2 offset)
+{
+    PrefabInstance* instance = new PrefabInstance(context_);
+    instance->prefab = prefab;
+    instance->offset = offset;
+    Rect bounds = GetInstanceBounds(instance);
+    instance->handle = spatialIndex_.Insert(ENTITY_PREFAB, instance, 0, bounds);
+    entities_.Add(instance);
+    journal_.Append(JOURNAL_STAMPPREFAB, 0, prefab, offset);
+    if(chunks_.IsResident(bounds))
+        InstantiateInstance(instance);
+    return instance;
+}
 
-    CollisionPolygon2D* box = movplatformnode->CreateComponent<CollisionPolygon2D>();
-    box->SetVertices(vertices);
-    box->SetDensity(1.0f);
-    box->SetFriction(0.5f);
-    box->SetRestitution(0.0f);
-    box->SetCategoryBits(32768);
+Rect MapEditor::GetInstanceBounds(const PrefabInstance* instance)
+{
+    Rect bounds = PrefabBounds(prefabs_[instance->prefab]);
+    return Rect(bounds.min_ + instance->offset, bounds.max_ + instance->offset);
+}
 
-    PlatformData* platdata = movplatformnode->CreateComponent<PlatformData>();
-    platdata->type = "movplatform";
-    platdata->p1 = p1;
+void MapEditor::InstantiateInstance(PrefabInstance* instance)
+{
+    if(instance->resident)
+        return;
+    instance->resident = true;
+
+    // Children sit at their place relative to the instance node, platforms take their corners in world space
+    Node* node = nodeWall->CreateChild("prefab");
+    node->AddComponent(instance, 0, REPLICATED);
+    node->SetPosition2D(instance->offset);
+    const PrefabDefinition& prefab = GetBakedPrefab(instance->prefab);
+    for(unsigned i = 0; i < prefab.platforms_.Size(); i++)
+    {
+        const MapPlatform& platform = prefab.platforms_[i];
+        EntityType type = (EntityType)platform.type_;
+        Node* platformnode = node->CreateChild(type == ENTITY_TYPE_MOVPLATFORM ? "movplatform" : "wall");
+        platformnode->SetPosition2D(type == ENTITY_TYPE_MOVPLATFORM ? platform.p1_ : (platform.p1_ + platform.p2_) / 2);
+        CreatePlatformBodies(platformnode, platform.p1_ + instance->offset, platform.p2_ + instance->offset, type);
+    }
+    for(unsigned i = 0; i < prefab.objects_.Size(); i++)
+    {
+        Node* objectnode = node->CreateChild("enemy");
+        objectnode->SetPosition2D(prefab.objects_[i].position_);
+        CreateObjectSprite(objectnode);
+    }
+    // Fixtures come from the shared pieces, nothing is triangulated per instance
+    for(unsigned i = 0; i < prefab.polygons_.Size(); i++)
+        CreateWallBody(node, prefab.polygons_[i].outline_, prefab.polygons_[i].mode_, prefab.polygons_[i].pieces_);
+}
 
-    PlatformsList.Push(platdata);
-    currentpd = platdata;
+void MapEditor::ReleaseInstance(PrefabInstance* instance)
+{
+    if(!instance->resident)
+        return;
+    instance->resident = false;
+    // The children go with the node, the registry keeps the PrefabInstance for picking, saving and the journal
+    DetachEntity(instance);
+}
 
-    Node* movplatformreference = nodeWall->CreateChild("reference");
+void MapEditor::MoveInstance(PrefabInstance* instance, Vector2 offset)
+{
+    if(instance->resident)
+    {
+        ReleaseInstance(instance);
+        movedInstances_.Push(instance);
+    }
+    instance->offset = offset;
+    spatialIndex_.Move(instance->handle, GetInstanceBounds(instance));
+    journal_.Append(JOURNAL_MOVEINSTANCE, EntityRegistry::GetReference(instance), 0, offset);
+}
 
-    StaticSprite2D* platformref = movplatformreference->CreateComponent<StaticSprite2D>();
-    platformref->SetSprite(movplatformsprite);
-    movplatformreference->SetPosition2D(p2);
-    currentpd->p2 = p2;
-    currentpd->imagereference = movplatformreference;
+void MapEditor::RemoveInstance(PrefabInstance* instance)
+{
+    journal_.Append(JOURNAL_REMOVEINSTANCE, EntityRegistry::GetReference(instance));
+    selection_.Remove(instance->handle);
+    spatialIndex_.Remove(instance->handle);
+    movedInstances_.Remove(instance);
+    DetachEntity(instance);
+    entities_.Remove(instance);
 }
 
-void MapEditor::DrawPolygon()
+void MapEditor::DrawInstances()
 {
     DebugRenderer* debug = scene_->GetComponent<DebugRenderer>();
-
-    Vector<Vector<PolygonVertex *>* > polygons = PolygonMap.Values();
-    for(RandomAccessIterator<Vector<PolygonVertex *>*> ps = polygons.Begin(); ps != polygons.End(); ps++)
+    Color color(0.0f, 0.8f, 1.0f);
+    const PODVector<PrefabInstance*>& instances = entities_.GetInstances();
+    for(unsigned i = 0; i < instances.Size(); i++)
     {
-        Vector<PolygonVertex *>* polygon = *ps;
-        if(!polygon->Empty())
+        if(!instances[i]->resident)
+            continue;
+        const PrefabDefinition& prefab = prefabs_[instances[i]->prefab];
+        Vector3 offset(instances[i]->offset, 0);
+        for(unsigned j = 0; j < prefab.polygons_.Size(); j++)
         {
-            int i = 1;
-            for(i; i < polygon->Size(); i++)
-            {
-                Vector2 p1 = (polygon->operator[](i-1))->GetVector();
-                Vector2 p2 = (polygon->operator[](i))->GetVector();
-                debug->AddLine(Vector3(p1.x_, p1.y_, 0), Vector3(p2.x_, p2.y_, 0), Color(1, 0, 0, 0),  false);
-            }
-            Vector2 p1 = (polygon->operator[](i-1))->GetVector();
-            Vector2 p2 = (polygon->operator[](0))->GetVector();
-            debug->AddLine(Vector3(p1.x_, p1.y_, 0), Vector3(p2.x_, p2.y_, 0), Color(1, 0, 0, 0),  false);
+            const PODVector<Vector2>& outline = prefab.polygons_[j].outline_;
+            for(unsigned k = 0, l = outline.Size() - 1; k < outline.Size(); l = k++)
+                debug->AddLine(Vector3(outline[l], 0) + offset, Vector3(outline[k], 0) + offset, color, false);
         }
     }
+}
 
-    for(RandomAccessIterator<Vector<EarTriangle*>*> i = ListPolygonTriangle.Begin(); i != ListPolygonTriangle.End(); i++)
+void MapEditor::DrawPolygon()
+{
+    EDITOR_PROFILE(DRAWPOLYGON);
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        Vector<EarTriangle*>* PolygonTriangles = *i;
-        for(RandomAccessIterator<EarTriangle*> j = PolygonTriangles->Begin(); j != PolygonTriangles->End(); j++)
-        {
-            EarTriangle* et = *j;
+        if(polygons[i]->resident)
+            overlay_->Update(polygons[i], polygons[i] == CurrentPolygon);
+    }
 
-            debug->AddLine(Vector3(et->p1_.x_, et->p1_.y_, 0), Vector3(et->p2_.x_, et->p2_.y_, 0), Color(0, 1, 0, 0),  false);
-            debug->AddLine(Vector3(et->p2_.x_, et->p2_.y_, 0), Vector3(et->p3_.x_, et->p3_.y_, 0), Color(0, 1, 0, 0),  false);
-            debug->AddLine(Vector3(et->p3_.x_, et->p3_.y_, 0), Vector3(et->p1_.x_, et->p1_.y_, 0), Color(0, 1, 0, 0),  false);
-        }
+    // The selected handle is the only per frame line left
+    if(selectObject_ && CurrentVertexPolygon)
+    {
+        DebugRenderer* debug = scene_->GetComponent<DebugRenderer>();
+        const Vector2& v = CurrentVertexPolygon->vertices[CurrentVertex];
+        Vector3 a(v.x_ - VERTEX_PICK_RADIUS, v.y_ - VERTEX_PICK_RADIUS, 0);
+        Vector3 b(v.x_ + VERTEX_PICK_RADIUS, v.y_ - VERTEX_PICK_RADIUS, 0);
+        Vector3 c(v.x_ + VERTEX_PICK_RADIUS, v.y_ + VERTEX_PICK_RADIUS, 0);
+        Vector3 d(v.x_ - VERTEX_PICK_RADIUS, v.y_ + VERTEX_PICK_RADIUS, 0);
+        debug->AddLine(a, b, Color::RED, false);
+        debug->AddLine(b, c, Color::RED, false);
+        debug->AddLine(c, d, Color::RED, false);
+        debug->AddLine(d, a, Color::RED, false);
     }
 }
 
@@ -929,6 +2618,12 @@ void MapEditor::InitWindow()
 
     uiRoot_->AddChild(auxwindow);
 
+    statsText_ = uiRoot_->CreateChild<Text>("StatsText");
+    statsText_->SetStyleAuto();
+    statsText_->SetPosition(10, 10);
+    statsText_->SetPriority(100);
+    statsText_->SetVisible(false);
+
     window_ = static_cast<Window*>(uiRoot_->GetChild("EditorMenu",true));
 
     View3D* auxview = (View3D*)auxwindow->GetChild("ObjPrevView",true);
@@ -937,12 +2632,8 @@ void MapEditor::InitWindow()
 
     ListView* itemlist = (ListView*)auxwindow->GetChild("FileList",true);
     ListView* seconditemlist = (ListView*)auxwindow->GetChild("SecondList",true);
-
-    JSONFile* data = new JSONFile(context_);
-    File file(context_,"Data/Scenes/map_editor.json");
-    data->Load(file);
-
-    rootjson = data->GetRoot();
+    fileList_->SetView(itemlist, (LineEdit*)auxwindow->GetChild("FileFilter",true), "FileSelectorListText");
+    polygonList_->SetView(seconditemlist, (LineEdit*)auxwindow->GetChild("SecondFilter",true), "FileSelectorListText");
 
     DropDownList* DropDownType = (DropDownList*)auxwindow->GetChild("ObjeList",true);
     Text* SelectedText = static_cast<Text*>(DropDownType->GetSelectedItem());
@@ -951,9 +2642,14 @@ void MapEditor::InitWindow()
     Button* button = (Button*)auxwindow->GetChild("ProcessButton", true);
 
     SubscribeToEvent(DropDownType, E_ITEMSELECTED, URHO3D_HANDLER(MapEditor, HandleChangeType));
-    SubscribeToEvent(itemlist, E_ITEMSELECTED, URHO3D_HANDLER(MapEditor, HandleLoadPreview));
-    SubscribeToEvent(seconditemlist, E_ITEMSELECTED, URHO3D_HANDLER(MapEditor, HandleSelectSecondList));
+    SubscribeToEvent(fileList_, E_VIRTUALLISTSELECTED, URHO3D_HANDLER(MapEditor, HandleLoadPreview));
+    SubscribeToEvent(polygonList_, E_VIRTUALLISTSELECTED, URHO3D_HANDLER(MapEditor, HandleSelectSecondList));
 	SubscribeToEvent(button, E_RELEASED, URHO3D_HANDLER(MapEditor, HandleProcess));
+
+    CheckBox* autoprocess = (CheckBox*)auxwindow->GetChild("AutoProcessCheck", true);
+    SubscribeToEvent(autoprocess, E_TOGGLED, URHO3D_HANDLER(MapEditor, HandleAutoProcess));
+    CheckBox* chaincheck = (CheckBox*)auxwindow->GetChild("ChainCheck", true);
+    SubscribeToEvent(chaincheck, E_TOGGLED, URHO3D_HANDLER(MapEditor, HandleChainMode));
 }
 
 void MapEditor::HandleChangeType(StringHash eventType, VariantMap& eventData)
@@ -965,14 +2661,12 @@ void MapEditor::HandleChangeType(StringHash eventType, VariantMap& eventData)
 
 void MapEditor::HandleSelectSecondList(StringHash eventType, VariantMap& eventData)
 {
-    ListView* ItemList = static_cast<ListView*>(eventData["Element"].GetPtr());
-    Text* SelectedText = static_cast<Text*>(ItemList->GetSelectedItem());
     //currentBodyType
     switch (currentFunction)
     {
     case DRAWBODY:
         UnselectPolygon(CurrentPolygon);
-        CurrentPolygon = PolygonMap[SelectedText->GetText()];
+        CurrentPolygon = polygons_.Get(eventData[VirtualListSelected::P_VALUE].GetUInt());
         SelectPolygon(CurrentPolygon);
         switch (currentBodyType)
         {
@@ -985,11 +2679,10 @@ void MapEditor::HandleSelectSecondList(StringHash eventType, VariantMap& eventDa
 
 void MapEditor::HandleLoadPreview(StringHash eventType, VariantMap& eventData)
 {
+    const String& selected = eventData[VirtualListSelected::P_NAME].GetString();
     if(CurrentType == "Tile")
     {
-        ListView* ItemList = static_cast<ListView*>(eventData["Element"].GetPtr());
-        Text* SelectedText = static_cast<Text*>(ItemList->GetSelectedItem());
-        Sprite2D* currenttile = TileSetMap[SelectedText->GetText()];
+        Sprite2D* currenttile = TileSetMap[selected];
 
         objprev_scene->GetChild("PrevNode",true)->RemoveAllComponents();
         objprev_scene->GetChild("PrevNode",true)->Remove();
@@ -1001,19 +2694,19 @@ void MapEditor::HandleLoadPreview(StringHash eventType, VariantMap& eventData)
     if(CurrentType == "Escenario")
     {
     }
+    if(CurrentType == "Prefab")
+        currentPrefab_ = eventData[VirtualListSelected::P_VALUE].GetUInt();
     if(CurrentType == "Characters")
     {
-        ListView* ItemList = static_cast<ListView*>(eventData["Element"].GetPtr());
-        Text* SelectedText = static_cast<Text*>(ItemList->GetSelectedItem());
-        if(SelectedText->GetText() == "Player")
+        if(selected == "Player")
         {
             currentCharType = PLAYER;
         }
-        if(SelectedText->GetText() == "Enemy")
+        if(selected == "Enemy")
         {
             currentCharType = ENEMY;
         }
-        if(SelectedText->GetText() == "NPC")
+        if(selected == "NPC")
         {
             currentCharType = NPC;
         }
@@ -1022,155 +2715,127 @@ void MapEditor::HandleLoadPreview(StringHash eventType, VariantMap& eventData)
     if(CurrentType == "Body")
     {
         currentKeyFunction = NONE;
-        ListView* ItemList = static_cast<ListView*>(eventData["Element"].GetPtr());
-        Text* SelectedText = static_cast<Text*>(ItemList->GetSelectedItem());
-        typebody = SelectedText->GetText();
-        if(SelectedText->GetText() == "Platform")
+        typebody = selected;
+        if(selected == "Platform")
         {
             currentBodyType = PLATFORM;
         }
-        if(SelectedText->GetText() == "MidlePlatform")
+        if(selected == "MidlePlatform")
         {
             currentBodyType = MIDLEPLATFORM;
         }
-        if(SelectedText->GetText() == "MovPlatform")
+        if(selected == "MovPlatform")
         {
             currentBodyType = MOVPLATFORM;
         }
-        if(SelectedText->GetText() == "PolygonBody")
+        if(selected == "PolygonBody")
         {
             currentBodyType = POLYGONBODY;
         }
-        if(SelectedText->GetText() == "VertexPolygon")
+        if(selected == "VertexPolygon")
         {
             currentBodyType = VERTEXPOLYGON;
         }
     }
 }
 
-void MapEditor::SelectPolygon(Vector<PolygonVertex *>* polygon)
+void MapEditor::SelectPolygon(PolygonData* polygon)
 {
     if(!polygon)
         return;
-    for(int i = 0; i < polygon->Size(); i++)
-    {
-       (polygon->operator[](i))->setSelectPolygon();
-    }
+    CheckBox* chaincheck = window_ ? (CheckBox*)window_->GetChild("ChainCheck", true) : 0;
+    if(chaincheck)
+        chaincheck->SetChecked(polygon->mode == CHAINBODY);
+    if(overlay_)
+        overlay_->SetSelected(polygon, true);
 }
 
-void MapEditor::UnselectPolygon(Vector<PolygonVertex *>* polygon)
+void MapEditor::UnselectPolygon(PolygonData* polygon)
 {
-    if(!polygon)
-        return;
-    for(int i=0; i < polygon->Size(); i++)
-    {
-       (polygon->operator[](i))->setUnselect();
-    }
+    if(overlay_)
+        overlay_->SetSelected(polygon, false);
 }
 
 void MapEditor::LoadPolygonList()
 {
-    ListView* seconditemlist = (ListView*)window_->GetChild("SecondList",true);
-    seconditemlist->RemoveAllItems();
-    Vector<String> keys = PolygonMap.Keys();
-    for( int i = 0 ; i < keys.Size() ; i++ )
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    Vector<String> names(polygons.Size());
+    PODVector<unsigned> ids(polygons.Size());
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        Text* item = new Text(context_);
-        item->SetText(keys[i]);
-        item->SetStyle("FileSelectorListText");
-        seconditemlist->InsertItem(seconditemlist->GetNumItems(), item);
+        names[i] = PolygonRegistry::GetName(polygons[i]->id);
+        ids[i] = polygons[i]->id;
     }
+    polygonList_->SetEntries(names, ids);
 }
 
 void MapEditor::LoadSelectedType(String type)
 {
     CurrentType = type;
-    ListView* itemlist = (ListView*)window_->GetChild("FileList",true);
-    itemlist->RemoveAllItems();
 
     if(type == "Tile")
+        fileList_->SetEntries(TileSetMap.Keys());
+    else if(type == "Prefab")
     {
-        Vector<String> keys = TileSetMap.Keys();
-        for( int i = 0 ; i < keys.Size() ; i++ )
-        {
-            Text* item = new Text(context_);
-            item->SetText(keys[i]);
-            item->SetStyle("FileSelectorListText");
-            itemlist->InsertItem(itemlist->GetNumItems(), item);
-        }
+        Vector<String> names(prefabs_.Size());
+        for(unsigned i = 0; i < prefabs_.Size(); i++)
+            names[i] = prefabs_[i].name_;
+        fileList_->SetEntries(names);
     }
     else
     {
         JSONValue jsonType = rootjson.Get(type);
         JSONArray jsonTypeArray = jsonType.GetArray();
-        for(int i = 0 ; i < jsonTypeArray.Size() ; i++)
-        {
-            Text* item = new Text(context_);
-            item->SetText(jsonType[i].GetString());
-            item->SetStyle("FileSelectorListText");
-            itemlist->InsertItem(itemlist->GetNumItems(), item);
-        }
+        Vector<String> names(jsonTypeArray.Size());
+        for(unsigned i = 0 ; i < jsonTypeArray.Size() ; i++)
+            names[i] = jsonType[i].GetString();
+        fileList_->SetEntries(names);
     }
+    // The polygon list follows every add and remove, switching types leaves it alone
     if(type == "Body")
-    {
         currentFunction = DRAWBODY;
-        LoadPolygonList();
-    }
 
     if(type == "Characters")
         currentFunction = DRAWCHAR;
     if(type == "Escenario")
         currentFunction = DRAWENV;
+    if(type == "Prefab")
+        currentFunction = DRAWPREFAB;
 }
 
-bool MapEditor::RemovePolygon(PolygonVertex * p)
+bool MapEditor::RemovePolygon(PolygonData* polygon)
 {
-    Vector<String> keys = PolygonMap.Keys();
-    for(int i = 0; i < keys.Size(); i++)
-    {
-        Vector<PolygonVertex *>* polygon = PolygonMap[keys[i]];
-        if(polygon->Contains(p))
-        {
-            while(!polygon->Empty())
-            {
-                PolygonVertex * pv = polygon->Back();
-                Node* noderemove = pv->GetNode();
-                noderemove->Remove();
-                polygon->Pop();
-            }
-            PolygonMap.Erase(keys[i]);
-        }
-    }
+    if(!polygon || !polygons_.Remove(polygon->id))
+        return false;
     UnselectPolygon(CurrentPolygon);
     CurrentPolygon = 0;
-    LoadPolygonList();
-}
-
-bool MapEditor::RemovePolygon(String key)
-{
-    Vector<PolygonVertex *>* polygon = PolygonMap[key];
-    while(!polygon->Empty())
+    if(CurrentVertexPolygon == polygon)
     {
-        PolygonVertex * pv = polygon->Back();
-        Node* noderemove = pv->GetNode();
-        noderemove->Remove();
-        polygon->Pop();
+        CurrentVertexPolygon = 0;
+        selectObject_ = false;
     }
-    PolygonMap.Erase(key);
-    UnselectPolygon(CurrentPolygon);
-    CurrentPolygon = 0;
-    LoadPolygonList();
+    journal_.Append(JOURNAL_REMOVEPOLYGON, polygon->id);
+    for(unsigned i = 0; i < polygon->handles.Size(); i++)
+    {
+        if(!selection_.Empty())
+            selection_.Remove(polygon->handles[i]);
+        spatialIndex_.Remove(polygon->handles[i]);
+    }
+    polygonList_->Remove(polygon->id);
+    delete polygon;
+    return true;
 }
 
-Vector<PolygonVertex *>* MapEditor::CreatePolygon()
+PolygonData* MapEditor::CreatePolygon()
 {
-    Vector<PolygonVertex *>* polygon_ = new Vector<PolygonVertex *>();
+    PolygonData* polygon_ = AddPolygon();
+    polygonList_->Add(PolygonRegistry::GetName(polygon_->id), polygon_->id);
 
     Vector2 pos = GetDiscreetPosition();
-    polygon_->Push(CreatePolygonVertex(Vector2(pos)));
-    polygon_->Push(CreatePolygonVertex(Vector2(pos.x_,pos.y_+0.7f)));
-    polygon_->Push(CreatePolygonVertex(Vector2(pos.x_+0.7f,pos.y_+0.7f)));
-    polygon_->Push(CreatePolygonVertex(Vector2(pos.x_+0.7f,pos.y_)));
+    AddPolygonVertex(polygon_, 0, Vector2(pos));
+    AddPolygonVertex(polygon_, 1, Vector2(pos.x_,pos.y_+0.7f));
+    AddPolygonVertex(polygon_, 2, Vector2(pos.x_+0.7f,pos.y_+0.7f));
+    AddPolygonVertex(polygon_, 3, Vector2(pos.x_+0.7f,pos.y_));
 
     UnselectPolygon(CurrentPolygon);
     CurrentPolygon = polygon_;
@@ -1178,216 +2843,234 @@ Vector<PolygonVertex *>* MapEditor::CreatePolygon()
     return polygon_;
 }
 
-PolygonVertex * MapEditor::CreatePolygonVertex(Vector2 pos)
+PolygonData* MapEditor::AddPolygon(unsigned id)
+{
+    PolygonData* polygon = new PolygonData();
+    if(!id)
+        polygons_.Add(polygon);
+    else if(!polygons_.Insert(id, polygon))
+    {
+        delete polygon;
+        return 0;
+    }
+    journal_.Append(JOURNAL_ADDPOLYGON, polygon->id);
+    return polygon;
+}
+
+PolygonData* MapEditor::GetPolygon(unsigned id)
 {
-    Node* nv = scene_->CreateChild("vertex");
-    PolygonVertex * pv = nv->CreateComponent<PolygonVertex>();
-    pv->SetVector(pos);
-    return pv;
+    return polygons_.Get(id);
 }
 
-void MapEditor::insertVertex(Vector<PolygonVertex *>* polygon, PolygonVertex * newvertex)
+void MapEditor::SetPolygonMode(PolygonData* polygon, PolygonBodyMode mode)
 {
-    if(!CurrentVertex)
+    if(polygon->mode == mode)
         return;
-    unsigned index = 0;
-    for(RandomAccessIterator<PolygonVertex*> v = polygon->Begin(); v != polygon->End(); v++)
-    {
-        if(polygon->Find(CurrentVertex) == v)
-            break;
-        index++;
-    }
-    CurrentVertex->setSelectPolygon();
-    polygon->Insert(index, newvertex);
-    CurrentVertex = newvertex;
-    CurrentVertex->setSelect();
+    polygon->mode = mode;
+    polygon->SetDirty();
+    journal_.Append(JOURNAL_POLYGONMODE, polygon->id, mode);
+}
+
+void MapEditor::insertVertex(PolygonData* polygon, Vector2 position)
+{
+    if(!selectObject_ || polygon != CurrentVertexPolygon)
+        return;
+    AddPolygonVertex(polygon, CurrentVertex, position);
+}
+
+static Rect VertexBounds(const Vector2& position)
+{
+    return Rect(position - Vector2(VERTEX_PICK_RADIUS, VERTEX_PICK_RADIUS), position + Vector2(VERTEX_PICK_RADIUS, VERTEX_PICK_RADIUS));
+}
+
+void MapEditor::AddPolygonVertex(PolygonData* polygon, unsigned index, Vector2 position)
+{
+    polygon->InsertVertex(index, position);
+    journal_.Append(JOURNAL_ADDVERTEX, polygon->id, index, position);
+    polygon->handles.Insert(index, spatialIndex_.Insert(ENTITY_VERTEX, polygon, index, VertexBounds(position)));
+    for(unsigned i = index + 1; i < polygon->handles.Size(); i++)
+        spatialIndex_.GetEntity(polygon->handles[i]).index_ = i;
+}
+
+void MapEditor::MovePolygonVertex(PolygonData* polygon, unsigned index, Vector2 position)
+{
+    if(polygon->vertices[index] == position)
+        return;
+    polygon->SetVertex(index, position);
+    journal_.Append(JOURNAL_MOVEVERTEX, polygon->id, index, position);
+    spatialIndex_.Move(polygon->handles[index], VertexBounds(position));
+}
+
+void MapEditor::RemovePolygonVertex(PolygonData* polygon, unsigned index)
+{
+    journal_.Append(JOURNAL_REMOVEVERTEX, polygon->id, index);
+    selection_.Remove(polygon->handles[index]);
+    spatialIndex_.Remove(polygon->handles[index]);
+    polygon->RemoveVertex(index);
+    polygon->handles.Erase(index);
+    for(unsigned i = index; i < polygon->handles.Size(); i++)
+        spatialIndex_.GetEntity(polygon->handles[i]).index_ = i;
+
+    if(polygon == CurrentVertexPolygon)
+        selectObject_ = false;
+}
+
+bool MapEditor::PickPolygonVertex(Vector2 position, PolygonData*& polygon, unsigned& index)
+{
+    unsigned handle;
+    if(!spatialIndex_.QueryPoint(position, 1 << ENTITY_VERTEX, handle))
+        return false;
+    EditorEntity& entity = spatialIndex_.GetEntity(handle);
+    polygon = static_cast<PolygonData*>(entity.object_);
+    index = entity.index_;
+    return true;
 }
 
 /* Process polygon */
 
-void MapEditor::HandleProcess(StringHash eventType, VariantMap& eventData)
+static void BakePolygon(PolygonTriangulator& triangulator, PolygonBake& bake)
 {
-    ListPolygonTriangle.Clear();
-    Vector<Vector<PolygonVertex *>* > polygons = PolygonMap.Values();
-    for(RandomAccessIterator<Vector<PolygonVertex *>*> ps = polygons.Begin(); ps != polygons.End(); ps++)
-    {
-        Vector<PolygonVertex *>* polygon = *ps;
-        Vector<EarTriangle*>* PolygonTriagles = new Vector<EarTriangle*>();
-        ListPolygonTriangle.Push(PolygonTriagles);
-        cleanVertex(polygon);
-        if(!polygon->Empty() || polygon->Size() > 3)
-        {
-            PolygonVertex * p = polygon->operator[](0);
-            int counter = polygon->Size();
-            while( counter > 3)
-            {
-                p->isEvalue = true;
-                Vector2 p1 = prevVertex(polygon,p);
-                Vector2 p2 = p->GetVector();
-                Vector2 p3 = nextVertex(polygon,p);
-                if(!ccw(p1, p2, p3))
-                {
-                    bool noear = false;
-                    for(int j = 0; j < polygon->Size(); j++)
-                    {
-                        PolygonVertex * testpolygon = polygon->operator[](j);
-                        if(!testpolygon->isEvalue && !testpolygon->isProcess)
-                        {
-                            if(isInTriangle(testpolygon->GetVector(),p1,p2,p3))
-                            {
-                                noear = true;
-                                break;
-                            }
-                        }
-                    }
-                    if(!noear)
-                    {
-                        PolygonTriagles->Push(new EarTriangle(p1,p2,p3));
-                        p->isProcess = true;
-                        counter--;
-                    }
-                }
-                p->isEvalue = false;
-                CurrentPrevVertex->isEvalue = false;
-                CurrentNextVertex->isEvalue = false;
-                p = CurrentNextVertex;
+    bake.valid_ = triangulator.Triangulate(bake.outline_, bake.triangles_);
+    MergeConvexPieces(bake.triangles_, bake.pieces_);
+}
 
-            }
-            Vector<Vector2> lasttriangle;
-            for(int j = 0; j < polygon->Size(); j++)
-            {
-                if(!(polygon->operator[](j))->isProcess)
-                    lasttriangle.Push((polygon->operator[](j))->GetVector());
-            }
-            PolygonTriagles->Push(new EarTriangle(lasttriangle[0],lasttriangle[1],lasttriangle[2]));
-        }
-    }
-    ProcessPolygonPhysics();
+static void TriangulateWork(const WorkItem* item, unsigned threadIndex)
+{
+    PolygonTriangulator triangulator;
+    PolygonBake* end = reinterpret_cast<PolygonBake*>(item->end_);
+    for(PolygonBake* bake = reinterpret_cast<PolygonBake*>(item->start_); bake != end; bake++)
+        BakePolygon(triangulator, *bake);
+}
+
+void MapEditor::HandleProcess(StringHash eventType, VariantMap& eventData)
+{
+    ProcessPolygons();
     Button* processbutton = static_cast<Button*>(eventData["Element"].GetPtr());
     processbutton->SetFocus(false);
 }
 
-void MapEditor::ProcessPolygonPhysics()
+void MapEditor::HandleAutoProcess(StringHash eventType, VariantMap& eventData)
 {
+    using namespace Toggled;
 
-    while(!ListNodePolygonsPhysics.Empty())
-    {
-        Node* noderemove = ListNodePolygonsPhysics.Back();
-        if(noderemove)
-        {
-            noderemove->Remove();
-            ListNodePolygonsPhysics.Pop();
-        }
-    }
-    for(RandomAccessIterator<Vector<EarTriangle*>*> i = ListPolygonTriangle.Begin(); i != ListPolygonTriangle.End(); i++)
-    {
-        Node* polygonnode = scene_->CreateChild("Wall");
-        ListNodePolygonsPhysics.Push(polygonnode);
-        RigidBody2D* body = polygonnode->CreateComponent<RigidBody2D>();
-        body->SetBodyType(BT_STATIC);
-
-        Vector<EarTriangle*>* PolygonTriangles = *i;
-        for(RandomAccessIterator<EarTriangle*> j = PolygonTriangles->Begin(); j != PolygonTriangles->End(); j++)
-        {
-            EarTriangle* et = *j;
-
-            PODVector<Vector2> vertices;
-            vertices.Push(et->p1_);
-            vertices.Push(et->p2_);
-            vertices.Push(et->p3_);
-
-            CollisionPolygon2D* triangle = polygonnode->CreateComponent<CollisionPolygon2D>();
-            triangle->SetVertices(vertices);
-            triangle->SetDensity(1.0f);
-            triangle->SetFriction(0.0f);
-            triangle->SetRestitution(0.1f);
-            triangle->SetCategoryBits(32768);
-        }
-    }
+    autoProcess_ = eventData[P_STATE].GetBool();
 }
 
-void MapEditor::cleanVertex(Vector<PolygonVertex *>* polygon)
+void MapEditor::HandleChainMode(StringHash eventType, VariantMap& eventData)
 {
-    for(int k = 0; k < polygon->Size(); k++)
-    {
-        (polygon->operator[](k))->isEvalue = false;
-        (polygon->operator[](k))->isProcess = false;
-    }
+    using namespace Toggled;
+
+    if(!CurrentPolygon)
+        return;
+    SetPolygonMode(CurrentPolygon, eventData[P_STATE].GetBool() ? CHAINBODY : SOLIDBODY);
 }
 
-Vector2 MapEditor::nextVertex(Vector<PolygonVertex *>* polygon, PolygonVertex * P)
+void MapEditor::ProcessPolygons()
 {
-    for(RandomAccessIterator<PolygonVertex*> p_ = polygon->Find(P)+1; p_ != polygon->End(); p_++)
+    EDITOR_PROFILE(PROCESS);
+    Vector<PolygonData*> dirtyPolygons;
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        PolygonVertex * pv = *p_;
-        if(!pv->isProcess)
-        {
-            CurrentNextVertex = pv;
-            pv->isEvalue = true;
-            return  pv->GetVector();
-        }
+        if(polygons[i]->dirty)
+            dirtyPolygons.Push(polygons[i]);
     }
-    for(RandomAccessIterator<PolygonVertex*> p_ = polygon->Begin(); p_ != polygon->Find(P); p_++)
+
+    // Bakes are kept between processes, their buffers only grow to the largest polygon seen
+    Vector<PolygonBake>& bakes = bakes_;
+    bakes.Resize(dirtyPolygons.Size());
+    for(unsigned i = 0; i < dirtyPolygons.Size(); i++)
     {
-        PolygonVertex * pv = *p_;
-        if(!pv->isProcess)
-        {
-            CurrentNextVertex = pv;
-            pv->isEvalue = true;
-            return  pv->GetVector();
-        }
+        PolygonBake& bake = bakes[i];
+        bake.outline_.Clear();
+        bake.triangles_.Clear();
+        bake.pieces_.Clear();
+        if(dirtyPolygons[i]->mode != CHAINBODY)
+            bake.outline_ = dirtyPolygons[i]->vertices;
     }
-    return Vector2::ZERO;
-}
 
-Vector2 MapEditor::prevVertex(Vector<PolygonVertex *>* polygon, PolygonVertex * P)
-{
-    if(polygon->Find(P)!= polygon->Begin())
+    TriangulatePolygons(bakes);
+
+    for(unsigned i = 0; i < bakes.Size(); i++)
     {
-        for(RandomAccessIterator<PolygonVertex*> p_ = polygon->Find(P)-1; p_ >= polygon->Begin(); p_--)
-        {
-            PolygonVertex * pv = *p_;
-            if(!pv->isProcess)
-            {
-                CurrentPrevVertex = pv;
-                pv->isEvalue = true;
-                return  pv->GetVector();
-            }
-        }
+        PolygonBake& bake = bakes[i];
+        if(!bake.valid_ && dirtyPolygons[i]->mode != CHAINBODY)
+            URHO3D_LOGWARNING("Polygon with " + String(bake.outline_.Size()) + " vertices is degenerate or self intersecting");
+        dirtyPolygons[i]->SetTriangles(bake.triangles_, bake.pieces_);
     }
+    ProcessPolygonPhysics();
 
-    for(RandomAccessIterator<PolygonVertex*> p_ = polygon->End()-1; p_ != polygon->Find(P); p_--)
+    unsigned numTriangles = 0;
+    unsigned numPieces = 0;
+    unsigned numChains = 0;
+    for(unsigned i = 0; i < polygons.Size(); i++)
     {
-        PolygonVertex * pv = *p_;
-        if(!pv->isProcess)
-        {
-            CurrentPrevVertex = pv;
-            pv->isEvalue = true;
-            return  pv->GetVector();
-        }
+        numTriangles += polygons[i]->triangles.Size();
+        numPieces += polygons[i]->pieces.Size();
+        if(polygons[i]->mode == CHAINBODY)
+            numChains++;
     }
-    return Vector2::ZERO;
+    fixtureCount_ = numPieces + numChains;
+    String fixtures = "Fixtures: " + String(numTriangles) + " -> " + String(numPieces) + " + " + String(numChains) + " chains";
+    URHO3D_LOGINFO("Polygon fixtures: " + String(numTriangles) + " triangles merged into " + String(numPieces) + " convex pieces, " + String(numChains) + " chain loops");
+    Text* fixturetext = window_ ? static_cast<Text*>(window_->GetChild("FixtureText", true)) : 0;
+    if(fixturetext)
+        fixturetext->SetText(fixtures);
 }
 
-bool MapEditor::ccw(Vector2 p1, Vector2 p2, Vector2 p3)
+void MapEditor::TriangulatePolygons(Vector<PolygonBake>& bakes)
 {
-    return ((p1.x_ - p2.x_) * (p3.y_ - p2.y_) - (p1.y_ - p2.y_) * (p3.x_ - p2.x_)) < 0;;
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    if(!parallelProcess_ || !queue || !queue->GetNumThreads() || bakes.Size() < 2)
+    {
+        PolygonTriangulator triangulator;
+        for(unsigned i = 0; i < bakes.Size(); i++)
+            BakePolygon(triangulator, bakes[i]);
+        return;
+    }
+
+    // Split into runs of about the same vertex count, a few per thread so one big cave doesn't serialize the rest
+    unsigned totalVertices = 0;
+    for(unsigned i = 0; i < bakes.Size(); i++)
+        totalVertices += bakes[i].outline_.Size();
+    unsigned batchVertices = Max(totalVertices / ((queue->GetNumThreads() + 1) * 4), 1U);
+
+    unsigned begin = 0;
+    unsigned batchSize = 0;
+    for(unsigned i = 0; i < bakes.Size(); i++)
+    {
+        batchSize += bakes[i].outline_.Size();
+        if(batchSize < batchVertices && i + 1 < bakes.Size())
+            continue;
+
+        SharedPtr<WorkItem> item = queue->GetFreeItem();
+        item->priority_ = M_MAX_UNSIGNED;
+        item->workFunction_ = TriangulateWork;
+        item->start_ = &bakes[begin];
+        item->end_ = &bakes[0] + i + 1;
+        queue->AddWorkItem(item);
+
+        begin = i + 1;
+        batchSize = 0;
+    }
+    queue->Complete(M_MAX_UNSIGNED);
 }
 
-float MapEditor::Sign (Vector2 p1, Vector2 p2, Vector2 p3)
+void MapEditor::ProcessPolygonPhysics()
 {
-    return (p1.x_ - p3.x_) * (p2.y_ - p3.y_) - (p2.x_ - p3.x_) * (p1.y_ - p3.y_);
+    EDITOR_PROFILE(PHYSICS);
+    // Only polygons without a body were re-triangulated, everything else keeps its body
+    const PODVector<PolygonData*>& polygons = polygons_.GetPolygons();
+    for(unsigned i = 0; i < polygons.Size(); i++)
+        CreatePolygonBody(polygons[i]);
 }
 
-bool MapEditor::isInTriangle (Vector2 pt, Vector2 v1, Vector2 v2, Vector2 v3)
+void MapEditor::CreatePolygonBody(PolygonData* polygon)
 {
-    bool b1, b2, b3;
-
-    b1 = Sign(pt, v1, v2) < 0.0f;
-    b2 = Sign(pt, v2, v3) < 0.0f;
-    b3 = Sign(pt, v3, v1) < 0.0f;
-
-    return ((b1 == b2) && (b2 == b3));
+    // Unprocessed polygons get theirs from the next process, polygons outside the resident chunks when streamed in
+    if(polygon->physicsNode || polygon->dirty || !polygon->resident)
+        return;
+    polygon->physicsNode = CreateWallBody(scene_, polygon->vertices, polygon->mode, polygon->pieces);
 }
 
 /* End Process polygon */
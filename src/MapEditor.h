@@ -24,23 +24,44 @@
 
 #include "Sample.h"
 #include "Urho3D/Urho2D/CollisionPolygon2D.h"
+#include "Urho3D/Container/HashSet.h"
 #include "Urho3D/Container/LinkedList.h"
-#include "PolygonVertex.h"
+#include "EditorGrid.h"
+#include "EditorStats.h"
+#include "EditorSpatialIndex.h"
+#include "EditorChunks.h"
+#include "PolygonTriangulator.h"
+#include "PolygonData.h"
+#include "PolygonRegistry.h"
+#include "EntityRegistry.h"
+#include "PolygonOverlay.h"
+#include "ConvexDecomposition.h"
+#include "MapFormat.h"
+#include "MapJournal.h"
+#include "PrefabData.h"
+#include "TmxCodec.h"
+#include "VirtualList.h"
+#include "Urho3D/IO/VectorBuffer.h"
 
 namespace Urho3D
 {
 
 class Window;
+class Text;
 class Node;
 class Scene;
 class Sprite;
+class TmxFile2D;
+struct WorkItem;
 }
 
 enum Function
 {
     DRAWBODY,
     DRAWCHAR,
-    DRAWENV
+    DRAWENV,
+    /// Stamp or remove instances of the prefab picked in the file list.
+    DRAWPREFAB
 };
 
 enum EnvLayer
@@ -70,18 +91,49 @@ enum TypeKeyFunction
     NONE,
     TRASLATE,
     ADD,
-    REMOVE
+    REMOVE,
+    /// Rectangle or lasso selection, dragging moves the selection.
+    SELECT
 };
 
-struct EarTriangle
+/// Immutable copy of a polygon outline and the triangles and convex pieces baked from it.
+struct PolygonBake
 {
-    EarTriangle(Vector2 p1,Vector2 p2,Vector2 p3)
-    {
-        p1_ = p1;
-        p2_ = p2;
-        p3_ = p3;
-    }
-    Vector2 p1_,p2_,p3_;
+    PODVector<Vector2> outline_;
+    PODVector<EarTriangle> triangles_;
+    ConvexPieces pieces_;
+    bool valid_;
+};
+
+/// Map directory and editor menu parsed on a worker thread while the resources load in the background.
+struct StartupJob
+{
+    Context* context_;
+    String mapDir_;
+    MapSnapshot snapshot_;
+    bool mapLoaded_;
+    /// Compressed tile map to expand, empty if TmxFile2D reads it as is.
+    String tmxName_;
+    VectorBuffer tmx_;
+    bool tmxExpanded_;
+    /// Null if map_editor.json couldn't be read.
+    SharedPtr<JSONFile> menu_;
+    float mapTime_;
+    float tmxTime_;
+    float menuTime_;
+};
+
+/// Map save that runs on a worker thread. The snapshot is taken on the main thread and only read from then on.
+struct SaveJob
+{
+    Context* context_;
+    String dir_;
+    MapSnapshot snapshot_;
+    float snapshotTime_;
+    float jsonTime_;
+    float binaryTime_;
+    /// Empty when both formats were written.
+    String error_;
 };
 
 Vector2  dragPointBegin;
@@ -94,6 +146,8 @@ class MapEditor : public Sample
 
 public:
     MapEditor(Context* context);
+    ~MapEditor();
+    virtual void Setup();
     virtual void Start();
 
 private:
@@ -102,10 +156,23 @@ private:
     void HandleMouseButtonUp(StringHash eventType, VariantMap& eventData);
 
     void CreateGrids();
+    /// Refresh the frame time HUD.
+    void UpdateStatsText();
     void DrawRectangle(Rect rect);
-    void CreatePlatform(Vector2 p1, Vector2 p2, String typeplatform);
-    void CreateMovablePlatform(Vector2 p1, Vector2 p2);
-    void CreateEnemy(Vector2 p1);
+    PlatformData* CreatePlatform(Vector2 p1, Vector2 p2, EntityType typeplatform);
+    PlatformData* CreateMovablePlatform(Vector2 p1, Vector2 p2);
+    /// Create the node, bodies, sprite and reference node of a platform in a resident chunk.
+    void InstantiatePlatform(PlatformData* platData);
+    /// Create the bodies and sprite of a platform with world corners p1 and p2 on its node. Returns the reference
+    /// node made next to it, null if there is none.
+    Node* CreatePlatformBodies(Node* node, Vector2 p1, Vector2 p2, EntityType type);
+    void ReleasePlatform(PlatformData* platData);
+    void MovePlatformTarget(PlatformData* platform, Vector2 p2);
+    ObjectData* CreateEnemy(Vector2 p1);
+    void InstantiateObject(ObjectData* data);
+    void CreateObjectSprite(Node* node);
+    void ReleaseObject(ObjectData* data);
+    void MovePlayer(Vector2 position);
     void DrawWall(int button);
 
     void DrawCharacter();
@@ -116,48 +183,159 @@ private:
 
     void HandleChangeType(StringHash eventType, VariantMap& eventData);
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    /// Letter and Delete key shortcuts, skipped while a text input has the focus.
+    void HandleShortcutKeys();
+    /// Close the frame in the stats once all of its timed sections have run.
+    void HandleEndFrame(StringHash eventType, VariantMap& eventData);
     void HandleLoadPreview(StringHash eventType, VariantMap& eventData);
     void HandleProcess(StringHash eventType, VariantMap& eventData);
     void HandleSelectSecondList(StringHash eventType, VariantMap& eventData);
 
     void SetupViewport();
+    /// World area the camera shows.
+    Rect GetViewRect();
+    /// Stream chunks in and out around the camera.
+    void UpdateChunks();
+    /// Instantiate or release the platforms and objects found in chunks that came or went.
+    void StreamEntities(const PODVector<Rect>& chunks);
+    /// Keep bodies and overlays only for polygons that overlap a resident chunk.
+    void UpdatePolygonResidency();
     void MoveCamera(float timeStep);
     void SubscribeToEvents();
 
-    void LoadMap();
-    void SaveMap();
+    /// Load the map snapshot and replay the journal on top of it.
+    bool LoadMap();
+    bool SaveMap();
+    /// Snapshot the map and write it on the work queue, editing goes on meanwhile.
+    void SaveMapAsync();
+    /// Finish a background save or the startup parse.
+    void HandleWorkItemCompleted(StringHash eventType, VariantMap& eventData);
+    void SetSaveStatus(const String& status);
+    /// Replace the editor contents with a loaded snapshot and its journal. An empty editor still replays the
+    /// journal when no snapshot was found.
+    bool ApplyLoadedMap(const MapSnapshot& snapshot, bool loaded);
+    /// Queue the startup resources on the background loader and the map parse on a worker.
+    void StartLoading();
+    void HandleStartupResource(StringHash eventType, VariantMap& eventData);
+    /// Build the scene, window and map once the resources and the parse are both done.
+    void FinishStartup();
+    /// Replace the editor contents with a snapshot.
+    void ApplySnapshot(const MapSnapshot& snapshot);
+    void TakeSnapshot(MapSnapshot& snapshot);
+    /// Reuse the pieces a snapshot holds for a polygon whose outline still has the hash they were baked from.
+    void RestoreBake(PolygonData* polygon, const MapSnapshot& snapshot, const MapPolygon& mapPolygon);
+    /// Replay the edits a snapshot doesn't hold yet from the journal, then keep appending to it outside batch mode.
+    void ReplayJournal(const MapSnapshot& snapshot);
+    /// Apply one journal record. Returns false if it doesn't fit the map.
+    bool ReplayRecord(const JournalRecord& record);
+    /// Drop the journal records a saved snapshot holds.
+    void CompactJournal(const MapSnapshot& snapshot);
+    /// Journal next to the map, empty when saves go to another directory than loads.
+    String GetJournalName();
+    /// Directory SaveMap writes to.
+    String GetOutputDir();
+    /// Scene for -batch runs: physics and tile map, no camera or UI.
+    bool CreateBatchScene();
+    /// Load, process and save the map given on the command line, print timings and exit.
+    void RunBatch();
+    /// Convert the map given on the command line between the JSON and binary formats and exit.
+    void RunConvert();
+    /// Re-encode the tile layers of every tmx in the resource directories.
+    void RunTmxEncode();
+    /// The tile map, loaded through an in memory expansion if its layers are compressed.
+    TmxFile2D* GetTmxFile();
+    /// Load an expanded tile map and register it as tmxName_.
+    TmxFile2D* AddExpandedTmx(VectorBuffer& expanded);
 
     void LoadSelectedType(String type);
 
     void DrawPolygon();
 
     void ProcessPolygonPhysics();
+    /// Build the physics body of a processed polygon in a resident chunk, if it has none.
+    void CreatePolygonBody(PolygonData* polygon);
 
-    void bodyFunctions();
-
-    void SelectPolygon(Vector<PolygonVertex *>* polygon);
+    /// Re-triangulate the dirty polygons and rebuild their physics bodies.
+    void ProcessPolygons();
 
-    void UnselectPolygon(Vector<PolygonVertex *>* polygon);
+    /// Triangulate every bake, spread over the work queue when parallel processing is on.
+    void TriangulatePolygons(Vector<PolygonBake>& bakes);
 
-    float Sign (Vector2 p1, Vector2 p2, Vector2 p3);
+    void HandleAutoProcess(StringHash eventType, VariantMap& eventData);
+    void HandleChainMode(StringHash eventType, VariantMap& eventData);
 
-    bool isInTriangle (Vector2 pt, Vector2 v1, Vector2 v2, Vector2 v3);
-
-    bool ccw (Vector2 p1, Vector2 p2, Vector2 p3);
-
-    Vector2 nextVertex(Vector<PolygonVertex *>* polygon, PolygonVertex * P);
-    Vector2 prevVertex(Vector<PolygonVertex *>* polygon, PolygonVertex * P);
-
-    void cleanVertex(Vector<PolygonVertex *>* polygon);
-
-    void insertVertex(Vector<PolygonVertex *>* polygon, PolygonVertex * newvertex);
-
-    Vector<PolygonVertex *>* CreatePolygon();
-
-    PolygonVertex * CreatePolygonVertex(Vector2 pos);
+    void bodyFunctions();
 
-    bool RemovePolygon(PolygonVertex * p);
-    bool RemovePolygon(String key);
+    void SelectPolygon(PolygonData* polygon);
+
+    void UnselectPolygon(PolygonData* polygon);
+
+    void insertVertex(PolygonData* polygon, Vector2 position);
+
+    PolygonData* CreatePolygon();
+    /// Add an empty polygon under a new id, or under the given one. Returns null if that id is taken.
+    PolygonData* AddPolygon(unsigned id = 0);
+    PolygonData* GetPolygon(unsigned id);
+    void SetPolygonMode(PolygonData* polygon, PolygonBodyMode mode);
+
+    /// Insert a vertex into a polygon and register its handle in the spatial index.
+    void AddPolygonVertex(PolygonData* polygon, unsigned index, Vector2 position);
+    void MovePolygonVertex(PolygonData* polygon, unsigned index, Vector2 position);
+    void RemovePolygonVertex(PolygonData* polygon, unsigned index);
+    /// Find the vertex handle under a world position.
+    bool PickPolygonVertex(Vector2 position, PolygonData*& polygon, unsigned& index);
+
+    /// Find the PlatformData, ObjectData or PrefabInstance of the given kind under a world position through the spatial
+    /// index.
+    void* PickEntity(Vector2 position, EditorEntityKind kind);
+    /// Remove a platform or moving platform together with its node and reference node.
+    void RemovePlatform(PlatformData* platdata);
+    /// Remove an enemy or other object.
+    void RemoveObject(ObjectData* data);
+    /// Move a platform to new corners. A resident platform loses its bodies until RebuildMovedEntities.
+    void MovePlatform(PlatformData* platData, Vector2 p1, Vector2 p2);
+    /// Give the platforms and instances moved since the last call their bodies back, once each.
+    void RebuildMovedEntities();
+    void MoveObject(ObjectData* data, Vector2 position);
+
+    /// Start a rectangle selection, a lasso with shift, or a drag of the selection when pressing on it.
+    void BeginSelectionDrag();
+    /// Finish the rectangle or lasso, ctrl adds to the selection, or commit the drag.
+    void EndSelectionDrag();
+    /// Move every selected vertex, platform, enemy and instance as one journal batch.
+    void MoveSelection(Vector2 delta);
+    void DeleteSelection();
+    /// Copy the selected platforms, enemies, instances and fully selected polygons one grid step away and select
+    /// the copies.
+    void DuplicateSelection();
+    /// Outline the selection and the rectangle or lasso being dragged.
+    void DrawSelection();
+
+    /// Capture the selected platforms, enemies, instances and fully selected polygons as a new prefab, its origin
+    /// at the grid corner below the selection. The originals stay in place.
+    void CapturePrefab();
+    /// Add an empty prefab and return its index.
+    unsigned AddPrefab();
+    void AddPrefabPlatform(unsigned prefab, Vector2 p1, Vector2 p2, unsigned type);
+    void AddPrefabObject(unsigned prefab, Vector2 position, EntityType type);
+    /// Start a new polygon in a prefab, AddPrefabVertex appends to it.
+    void AddPrefabPolygon(unsigned prefab, unsigned mode);
+    void AddPrefabVertex(unsigned prefab, Vector2 position);
+    /// Definition of a prefab with its pieces baked, baking them on first use.
+    PrefabDefinition& GetBakedPrefab(unsigned prefab);
+    /// Place a prefab with its origin at offset.
+    PrefabInstance* StampPrefab(unsigned prefab, Vector2 offset);
+    Rect GetInstanceBounds(const PrefabInstance* instance);
+    /// Create the node, bodies and sprites of an instance in a resident chunk from the shared definition.
+    void InstantiateInstance(PrefabInstance* instance);
+    void ReleaseInstance(PrefabInstance* instance);
+    /// Move an instance origin. A resident instance loses its bodies until RebuildMovedEntities.
+    void MoveInstance(PrefabInstance* instance, Vector2 offset);
+    void RemoveInstance(PrefabInstance* instance);
+    /// Outline the polygons of resident instances, they have no overlay.
+    void DrawInstances();
+
+    bool RemovePolygon(PolygonData* polygon);
 
     void LoadPolygonList();
 
@@ -179,9 +357,8 @@ private:
 
     JSONValue rootjson;
 
-    int PolygonCounter = 0;
     HashMap< String, SharedPtr< Sprite2D > > TileSetMap;
-    HashMap< String, Vector<PolygonVertex *>* > PolygonMap;
+    PolygonRegistry polygons_;
 
     String CurrentType;
 
@@ -198,29 +375,98 @@ private:
     /// Flag for drawing debug geometry.
     bool drawDebug_;
     bool selectObject_ = false;
+    /// Spatial index handles of the selected vertices, platforms, enemies and instances.
+    PODVector<unsigned> selection_;
+    /// A rectangle or lasso is being dragged out from selectStart_.
+    bool selecting_ = false;
+    Vector2 selectStart_;
+    /// Lasso points, empty for a rectangle.
+    PODVector<Vector2> lasso_;
+    /// The selection is being dragged, by the snapped distance from moveStart_.
+    bool movingSelection_ = false;
+    Vector2 moveStart_;
+    /// Platforms and instances released by MovePlatform and MoveInstance, waiting for their bodies.
+    PODVector<PlatformData*> movedPlatforms_;
+    PODVector<PrefabInstance*> movedInstances_;
+    /// Triangulate polygons on worker threads.
+    bool parallelProcess_ = true;
+    /// Process dirty polygons as soon as they are edited.
+    bool autoProcess_ = false;
     /// Camera object.
     Camera* camera_;
 
-    Vector<EarTriangle*> earTriagles;
-    Vector< Vector<EarTriangle*>* > ListPolygonTriangle;
-    Vector<Node*> ListNodePolygonsPhysics;
     Vector<Node*> CuadrilateralPhysics;
-    Vector<PlatformData*> PlatformsList;
-    Vector<ObjectData*> ObjectList;
+    /// Placed platforms, objects and prefab instances by type.
+    EntityRegistry entities_;
+    /// Prefab definitions, never removed so journal records can refer to them by index.
+    Vector<PrefabDefinition> prefabs_;
+    /// Prefab picked in the file list, M_MAX_UNSIGNED for none.
+    unsigned currentPrefab_ = M_MAX_UNSIGNED;
 
     SharedPtr<Node> nodeWall;
     SharedPtr<Node> nodePlayer;
+    /// Retained editor grid.
+    WeakPtr<EditorGrid> grid_;
     Vector<Node*> EnemyList;
     Vector<Node*> NPCyList;
     String typebody = "Wall";
 
 
     Vector2 prevPositionLayer;
-    Vector<PolygonVertex *>* CurrentPolygon;
-    Vector< Vector<PolygonVertex *>* > ListPolygon;
-    PolygonVertex * CurrentVertex;
-    PolygonVertex * CurrentPrevVertex;
-    PolygonVertex * CurrentNextVertex;
+    PolygonData* CurrentPolygon = 0;
+    /// Selected vertex, valid while selectObject_ is set.
+    PolygonData* CurrentVertexPolygon = 0;
+    unsigned CurrentVertex = 0;
+    /// Command line: -batch runs headless, -map and -out set the map directories, -tmx the tile map resource and
+    /// -convert bin|json only converts the map to that format. -flatten makes batch saves write prefab instances as
+    /// plain platforms, objects and polygons.
+    bool batchMode_ = false;
+    bool flattenPrefabs_ = false;
+    String mapDir_ = "Data/Scenes/";
+    String outputDir_;
+    String tmxName_ = "Urho2D/nivel1.tmx";
+    String convertTo_;
+    /// Tile encoding for -tmxencode.
+    String tmxEncoding_;
+    /// Hot path timings, shown with F3 and saved to CSV with F4.
+    EditorStats stats_;
+    SharedPtr<Text> statsText_;
+    float statsRefresh_ = 0.0f;
+    /// Timestep of the frame being timed.
+    float frameTime_ = 0.0f;
+    /// Polygon fixtures after the last process.
+    unsigned fixtureCount_ = 0;
+    /// Bake buffers of the last process, reused by the next one.
+    Vector<PolygonBake> bakes_;
+    /// Retained outlines, handles and pieces of the polygons.
+    PolygonOverlay* overlay_ = 0;
+    /// Platforms, enemies, instances and vertex handles for picking.
+    EditorSpatialIndex spatialIndex_;
+    /// Chunks around the camera whose objects have bodies and drawables.
+    EditorChunks chunks_;
+    /// Save running in the background, and whether F5 was pressed again while it ran.
+    SharedPtr<WorkItem> saveItem_;
+    SaveJob* saveJob_ = 0;
+    bool savePending_ = false;
+    HiresTimer saveTimer_;
+    /// Startup loads in flight, and their timings for the log.
+    SharedPtr<WorkItem> startupItem_;
+    StartupJob* startupJob_ = 0;
+    /// Names of the queued startup resources not loaded yet. Their dependencies send the same event and aren't in it.
+    HashSet<String> pendingResources_;
+    HiresTimer startupTimer_;
+    float resourcesTime_ = 0.0f;
+    bool firstFrame_ = false;
+    /// Every edit since the last save, replayed on load. A background save compacts it once it reaches compactAt_
+    /// records.
+    MapJournal journal_;
+    /// Polygons of the last applied snapshot that couldn't keep their saved id, journal records may miss them.
+    unsigned numRenumbered_ = 0;
+    unsigned compactAt_;
+    /// Rows of the FileList view, the entries of the selected type.
+    SharedPtr<VirtualList> fileList_;
+    /// Rows of the SecondList view, one per polygon valued with its id.
+    SharedPtr<VirtualList> polygonList_;
 
 };
 
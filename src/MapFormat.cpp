@@ -0,0 +1,832 @@
+#include "MapFormat.h"
+#include "JSONStreamWriter.h"
+#include "Urho3D/IO/File.h"
+#include "Urho3D/IO/FileSystem.h"
+#include "Urho3D/IO/Log.h"
+#include "Urho3D/Resource/JSONFile.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char* platformTypeNames[] = {
+    "platform",
+    "midleplatform",
+    "movplatform"
+};
+
+/// Fixed part of a binary map. The arrays follow in this order, all of them 4 byte aligned.
+struct MapBinaryHeader
+{
+    char magic_[4];
+    unsigned version_;
+    Vector2 playerPosition_;
+    unsigned numPlatforms_;
+    unsigned numObjects_;
+    unsigned numPolygons_;
+    unsigned numVertices_;
+    unsigned numPieces_;
+    unsigned numPieceVertices_;
+    unsigned numPrefabs_;
+    unsigned numPrefabPlatforms_;
+    unsigned numPrefabObjects_;
+    unsigned numPrefabPolygons_;
+    unsigned numInstances_;
+    unsigned journalGeneration_;
+    unsigned journalRecords_;
+};
+
+/// Read only mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile(const String& fileName) :
+        data_(0),
+        size_(0)
+    {
+#ifdef _WIN32
+        file_ = CreateFileW(WString(GetNativePath(fileName)).CString(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, 0);
+        mapping_ = 0;
+        if(file_ == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file_, &size) || !size.QuadPart || size.HighPart)
+            return;
+        mapping_ = CreateFileMappingW(file_, 0, PAGE_READONLY, 0, 0, 0);
+        if(!mapping_)
+            return;
+        data_ = (const unsigned char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if(data_)
+            size_ = (unsigned)size.LowPart;
+#else
+        fd_ = open(GetNativePath(fileName).CString(), O_RDONLY);
+        if(fd_ < 0)
+            return;
+        struct stat st;
+        if(fstat(fd_, &st) || st.st_size <= 0 || (unsigned long long)st.st_size > M_MAX_UNSIGNED)
+            return;
+        void* data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if(data == MAP_FAILED)
+            return;
+        data_ = (const unsigned char*)data;
+        size_ = (unsigned)st.st_size;
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if(data_)
+            UnmapViewOfFile(data_);
+        if(mapping_)
+            CloseHandle(mapping_);
+        if(file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+#else
+        if(data_)
+            munmap((void*)data_, size_);
+        if(fd_ >= 0)
+            close(fd_);
+#endif
+    }
+
+    const unsigned char* GetData() const { return data_; }
+    unsigned GetSize() const { return size_; }
+
+private:
+    const unsigned char* data_;
+    unsigned size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#else
+    int fd_;
+#endif
+};
+
+bool CommitMapFile(const String& tempName, const String& fileName)
+{
+#ifdef _WIN32
+    return MoveFileExW(WString(GetNativePath(tempName)).CString(), WString(GetNativePath(fileName)).CString(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(GetNativePath(tempName).CString(), GetNativePath(fileName).CString()) == 0;
+#endif
+}
+
+void DiscardMapFile(const String& tempName)
+{
+#ifdef _WIN32
+    DeleteFileW(WString(GetNativePath(tempName)).CString());
+#else
+    remove(GetNativePath(tempName).CString());
+#endif
+}
+
+void MapSnapshot::Clear()
+{
+    playerPosition_ = Vector2::ZERO;
+    journalGeneration_ = 0;
+    journalRecords_ = 0;
+    platforms_.Clear();
+    objects_.Clear();
+    polygons_.Clear();
+    vertices_.Clear();
+    pieces_.Clear();
+    pieceVertices_.Clear();
+    prefabs_.Clear();
+    prefabPlatforms_.Clear();
+    prefabObjects_.Clear();
+    prefabPolygons_.Clear();
+    instances_.Clear();
+}
+
+/// Append a polygon to dest with its outline and pieces at the end of the shared arrays.
+static void AppendPolygon(MapSnapshot& snapshot, PODVector<MapPolygon>& dest, const PODVector<Vector2>& outline,
+    const ConvexPieces& pieces, unsigned mode, unsigned hash, unsigned id)
+{
+    MapPolygon polygon;
+    polygon.firstVertex_ = snapshot.vertices_.Size();
+    polygon.numVertices_ = outline.Size();
+    polygon.firstPiece_ = snapshot.pieces_.Size();
+    polygon.numPieces_ = pieces.Size();
+    polygon.mode_ = mode;
+    polygon.hash_ = hash;
+    polygon.id_ = id;
+    dest.Push(polygon);
+    snapshot.vertices_.Push(outline);
+
+    for(unsigned i = 0; i < pieces.Size(); i++)
+    {
+        MapPiece piece;
+        piece.firstVertex_ = snapshot.pieceVertices_.Size() + pieces.starts_[i];
+        piece.numVertices_ = pieces.GetNumVertices(i);
+        snapshot.pieces_.Push(piece);
+    }
+    snapshot.pieceVertices_.Push(pieces.vertices_);
+}
+
+void MapSnapshot::AddPolygon(const PODVector<Vector2>& outline, const ConvexPieces& pieces, unsigned mode, unsigned hash,
+    unsigned id)
+{
+    AppendPolygon(*this, polygons_, outline, pieces, mode, hash, id);
+}
+
+void MapSnapshot::AddPrefabPolygon(const PODVector<Vector2>& outline, const ConvexPieces& pieces, unsigned mode, unsigned hash)
+{
+    // Prefab polygons are never edited in place, journal records don't need an id for them
+    AppendPolygon(*this, prefabPolygons_, outline, pieces, mode, hash, 0);
+}
+
+unsigned GetOutlineHash(const Vector2* vertices, unsigned count, unsigned mode)
+{
+    // FNV-1a over the raw coordinates, the editor snaps them to the grid so equal outlines have equal bits
+    unsigned hash = 2166136261u;
+    unsigned header[2] = { MAP_BAKE_VERSION, mode };
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(header);
+    for(unsigned i = 0; i < sizeof(header); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    bytes = reinterpret_cast<const unsigned char*>(vertices);
+    for(unsigned i = 0; i < count * sizeof(Vector2); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash ? hash : 1;
+}
+
+MapPlatformType GetMapPlatformType(const String& type)
+{
+    if(type == "movplatform")
+        return MAP_MOVPLATFORM;
+    if(type == "midleplatform")
+        return MAP_MIDLEPLATFORM;
+    return MAP_PLATFORM;
+}
+
+String GetMapPlatformTypeName(unsigned type)
+{
+    return platformTypeNames[type <= MAP_MOVPLATFORM ? type : MAP_PLATFORM];
+}
+
+static void CopyName(char* dest, const String& source)
+{
+    // Names are short ids like "enemy" or "t01", longer ones are cut
+    memset(dest, 0, 16);
+    strncpy(dest, source.CString(), 15);
+}
+
+static String ReadName(const char* source)
+{
+    return String(source, (unsigned)strnlen(source, 16));
+}
+
+static void ReadPlatform(const JSONValue& platformdata, MapPlatform& platform)
+{
+    platform.type_ = GetMapPlatformType(platformdata.Get("type").GetString());
+    platform.p1_ = Vector2(platformdata.Get("p1_x").GetFloat(), platformdata.Get("p1_y").GetFloat());
+    platform.p2_ = Vector2(platformdata.Get("p2_x").GetFloat(), platformdata.Get("p2_y").GetFloat());
+}
+
+static void ReadObject(const JSONValue& objectdata, MapObject& object)
+{
+    object.position_ = Vector2(objectdata.Get("pos_x").GetFloat(), objectdata.Get("pos_y").GetFloat());
+    CopyName(object.type_, objectdata.Get("type").GetString());
+    CopyName(object.code_, objectdata.Get("code").IsNull() ? String("t01") : objectdata.Get("code").GetString());
+}
+
+static void ReadOutline(const JSONArray& polygonVertexArray, PODVector<Vector2>& outline)
+{
+    outline.Resize(polygonVertexArray.Size());
+    for(unsigned j = 0; j < polygonVertexArray.Size(); j++)
+        outline[j] = Vector2(polygonVertexArray[j].Get("x_").GetFloat(), polygonVertexArray[j].Get("y_").GetFloat());
+}
+
+static void ReadPieces(const JSONArray& pieceArray, ConvexPieces& pieces)
+{
+    pieces.Clear();
+    for(unsigned j = 0; j < pieceArray.Size(); j++)
+    {
+        // Files from before the convex merge only hold triangles and no vertex count
+        const JSONValue& piece = pieceArray[j];
+        unsigned count = piece.Get("vertices").IsNull() ? 3 : piece.Get("vertices").GetUInt();
+        pieces.BeginPiece();
+        for(unsigned k = 0; k < count; k++)
+            pieces.vertices_.Push(Vector2(piece.Get("p" + String(k + 1) + "_x_").GetFloat(), piece.Get("p" + String(k + 1) + "_y_").GetFloat()));
+    }
+}
+
+bool LoadMapJSON(Context* context, const String& dir, MapSnapshot& snapshot)
+{
+    File nodeFile(context, dir + "MapNode.json");
+    File dataFile(context, dir + "MapData.json");
+    if(!nodeFile.IsOpen() || !dataFile.IsOpen())
+        return false;
+
+    SharedPtr<JSONFile> nodeJson(new JSONFile(context));
+    SharedPtr<JSONFile> dataJson(new JSONFile(context));
+    if(!nodeJson->Load(nodeFile) || !dataJson->Load(dataFile))
+        return false;
+
+    snapshot.Clear();
+    const JSONValue& root = nodeJson->GetRoot();
+    snapshot.playerPosition_ = Vector2(root.Get("playerPos_x").GetFloat(), root.Get("playerPos_y").GetFloat());
+
+    const JSONArray& platforms = root.Get("platforms").GetArray();
+    snapshot.platforms_.Resize(platforms.Size());
+    for(unsigned i = 0; i < platforms.Size(); i++)
+        ReadPlatform(platforms[i], snapshot.platforms_[i]);
+
+    const JSONArray& objects = root.Get("objects").GetArray();
+    snapshot.objects_.Resize(objects.Size());
+    for(unsigned i = 0; i < objects.Size(); i++)
+        ReadObject(objects[i], snapshot.objects_[i]);
+
+    // Outlines come from the editor file, the pieces baked from them from the game file, both in polygon order
+    const JSONValue& dataRoot = dataJson->GetRoot();
+    const JSONArray& polygonsJSON = dataRoot.Get("polygons").GetArray();
+    const JSONArray& chainJSON = dataRoot.Get("chain").GetArray();
+    const JSONArray& hashJSON = dataRoot.Get("hashes").GetArray();
+    const JSONArray& idJSON = dataRoot.Get("ids").GetArray();
+    const JSONArray& triangleJSON = root.Get("triangles").GetArray();
+    PODVector<Vector2> outline;
+    ConvexPieces pieces;
+    for(unsigned i = 0; i < polygonsJSON.Size(); i++)
+    {
+        ReadOutline(polygonsJSON[i].GetArray(), outline);
+        pieces.Clear();
+        if(i < triangleJSON.Size())
+            ReadPieces(triangleJSON[i].GetArray(), pieces);
+
+        bool chain = i < chainJSON.Size() && chainJSON[i].GetBool();
+        // Files without hashes get every polygon processed again, maps saved before ids were kept get new ones
+        unsigned hash = i < hashJSON.Size() ? hashJSON[i].GetUInt() : 0;
+        unsigned id = i < idJSON.Size() ? idJSON[i].GetUInt() : 0;
+        snapshot.AddPolygon(outline, pieces, chain ? CHAINBODY : SOLIDBODY, hash, id);
+    }
+
+    // Prefab outlines are split the same way, one list for every prefab polygon in prefab order. A prefab has one
+    // entry of pieces for each of its polygons. Maps saved before prefabs have neither key
+    const JSONArray& prefabsJSON = root.Get("prefabs").GetArray();
+    const JSONArray& prefabPolygonsJSON = dataRoot.Get("prefabPolygons").GetArray();
+    const JSONArray& prefabChainJSON = dataRoot.Get("prefabChain").GetArray();
+    const JSONArray& prefabHashJSON = dataRoot.Get("prefabHashes").GetArray();
+    unsigned nextPolygon = 0;
+    for(unsigned i = 0; i < prefabsJSON.Size(); i++)
+    {
+        const JSONValue& prefabdata = prefabsJSON[i];
+        MapPrefab prefab;
+        CopyName(prefab.name_, prefabdata.Get("name").GetString());
+
+        const JSONArray& prefabPlatforms = prefabdata.Get("platforms").GetArray();
+        prefab.firstPlatform_ = snapshot.prefabPlatforms_.Size();
+        prefab.numPlatforms_ = prefabPlatforms.Size();
+        snapshot.prefabPlatforms_.Resize(prefab.firstPlatform_ + prefab.numPlatforms_);
+        for(unsigned j = 0; j < prefabPlatforms.Size(); j++)
+            ReadPlatform(prefabPlatforms[j], snapshot.prefabPlatforms_[prefab.firstPlatform_ + j]);
+
+        const JSONArray& prefabObjects = prefabdata.Get("objects").GetArray();
+        prefab.firstObject_ = snapshot.prefabObjects_.Size();
+        prefab.numObjects_ = prefabObjects.Size();
+        snapshot.prefabObjects_.Resize(prefab.firstObject_ + prefab.numObjects_);
+        for(unsigned j = 0; j < prefabObjects.Size(); j++)
+            ReadObject(prefabObjects[j], snapshot.prefabObjects_[prefab.firstObject_ + j]);
+
+        const JSONArray& prefabTriangles = prefabdata.Get("triangles").GetArray();
+        prefab.firstPolygon_ = snapshot.prefabPolygons_.Size();
+        for(unsigned j = 0; j < prefabTriangles.Size() && nextPolygon < prefabPolygonsJSON.Size(); j++, nextPolygon++)
+        {
+            ReadOutline(prefabPolygonsJSON[nextPolygon].GetArray(), outline);
+            ReadPieces(prefabTriangles[j].GetArray(), pieces);
+            bool chain = nextPolygon < prefabChainJSON.Size() && prefabChainJSON[nextPolygon].GetBool();
+            unsigned hash = nextPolygon < prefabHashJSON.Size() ? prefabHashJSON[nextPolygon].GetUInt() : 0;
+            snapshot.AddPrefabPolygon(outline, pieces, chain ? CHAINBODY : SOLIDBODY, hash);
+        }
+        prefab.numPolygons_ = snapshot.prefabPolygons_.Size() - prefab.firstPolygon_;
+        snapshot.prefabs_.Push(prefab);
+    }
+
+    const JSONArray& instancesJSON = root.Get("instances").GetArray();
+    for(unsigned i = 0; i < instancesJSON.Size(); i++)
+    {
+        MapInstance instance;
+        instance.prefab_ = instancesJSON[i].Get("prefab").GetUInt();
+        instance.offset_ = Vector2(instancesJSON[i].Get("x").GetFloat(), instancesJSON[i].Get("y").GetFloat());
+        if(instance.prefab_ < snapshot.prefabs_.Size())
+            snapshot.instances_.Push(instance);
+    }
+
+    // Maps saved before the journal have neither key and read as generation 0
+    snapshot.journalGeneration_ = dataRoot.Get("journal").GetUInt();
+    snapshot.journalRecords_ = dataRoot.Get("journalRecords").GetUInt();
+    return true;
+}
+
+bool LoadMapSnapshot(Context* context, const String& dir, MapSnapshot& snapshot)
+{
+    // The binary file is written with the JSON ones, only trust it if nobody edited those afterwards
+    FileSystem* fileSystem = context->GetSubsystem<FileSystem>();
+    String binaryName = dir + "MapData.bin";
+    if(fileSystem->FileExists(binaryName))
+    {
+        unsigned binaryTime = fileSystem->GetLastModifiedTime(binaryName);
+        if(binaryTime >= fileSystem->GetLastModifiedTime(dir + "MapNode.json") &&
+            binaryTime >= fileSystem->GetLastModifiedTime(dir + "MapData.json") &&
+            LoadMapBinary(binaryName, snapshot))
+            return true;
+    }
+    return LoadMapJSON(context, dir, snapshot);
+}
+
+/// Outline of a polygon as {x_, y_} objects.
+static void WriteOutline(JSONStreamWriter& writer, const MapSnapshot& snapshot, const MapPolygon& polygon)
+{
+    writer.BeginArray();
+    for(unsigned j = 0; j < polygon.numVertices_; j++)
+    {
+        const Vector2& v = snapshot.vertices_[polygon.firstVertex_ + j];
+        writer.BeginObject();
+        writer.Key("x_");
+        writer.Value(v.x_);
+        writer.Key("y_");
+        writer.Value(v.y_);
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+/// Pieces of a polygon. Convex pieces keep the triangle keys, p1..pN plus their vertex count.
+static void WritePieces(JSONStreamWriter& writer, const MapSnapshot& snapshot, const MapPolygon& polygon)
+{
+    char key[16];
+    writer.BeginArray();
+    for(unsigned j = 0; j < polygon.numPieces_; j++)
+    {
+        const MapPiece& piece = snapshot.pieces_[polygon.firstPiece_ + j];
+        const Vector2* points = &snapshot.pieceVertices_[piece.firstVertex_];
+        writer.BeginObject();
+        for(unsigned k = 0; k < piece.numVertices_; k++)
+        {
+            snprintf(key, sizeof(key), "p%u_x_", k + 1);
+            writer.Key(key);
+            writer.Value(points[k].x_);
+            snprintf(key, sizeof(key), "p%u_y_", k + 1);
+            writer.Key(key);
+            writer.Value(points[k].y_);
+        }
+        writer.Key("vertices");
+        writer.Value(piece.numVertices_);
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+static void WritePlatform(JSONStreamWriter& writer, const MapPlatform& platform)
+{
+    writer.BeginObject();
+    writer.Key("p1_x");
+    writer.Value(platform.p1_.x_);
+    writer.Key("p1_y");
+    writer.Value(platform.p1_.y_);
+    writer.Key("p2_x");
+    writer.Value(platform.p2_.x_);
+    writer.Key("p2_y");
+    writer.Value(platform.p2_.y_);
+    writer.Key("type");
+    writer.Value(GetMapPlatformTypeName(platform.type_));
+    writer.EndObject();
+}
+
+static void WriteObject(JSONStreamWriter& writer, const MapObject& object)
+{
+    writer.BeginObject();
+    writer.Key("pos_x");
+    writer.Value(object.position_.x_);
+    writer.Key("pos_y");
+    writer.Value(object.position_.y_);
+    writer.Key("type");
+    writer.Value(ReadName(object.type_));
+    writer.Key("code");
+    writer.Value(ReadName(object.code_));
+    writer.EndObject();
+}
+
+/// Keep the current fileName as backupName while fileName stays in place, a hard link where the file system allows it.
+static bool BackupMapFile(Context* context, const String& fileName, const String& backupName)
+{
+    DiscardMapFile(backupName);
+#ifdef _WIN32
+    if(CreateHardLinkW(WString(GetNativePath(backupName)).CString(), WString(GetNativePath(fileName)).CString(), 0))
+        return true;
+#else
+    if(link(GetNativePath(fileName).CString(), GetNativePath(backupName).CString()) == 0)
+        return true;
+#endif
+    return context->GetSubsystem<FileSystem>()->Copy(fileName, backupName);
+}
+
+bool SaveMapJSON(Context* context, const String& dir, const MapSnapshot& snapshot)
+{
+    // Written straight to the file in one pass, nothing but the writer buffer is held in memory. Both files go
+    // to temp names first and only replace the old ones once complete
+    File file(context, dir + "MapNode.json.tmp", FILE_WRITE);
+    if(!file.IsOpen())
+        return false;
+
+    JSONStreamWriter writer(file);
+    writer.BeginObject();
+    writer.Key("playerPos_x");
+    writer.Value(snapshot.playerPosition_.x_);
+    writer.Key("playerPos_y");
+    writer.Value(snapshot.playerPosition_.y_);
+
+    writer.Key("triangles");
+    writer.BeginArray();
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+        WritePieces(writer, snapshot, snapshot.polygons_[i]);
+    writer.EndArray();
+
+    writer.Key("chains");
+    writer.BeginArray();
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+    {
+        if(snapshot.polygons_[i].mode_ == CHAINBODY)
+            WriteOutline(writer, snapshot, snapshot.polygons_[i]);
+    }
+    writer.EndArray();
+
+    writer.Key("platforms");
+    writer.BeginArray();
+    for(unsigned i = 0; i < snapshot.platforms_.Size(); i++)
+        WritePlatform(writer, snapshot.platforms_[i]);
+    writer.EndArray();
+
+    writer.Key("objects");
+    writer.BeginArray();
+    for(unsigned i = 0; i < snapshot.objects_.Size(); i++)
+        WriteObject(writer, snapshot.objects_[i]);
+    writer.EndArray();
+
+    // Each prefab is written once with its pieces, an instance is only its prefab index and offset
+    writer.Key("prefabs");
+    writer.BeginArray();
+    for(unsigned i = 0; i < snapshot.prefabs_.Size(); i++)
+    {
+        const MapPrefab& prefab = snapshot.prefabs_[i];
+        writer.BeginObject();
+        writer.Key("name");
+        writer.Value(ReadName(prefab.name_));
+        writer.Key("platforms");
+        writer.BeginArray();
+        for(unsigned j = 0; j < prefab.numPlatforms_; j++)
+            WritePlatform(writer, snapshot.prefabPlatforms_[prefab.firstPlatform_ + j]);
+        writer.EndArray();
+        writer.Key("objects");
+        writer.BeginArray();
+        for(unsigned j = 0; j < prefab.numObjects_; j++)
+            WriteObject(writer, snapshot.prefabObjects_[prefab.firstObject_ + j]);
+        writer.EndArray();
+        writer.Key("triangles");
+        writer.BeginArray();
+        for(unsigned j = 0; j < prefab.numPolygons_; j++)
+            WritePieces(writer, snapshot, snapshot.prefabPolygons_[prefab.firstPolygon_ + j]);
+        writer.EndArray();
+        writer.Key("chains");
+        writer.BeginArray();
+        for(unsigned j = 0; j < prefab.numPolygons_; j++)
+        {
+            const MapPolygon& polygon = snapshot.prefabPolygons_[prefab.firstPolygon_ + j];
+            if(polygon.mode_ == CHAINBODY)
+                WriteOutline(writer, snapshot, polygon);
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("instances");
+    writer.BeginArray();
+    for(unsigned i = 0; i < snapshot.instances_.Size(); i++)
+    {
+        const MapInstance& instance = snapshot.instances_[i];
+        writer.BeginObject();
+        writer.Key("prefab");
+        writer.Value(instance.prefab_);
+        writer.Key("x");
+        writer.Value(instance.offset_.x_);
+        writer.Key("y");
+        writer.Value(instance.offset_.y_);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    bool ok = writer.Flush();
+    file.Close();
+    if(!ok)
+    {
+        DiscardMapFile(dir + "MapNode.json.tmp");
+        return false;
+    }
+
+    /** Solo archivo de editor **/
+
+    File mapDataFile(context, dir + "MapData.json.tmp", FILE_WRITE);
+    if(!mapDataFile.IsOpen())
+    {
+        DiscardMapFile(dir + "MapNode.json.tmp");
+        return false;
+    }
+
+    JSONStreamWriter dataWriter(mapDataFile);
+    dataWriter.BeginObject();
+    dataWriter.Key("polygons");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+        WriteOutline(dataWriter, snapshot, snapshot.polygons_[i]);
+    dataWriter.EndArray();
+    dataWriter.Key("chain");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+        dataWriter.Value(snapshot.polygons_[i].mode_ == CHAINBODY);
+    dataWriter.EndArray();
+    dataWriter.Key("hashes");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+        dataWriter.Value(snapshot.polygons_[i].hash_);
+    dataWriter.EndArray();
+    dataWriter.Key("ids");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.polygons_.Size(); i++)
+        dataWriter.Value(snapshot.polygons_[i].id_);
+    dataWriter.EndArray();
+    dataWriter.Key("prefabPolygons");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.prefabPolygons_.Size(); i++)
+        WriteOutline(dataWriter, snapshot, snapshot.prefabPolygons_[i]);
+    dataWriter.EndArray();
+    dataWriter.Key("prefabChain");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.prefabPolygons_.Size(); i++)
+        dataWriter.Value(snapshot.prefabPolygons_[i].mode_ == CHAINBODY);
+    dataWriter.EndArray();
+    dataWriter.Key("prefabHashes");
+    dataWriter.BeginArray();
+    for(unsigned i = 0; i < snapshot.prefabPolygons_.Size(); i++)
+        dataWriter.Value(snapshot.prefabPolygons_[i].hash_);
+    dataWriter.EndArray();
+    dataWriter.Key("journal");
+    dataWriter.Value(snapshot.journalGeneration_);
+    dataWriter.Key("journalRecords");
+    dataWriter.Value(snapshot.journalRecords_);
+    dataWriter.EndObject();
+    ok = dataWriter.Flush();
+    mapDataFile.Close();
+
+    if(!ok)
+    {
+        DiscardMapFile(dir + "MapNode.json.tmp");
+        DiscardMapFile(dir + "MapData.json.tmp");
+        return false;
+    }
+
+    // MapData.json goes last and the old MapNode.json is kept until it is in place, so a failed second move
+    // puts the previous pair back instead of leaving new nodes next to old polygon data
+    bool hadNodes = context->GetSubsystem<FileSystem>()->FileExists(dir + "MapNode.json");
+    if(hadNodes && !BackupMapFile(context, dir + "MapNode.json", dir + "MapNode.json.bak"))
+    {
+        URHO3D_LOGWARNING("Could not back up " + dir + "MapNode.json, map not saved");
+        DiscardMapFile(dir + "MapNode.json.tmp");
+        DiscardMapFile(dir + "MapData.json.tmp");
+        return false;
+    }
+    if(!CommitMapFile(dir + "MapNode.json.tmp", dir + "MapNode.json"))
+    {
+        DiscardMapFile(dir + "MapNode.json.tmp");
+        DiscardMapFile(dir + "MapData.json.tmp");
+        DiscardMapFile(dir + "MapNode.json.bak");
+        return false;
+    }
+    if(!CommitMapFile(dir + "MapData.json.tmp", dir + "MapData.json"))
+    {
+        DiscardMapFile(dir + "MapData.json.tmp");
+        if(!hadNodes)
+            DiscardMapFile(dir + "MapNode.json");
+        else if(!CommitMapFile(dir + "MapNode.json.bak", dir + "MapNode.json"))
+            URHO3D_LOGWARNING("Could not restore " + dir + "MapNode.json, the previous one is in MapNode.json.bak");
+        return false;
+    }
+    DiscardMapFile(dir + "MapNode.json.bak");
+    return true;
+}
+
+/// Copy count elements of an array out of the mapping and advance past them.
+template <class T> static bool ReadArray(const unsigned char*& data, const unsigned char* end, unsigned count, PODVector<T>& dest)
+{
+    unsigned long long bytes = (unsigned long long)count * sizeof(T);
+    if(bytes > (unsigned long long)(end - data))
+        return false;
+    dest.Resize(count);
+    if(count)
+        memcpy(&dest[0], data, (size_t)bytes);
+    data += bytes;
+    return true;
+}
+
+template <class T> static bool WriteArray(File& file, const PODVector<T>& source)
+{
+    unsigned bytes = source.Size() * sizeof(T);
+    return !bytes || file.Write(&source[0], bytes) == bytes;
+}
+
+/// Cut the type and code of objects read from a file to at most 15 characters.
+static void TerminateNames(PODVector<MapObject>& objects)
+{
+    for(unsigned i = 0; i < objects.Size(); i++)
+    {
+        objects[i].type_[sizeof(objects[i].type_) - 1] = 0;
+        objects[i].code_[sizeof(objects[i].code_) - 1] = 0;
+    }
+}
+
+/// Check the outline and piece ranges of a polygon array against the shared arrays.
+static bool PolygonsInRange(const MapSnapshot& snapshot, const PODVector<MapPolygon>& polygons)
+{
+    for(unsigned i = 0; i < polygons.Size(); i++)
+    {
+        const MapPolygon& polygon = polygons[i];
+        if((unsigned long long)polygon.firstVertex_ + polygon.numVertices_ > snapshot.vertices_.Size() ||
+            (unsigned long long)polygon.firstPiece_ + polygon.numPieces_ > snapshot.pieces_.Size())
+            return false;
+    }
+    return true;
+}
+
+bool LoadMapBinary(const String& fileName, MapSnapshot& snapshot)
+{
+    MappedFile file(fileName);
+    if(!file.GetData() || file.GetSize() < sizeof(MapBinaryHeader))
+        return false;
+
+    MapBinaryHeader header;
+    memcpy(&header, file.GetData(), sizeof(header));
+    if(memcmp(header.magic_, "PMAP", 4))
+        return false;
+    if(header.version_ != MAP_BINARY_VERSION)
+    {
+        URHO3D_LOGWARNING(fileName + " has binary map version " + String(header.version_) + ", expected " + String(MAP_BINARY_VERSION));
+        return false;
+    }
+
+    const unsigned char* data = file.GetData() + sizeof(header);
+    const unsigned char* end = file.GetData() + file.GetSize();
+    snapshot.playerPosition_ = header.playerPosition_;
+    snapshot.journalGeneration_ = header.journalGeneration_;
+    snapshot.journalRecords_ = header.journalRecords_;
+    if(!ReadArray(data, end, header.numPlatforms_, snapshot.platforms_) ||
+        !ReadArray(data, end, header.numObjects_, snapshot.objects_) ||
+        !ReadArray(data, end, header.numPolygons_, snapshot.polygons_) ||
+        !ReadArray(data, end, header.numVertices_, snapshot.vertices_) ||
+        !ReadArray(data, end, header.numPieces_, snapshot.pieces_) ||
+        !ReadArray(data, end, header.numPieceVertices_, snapshot.pieceVertices_) ||
+        !ReadArray(data, end, header.numPrefabs_, snapshot.prefabs_) ||
+        !ReadArray(data, end, header.numPrefabPlatforms_, snapshot.prefabPlatforms_) ||
+        !ReadArray(data, end, header.numPrefabObjects_, snapshot.prefabObjects_) ||
+        !ReadArray(data, end, header.numPrefabPolygons_, snapshot.prefabPolygons_) ||
+        !ReadArray(data, end, header.numInstances_, snapshot.instances_))
+    {
+        URHO3D_LOGWARNING(fileName + " is truncated");
+        snapshot.Clear();
+        return false;
+    }
+
+    // Ranges are trusted by every reader, check them once here
+    if(!PolygonsInRange(snapshot, snapshot.polygons_) || !PolygonsInRange(snapshot, snapshot.prefabPolygons_))
+    {
+        snapshot.Clear();
+        return false;
+    }
+    for(unsigned i = 0; i < snapshot.pieces_.Size(); i++)
+    {
+        const MapPiece& piece = snapshot.pieces_[i];
+        if((unsigned long long)piece.firstVertex_ + piece.numVertices_ > snapshot.pieceVertices_.Size())
+        {
+            snapshot.Clear();
+            return false;
+        }
+    }
+    for(unsigned i = 0; i < snapshot.prefabs_.Size(); i++)
+    {
+        const MapPrefab& prefab = snapshot.prefabs_[i];
+        if((unsigned long long)prefab.firstPlatform_ + prefab.numPlatforms_ > snapshot.prefabPlatforms_.Size() ||
+            (unsigned long long)prefab.firstObject_ + prefab.numObjects_ > snapshot.prefabObjects_.Size() ||
+            (unsigned long long)prefab.firstPolygon_ + prefab.numPolygons_ > snapshot.prefabPolygons_.Size())
+        {
+            snapshot.Clear();
+            return false;
+        }
+    }
+    for(unsigned i = 0; i < snapshot.instances_.Size(); i++)
+    {
+        if(snapshot.instances_[i].prefab_ >= snapshot.prefabs_.Size())
+        {
+            snapshot.Clear();
+            return false;
+        }
+    }
+
+    // Names are copied raw from the file, cut them so callers can read them as C strings
+    TerminateNames(snapshot.objects_);
+    TerminateNames(snapshot.prefabObjects_);
+    for(unsigned i = 0; i < snapshot.prefabs_.Size(); i++)
+        snapshot.prefabs_[i].name_[sizeof(snapshot.prefabs_[i].name_) - 1] = 0;
+    return true;
+}
+
+bool SaveMapBinary(Context* context, const String& fileName, const MapSnapshot& snapshot)
+{
+    File file(context, fileName + ".tmp", FILE_WRITE);
+    if(!file.IsOpen())
+        return false;
+
+    MapBinaryHeader header;
+    memcpy(header.magic_, "PMAP", 4);
+    header.version_ = MAP_BINARY_VERSION;
+    header.playerPosition_ = snapshot.playerPosition_;
+    header.numPlatforms_ = snapshot.platforms_.Size();
+    header.numObjects_ = snapshot.objects_.Size();
+    header.numPolygons_ = snapshot.polygons_.Size();
+    header.numVertices_ = snapshot.vertices_.Size();
+    header.numPieces_ = snapshot.pieces_.Size();
+    header.numPieceVertices_ = snapshot.pieceVertices_.Size();
+    header.numPrefabs_ = snapshot.prefabs_.Size();
+    header.numPrefabPlatforms_ = snapshot.prefabPlatforms_.Size();
+    header.numPrefabObjects_ = snapshot.prefabObjects_.Size();
+    header.numPrefabPolygons_ = snapshot.prefabPolygons_.Size();
+    header.numInstances_ = snapshot.instances_.Size();
+    header.journalGeneration_ = snapshot.journalGeneration_;
+    header.journalRecords_ = snapshot.journalRecords_;
+
+    bool ok = file.Write(&header, sizeof(header)) == sizeof(header) &&
+        WriteArray(file, snapshot.platforms_) &&
+        WriteArray(file, snapshot.objects_) &&
+        WriteArray(file, snapshot.polygons_) &&
+        WriteArray(file, snapshot.vertices_) &&
+        WriteArray(file, snapshot.pieces_) &&
+        WriteArray(file, snapshot.pieceVertices_) &&
+        WriteArray(file, snapshot.prefabs_) &&
+        WriteArray(file, snapshot.prefabPlatforms_) &&
+        WriteArray(file, snapshot.prefabObjects_) &&
+        WriteArray(file, snapshot.prefabPolygons_) &&
+        WriteArray(file, snapshot.instances_);
+    file.Close();
+    if(ok && CommitMapFile(fileName + ".tmp", fileName))
+        return true;
+    DiscardMapFile(fileName + ".tmp");
+    return false;
+}
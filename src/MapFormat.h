@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/Math/Vector2.h"
+#include "PolygonData.h"
+
+using namespace Urho3D;
+
+/// Binary map file version, bumped on any layout change.
+static const unsigned MAP_BINARY_VERSION = 5;
+/// Bumped whenever triangulation or convex merging change their output, so baked pieces in older maps are redone.
+static const unsigned MAP_BAKE_VERSION = 1;
+
+enum MapPlatformType
+{
+    MAP_PLATFORM = 0,
+    MAP_MIDLEPLATFORM,
+    MAP_MOVPLATFORM
+};
+
+struct MapPlatform
+{
+    Vector2 p1_;
+    Vector2 p2_;
+    unsigned type_;
+};
+
+struct MapObject
+{
+    Vector2 position_;
+    char type_[16];
+    char code_[16];
+};
+
+/// Outline and baked pieces of a polygon, as ranges into the snapshot arrays.
+struct MapPolygon
+{
+    unsigned firstVertex_;
+    unsigned numVertices_;
+    unsigned firstPiece_;
+    unsigned numPieces_;
+    /// PolygonBodyMode.
+    unsigned mode_;
+    /// GetOutlineHash of the outline the pieces were baked from, 0 when they are stale.
+    unsigned hash_;
+    /// Editor polygon id, journal records refer to the polygon by it. 0 in maps saved before ids were kept.
+    unsigned id_;
+};
+
+struct MapPiece
+{
+    unsigned firstVertex_;
+    unsigned numVertices_;
+};
+
+/// Platforms, objects and polygons relative to a prefab origin, as ranges into the prefab arrays of the snapshot.
+struct MapPrefab
+{
+    char name_[16];
+    unsigned firstPlatform_;
+    unsigned numPlatforms_;
+    unsigned firstObject_;
+    unsigned numObjects_;
+    unsigned firstPolygon_;
+    unsigned numPolygons_;
+};
+
+/// Placed copy of a prefab, its origin moved to offset_.
+struct MapInstance
+{
+    unsigned prefab_;
+    Vector2 offset_;
+};
+
+/// Whole map as flat arrays. This is what both file formats read and write, the editor converts it to and from
+/// its scene.
+struct MapSnapshot
+{
+    MapSnapshot() :
+        playerPosition_(Vector2::ZERO),
+        journalGeneration_(0),
+        journalRecords_(0)
+    {
+    }
+
+    void Clear();
+    /// Append a polygon with its outline, pieces and editor id. hash is 0 if the pieces don't match the outline.
+    void AddPolygon(const PODVector<Vector2>& outline, const ConvexPieces& pieces, unsigned mode, unsigned hash,
+        unsigned id);
+    /// Append a prefab polygon. Its outline and pieces share the arrays of the map polygons.
+    void AddPrefabPolygon(const PODVector<Vector2>& outline, const ConvexPieces& pieces, unsigned mode, unsigned hash);
+
+    Vector2 playerPosition_;
+    PODVector<MapPlatform> platforms_;
+    PODVector<MapObject> objects_;
+    PODVector<MapPolygon> polygons_;
+    /// Polygon outlines.
+    PODVector<Vector2> vertices_;
+    PODVector<MapPiece> pieces_;
+    PODVector<Vector2> pieceVertices_;
+    /// Prefab definitions and their contents. Instances only store an offset, so each prefab polygon is baked once
+    /// however often it is placed.
+    PODVector<MapPrefab> prefabs_;
+    PODVector<MapPlatform> prefabPlatforms_;
+    PODVector<MapObject> prefabObjects_;
+    PODVector<MapPolygon> prefabPolygons_;
+    PODVector<MapInstance> instances_;
+    /// Journal generation and number of its records already folded into this snapshot.
+    unsigned journalGeneration_;
+    unsigned journalRecords_;
+};
+
+/// Move a completely written temp file over fileName in one step, so a crash mid save never leaves a torn file.
+bool CommitMapFile(const String& tempName, const String& fileName);
+/// Delete the temp file of a save that failed, the old file stays as it was.
+void DiscardMapFile(const String& tempName);
+
+/// Hash of an outline and body mode, never 0. Pieces are only reused for an outline with the hash they were baked from.
+unsigned GetOutlineHash(const Vector2* vertices, unsigned count, unsigned mode);
+
+MapPlatformType GetMapPlatformType(const String& type);
+String GetMapPlatformTypeName(unsigned type);
+
+/// Read a map directory, from MapData.bin when it is newer than the JSON files. Safe to call from a worker thread.
+bool LoadMapSnapshot(Context* context, const String& dir, MapSnapshot& snapshot);
+/// Read MapNode.json and MapData.json from a directory.
+bool LoadMapJSON(Context* context, const String& dir, MapSnapshot& snapshot);
+/// Write MapNode.json and MapData.json to a directory. Safe to call from a worker thread.
+bool SaveMapJSON(Context* context, const String& dir, const MapSnapshot& snapshot);
+/// Map a binary map file and copy its arrays out, no per element parsing.
+bool LoadMapBinary(const String& fileName, MapSnapshot& snapshot);
+bool SaveMapBinary(Context* context, const String& fileName, const MapSnapshot& snapshot);
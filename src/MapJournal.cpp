@@ -0,0 +1,248 @@
+#include "MapJournal.h"
+#include "MapFormat.h"
+#include "Urho3D/IO/FileSystem.h"
+#include "Urho3D/IO/Log.h"
+
+#include <cstddef>
+#include <cstring>
+
+/// Start of a journal file, the records follow.
+struct MapJournalHeader
+{
+    char magic_[4];
+    unsigned version_;
+    unsigned generation_;
+};
+
+static unsigned RecordChecksum(const JournalRecord& record)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(&record);
+    unsigned crc = 0xffffffff;
+    for(unsigned i = 0; i < offsetof(JournalRecord, checksum_); i++)
+    {
+        crc ^= data[i];
+        for(unsigned j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static JournalRecord MakeRecord(JournalOp op, unsigned target, unsigned index, const Vector2& a, const Vector2& b)
+{
+    JournalRecord record;
+    record.op_ = op;
+    record.target_ = target;
+    record.index_ = index;
+    record.a_ = a;
+    record.b_ = b;
+    record.checksum_ = RecordChecksum(record);
+    return record;
+}
+
+MapJournal::MapJournal(Context* context) :
+    context_(context),
+    generation_(0),
+    rewrite_(false),
+    batching_(false)
+{
+}
+
+MapJournal::~MapJournal()
+{
+    Close();
+}
+
+void MapJournal::Load(const String& fileName, unsigned generation, unsigned numRecords, PODVector<JournalRecord>& replay)
+{
+    Close();
+    fileName_ = fileName;
+    records_.Clear();
+    replay.Clear();
+
+    unsigned fileGeneration = 0;
+    bool torn = false;
+    if(context_->GetSubsystem<FileSystem>()->FileExists(fileName))
+    {
+        File file(context_, fileName);
+        MapJournalHeader header;
+        if(file.Read(&header, sizeof(header)) == sizeof(header) && !memcmp(header.magic_, "PJNL", 4) &&
+            header.version_ == MAP_JOURNAL_VERSION)
+        {
+            fileGeneration = header.generation_;
+            JournalRecord record;
+            unsigned batchStart = 0;
+            unsigned batchEnd = 0;
+            while(!file.IsEof())
+            {
+                // A crash mid append leaves a short or garbled last record, everything before it is good
+                if(file.Read(&record, sizeof(record)) != sizeof(record) || record.checksum_ != RecordChecksum(record))
+                {
+                    torn = true;
+                    break;
+                }
+                if(record.op_ == JOURNAL_BATCH)
+                {
+                    batchStart = records_.Size();
+                    batchEnd = batchStart + 1 + record.index_;
+                }
+                records_.Push(record);
+            }
+            // Half a batch is an edit that never finished, none of it is replayed
+            if(records_.Size() < batchEnd)
+            {
+                records_.Resize(batchStart);
+                torn = true;
+            }
+        }
+        else
+            torn = true;
+    }
+
+    // Same generation: the snapshot holds the first numRecords. Next generation: it was compacted after the
+    // snapshot and holds nothing of it. Anything else was written against another snapshot
+    if(fileGeneration == generation && numRecords <= records_.Size())
+    {
+        generation_ = generation;
+        replay.Insert(replay.End(), records_.Begin() + numRecords, records_.End());
+    }
+    else if(fileGeneration == generation + 1)
+    {
+        generation_ = fileGeneration;
+        replay = records_;
+    }
+    else
+    {
+        if(!records_.Empty())
+            URHO3D_LOGWARNING(fileName + " doesn't match the loaded map, dropping " + String(records_.Size()) + " edits");
+        generation_ = generation + 1;
+        records_.Clear();
+        torn = true;
+    }
+    rewrite_ = torn;
+}
+
+void MapJournal::Drop(unsigned generation)
+{
+    generation_ = generation + 1;
+    records_.Clear();
+    rewrite_ = true;
+}
+
+bool MapJournal::Open()
+{
+    Close();
+    if(fileName_.Empty())
+        return false;
+    if((rewrite_ || !context_->GetSubsystem<FileSystem>()->FileExists(fileName_)) && !Rewrite())
+        return false;
+
+    file_ = new File(context_, fileName_, FILE_READWRITE);
+    if(!file_->IsOpen())
+    {
+        file_.Reset();
+        return false;
+    }
+    file_->Seek(file_->GetSize());
+    return true;
+}
+
+void MapJournal::Close()
+{
+    if(file_)
+        file_->Close();
+    file_.Reset();
+}
+
+void MapJournal::Append(JournalOp op, unsigned target, unsigned index, const Vector2& a, const Vector2& b)
+{
+    if(!file_)
+        return;
+
+    JournalRecord record = MakeRecord(op, target, index, a, b);
+    if(batching_)
+    {
+        batch_.Push(record);
+        return;
+    }
+    records_.Push(record);
+    Write(&record, 1);
+}
+
+void MapJournal::BeginBatch()
+{
+    batch_.Clear();
+    batching_ = true;
+}
+
+void MapJournal::EndBatch()
+{
+    batching_ = false;
+    if(!file_ || batch_.Empty())
+    {
+        batch_.Clear();
+        return;
+    }
+    if(batch_.Size() > 1)
+        batch_.Insert(0, MakeRecord(JOURNAL_BATCH, 0, batch_.Size(), Vector2::ZERO, Vector2::ZERO));
+    records_.Push(batch_);
+    Write(&batch_[0], batch_.Size());
+    batch_.Clear();
+}
+
+void MapJournal::Write(const JournalRecord* records, unsigned count)
+{
+    // Flushed right away so the edit survives the editor crashing, the next record can wait for the next edit
+    unsigned bytes = count * sizeof(JournalRecord);
+    if(file_->Write(records, bytes) != bytes)
+    {
+        URHO3D_LOGWARNING("Could not append to " + fileName_ + ", save with F5");
+        Close();
+        return;
+    }
+    file_->Flush();
+}
+
+bool MapJournal::Compact(unsigned generation, unsigned numRecords)
+{
+    if(fileName_.Empty() || generation != generation_ || numRecords > records_.Size())
+        return false;
+
+    bool wasOpen = IsOpen();
+    Close();
+    PODVector<JournalRecord> records = records_;
+    records_.Erase(0, numRecords);
+    generation_++;
+    bool ok = Rewrite();
+    if(!ok)
+    {
+        // The old file still has every record and stays valid against the new snapshot, keep appending to it
+        URHO3D_LOGWARNING("Could not compact " + fileName_);
+        records_ = records;
+        generation_--;
+    }
+    if(wasOpen && !Open())
+        URHO3D_LOGWARNING("Could not reopen " + fileName_ + ", save with F5");
+    return ok;
+}
+
+bool MapJournal::Rewrite()
+{
+    File file(context_, fileName_ + ".tmp", FILE_WRITE);
+    if(!file.IsOpen())
+        return false;
+
+    MapJournalHeader header;
+    memcpy(header.magic_, "PJNL", 4);
+    header.version_ = MAP_JOURNAL_VERSION;
+    header.generation_ = generation_;
+    unsigned bytes = records_.Size() * sizeof(JournalRecord);
+    bool ok = file.Write(&header, sizeof(header)) == sizeof(header) && (!bytes || file.Write(&records_[0], bytes) == bytes);
+    file.Close();
+    if(!ok || !CommitMapFile(fileName_ + ".tmp", fileName_))
+    {
+        DiscardMapFile(fileName_ + ".tmp");
+        return false;
+    }
+    rewrite_ = false;
+    return true;
+}
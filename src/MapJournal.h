@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Urho3D/Container/Ptr.h"
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/IO/File.h"
+#include "Urho3D/Math/Vector2.h"
+
+using namespace Urho3D;
+
+/// Journal file version, bumped on any layout or id change.
+static const unsigned MAP_JOURNAL_VERSION = 3;
+
+/// Editor operation stored in a journal record. Platforms, objects and prefab instances are referred to by their
+/// EntityRegistry reference, polygons by their id and prefabs by their index.
+enum JournalOp
+{
+    /// a_ and b_ are the corners, index_ the MapPlatformType.
+    JOURNAL_CREATEPLATFORM = 1,
+    /// a_ is the position, b_ the target.
+    JOURNAL_CREATEMOVPLATFORM,
+    /// Move the target of moving platform target_ to a_.
+    JOURNAL_PLATFORMTARGET,
+    JOURNAL_REMOVEPLATFORM,
+    JOURNAL_CREATEENEMY,
+    JOURNAL_REMOVEOBJECT,
+    JOURNAL_MOVEPLAYER,
+    /// Add an empty polygon with id target_.
+    JOURNAL_ADDPOLYGON,
+    JOURNAL_REMOVEPOLYGON,
+    /// Set the PolygonBodyMode of polygon target_ to index_.
+    JOURNAL_POLYGONMODE,
+    /// Insert a_ before vertex index_ of polygon target_.
+    JOURNAL_ADDVERTEX,
+    JOURNAL_MOVEVERTEX,
+    JOURNAL_REMOVEVERTEX,
+    /// Move platform target_ to corners a_ and b_.
+    JOURNAL_MOVEPLATFORM,
+    /// Move object target_ to a_.
+    JOURNAL_MOVEOBJECT,
+    /// The next index_ records are one edit. Load drops them all unless every one made it to the file.
+    JOURNAL_BATCH,
+    /// Add an empty prefab, index_ is its index in the prefab list. The records filling it follow in the same batch.
+    JOURNAL_ADDPREFAB,
+    /// Add a platform with corners a_ and b_ and MapPlatformType index_ to prefab target_.
+    JOURNAL_PREFABPLATFORM,
+    /// Add an object of EntityType index_ at a_ to prefab target_.
+    JOURNAL_PREFABOBJECT,
+    /// Start a polygon with PolygonBodyMode index_ in prefab target_.
+    JOURNAL_PREFABPOLYGON,
+    /// Append a_ to the last polygon of prefab target_.
+    JOURNAL_PREFABVERTEX,
+    /// Place prefab index_ with its origin at a_.
+    JOURNAL_STAMPPREFAB,
+    /// Move the origin of instance target_ to a_.
+    JOURNAL_MOVEINSTANCE,
+    JOURNAL_REMOVEINSTANCE
+};
+
+/// One edit, fixed size so a torn write can only ever cut off the last record.
+struct JournalRecord
+{
+    unsigned op_;
+    unsigned target_;
+    unsigned index_;
+    Vector2 a_;
+    Vector2 b_;
+    /// CRC-32 of the fields above.
+    unsigned checksum_;
+};
+
+/// Append-only log of the edits made since the last full save, kept next to MapData.json. A snapshot remembers
+/// the journal generation and how many of its records it already holds; compaction drops those and starts the
+/// next generation with the rest, so autosave costs one record per edit instead of a whole map.
+class MapJournal
+{
+public:
+    MapJournal(Context* context);
+    ~MapJournal();
+
+    /// Read a journal and return the records a snapshot at generation and numRecords doesn't hold yet. A journal
+    /// that doesn't belong to that snapshot is dropped, records after the first bad checksum too.
+    void Load(const String& fileName, unsigned generation, unsigned numRecords, PODVector<JournalRecord>& replay);
+    /// Forget the records Load returned when they can't be replayed on the snapshot at generation. Open then
+    /// rewrites the file empty.
+    void Drop(unsigned generation);
+    /// Start appending to the loaded journal. Rewrites the file first if Load dropped anything from it.
+    bool Open();
+    void Close();
+    bool IsOpen() const { return file_.NotNull(); }
+
+    /// Write one record and flush it. Does nothing while the journal is closed.
+    void Append(JournalOp op, unsigned target, unsigned index = 0, const Vector2& a = Vector2::ZERO, const Vector2& b = Vector2::ZERO);
+    /// Hold back appended records until EndBatch.
+    void BeginBatch();
+    /// Write the held back records behind a JOURNAL_BATCH record with one write and one flush.
+    void EndBatch();
+    /// Drop the first numRecords records, now held by a snapshot at generation, and start the next generation with
+    /// the rest. Does nothing if the journal moved on to another generation meanwhile.
+    bool Compact(unsigned generation, unsigned numRecords);
+
+    unsigned GetGeneration() const { return generation_; }
+    unsigned GetNumRecords() const { return records_.Size(); }
+
+private:
+    /// Write the header and records to a temp file and move it over the journal.
+    bool Rewrite();
+    /// Write records at the end of the file and flush. Closes the journal on failure.
+    void Write(const JournalRecord* records, unsigned count);
+
+    Context* context_;
+    String fileName_;
+    /// Open for appending.
+    SharedPtr<File> file_;
+    unsigned generation_;
+    /// Every valid record in the file, in order.
+    PODVector<JournalRecord> records_;
+    /// The file doesn't match records_ and must be rewritten before appending.
+    bool rewrite_;
+    /// Records appended since BeginBatch.
+    PODVector<JournalRecord> batch_;
+    bool batching_;
+};
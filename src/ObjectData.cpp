@@ -3,7 +3,11 @@
 #include "Urho3D/Scene/Node.h"
 
 
-ObjectData::ObjectData(Context* context): Component(context)
+ObjectData::ObjectData(Context* context): Component(context),
+    type(ENTITY_TYPE_ENEMY),
+    index(M_MAX_UNSIGNED),
+    handle(M_MAX_UNSIGNED),
+    resident(false)
 {
 
 }
@@ -16,6 +20,7 @@ void ObjectData::RegisterObject(Context* context)
 void ObjectData::SetPostion(Vector2 pos)
 {
     position = pos;
-    node_->SetPosition2D(position);
+    if(node_)
+        node_->SetPosition2D(position);
 }
 
@@ -5,6 +5,7 @@
 #include "Urho3D/Core/Context.h"
 #include "Urho3D/Math/Vector2.h"
 #include "Urho3D/Scene/Component.h"
+#include "EntityRegistry.h"
 
 using namespace Urho3D;
 
@@ -17,9 +18,16 @@ public:
     Vector2 position;
     Vector2 p1;
     Vector2 p2;
-    String type;
+    /// ENTITY_TYPE_ENEMY or ENTITY_TYPE_NPC.
+    EntityType type;
     String object_orientation;
     String Code;
+    /// Position in the EntityRegistry list of its type.
+    unsigned index;
+    /// Handle in the editor spatial index.
+    unsigned handle;
+    /// The object is in a resident chunk and attached to a node with its sprite.
+    bool resident;
     void SetPostion(Vector2 pos);
 private:
 
@@ -2,7 +2,12 @@
 #include "PlatformData.h"
 
 
-PlatformData::PlatformData(Context* context): Component(context)
+PlatformData::PlatformData(Context* context): Component(context),
+    type(ENTITY_TYPE_PLATFORM),
+    imagereference(0),
+    index(M_MAX_UNSIGNED),
+    handle(M_MAX_UNSIGNED),
+    resident(false)
 {
 
 }
@@ -5,6 +5,7 @@
 #include "Urho3D/Core/Context.h"
 #include "Urho3D/Math/Vector2.h"
 #include "Urho3D/Scene/Component.h"
+#include "EntityRegistry.h"
 
 using namespace Urho3D;
 
@@ -16,8 +17,15 @@ public:
     static void RegisterObject(Context* context);
     Vector2 p1;
     Vector2 p2;
-    String type;
+    /// ENTITY_TYPE_PLATFORM, ENTITY_TYPE_MIDLEPLATFORM or ENTITY_TYPE_MOVPLATFORM.
+    EntityType type;
     Node* imagereference;
+    /// Position in the EntityRegistry list of its type.
+    unsigned index;
+    /// Handle in the editor spatial index.
+    unsigned handle;
+    /// The platform is in a resident chunk and attached to a node with its bodies, sprite and reference node.
+    bool resident;
 private:
 
 };
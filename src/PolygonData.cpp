@@ -0,0 +1,73 @@
+#include "PolygonData.h"
+
+PolygonData::PolygonData(unsigned polygonid) :
+    id(polygonid),
+    mode(SOLIDBODY),
+    dirty(true),
+    overlayDirty(true),
+    resident(true)
+{
+}
+
+PolygonData::~PolygonData()
+{
+    ClearTriangles();
+    ReleasePhysics();
+    ReleaseOverlay();
+}
+
+void PolygonData::SetDirty()
+{
+    dirty = true;
+}
+
+void PolygonData::SetVertex(unsigned index, const Vector2& position)
+{
+    vertices[index] = position;
+    dirty = true;
+    overlayDirty = true;
+}
+
+void PolygonData::InsertVertex(unsigned index, const Vector2& position)
+{
+    vertices.Insert(index, position);
+    dirty = true;
+    overlayDirty = true;
+}
+
+void PolygonData::RemoveVertex(unsigned index)
+{
+    vertices.Erase(index);
+    dirty = true;
+    overlayDirty = true;
+}
+
+void PolygonData::SetTriangles(const PODVector<EarTriangle>& newtriangles, const ConvexPieces& newpieces)
+{
+    // Plain copies into the existing buffers, a rebake only allocates when the polygon grew
+    triangles = newtriangles;
+    pieces = newpieces;
+    ReleasePhysics();
+    dirty = false;
+    overlayDirty = true;
+}
+
+void PolygonData::ReleasePhysics()
+{
+    if(physicsNode)
+        physicsNode->Remove();
+    physicsNode.Reset();
+}
+
+void PolygonData::ReleaseOverlay()
+{
+    if(overlayNode)
+        overlayNode->Remove();
+    overlayNode.Reset();
+}
+
+void PolygonData::ClearTriangles()
+{
+    triangles.Clear();
+    pieces.Clear();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Urho3D/Container/Ptr.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Math/Vector2.h"
+#include "Urho3D/Scene/Node.h"
+#include "ConvexDecomposition.h"
+#include "PolygonTriangulator.h"
+
+using namespace Urho3D;
+
+enum PolygonBodyMode
+{
+    SOLIDBODY,
+    CHAINBODY
+};
+
+/// Editable polygon: its outline plus the triangles and physics body baked from it. Vertices are plain
+/// coordinates, the editor draws them in a retained overlay and picks them through its spatial index.
+class PolygonData
+{
+public:
+    PolygonData(unsigned polygonid = 0);
+    ~PolygonData();
+    /// Mark for re-triangulation and a new physics body on the next process.
+    void SetDirty();
+    /// Move one vertex.
+    void SetVertex(unsigned index, const Vector2& position);
+    /// Insert a vertex before index.
+    void InsertVertex(unsigned index, const Vector2& position);
+    /// Remove one vertex.
+    void RemoveVertex(unsigned index);
+    /// Replace the baked triangles and convex pieces. The old physics body is dropped, it no longer matches.
+    void SetTriangles(const PODVector<EarTriangle>& newtriangles, const ConvexPieces& newpieces);
+    /// Remove the physics body, if any.
+    void ReleasePhysics();
+    /// Remove the overlay geometry, if any.
+    void ReleaseOverlay();
+
+    /// PolygonRegistry id, journal records and snapshots refer to the polygon by it.
+    unsigned id;
+    PODVector<Vector2> vertices;
+    /// Spatial index handle of every vertex, kept parallel to vertices by the editor.
+    PODVector<unsigned> handles;
+    /// Baked triangles, contiguous. Rebakes reuse the buffer.
+    PODVector<EarTriangle> triangles;
+    /// Triangles merged into convex pieces, one physics fixture each.
+    ConvexPieces pieces;
+    WeakPtr<Node> physicsNode;
+    /// Solid polygons get one fixture per convex piece, chain polygons a single loop along the outline.
+    PolygonBodyMode mode;
+    bool dirty;
+    /// Outline, handles and pieces drawn by the editor overlay, rebuilt when overlayDirty is set.
+    WeakPtr<Node> overlayNode;
+    bool overlayDirty;
+    /// Overlaps a resident chunk. Bodies and overlays are only kept for resident polygons.
+    bool resident;
+private:
+    void ClearTriangles();
+};
@@ -0,0 +1,107 @@
+#include "PolygonOverlay.h"
+#include "Urho3D/Graphics/CustomGeometry.h"
+#include "Urho3D/Graphics/Technique.h"
+#include "Urho3D/Resource/ResourceCache.h"
+
+/// Geometry slots of an overlay.
+static const unsigned OVERLAY_OUTLINE = 0;
+static const unsigned OVERLAY_HANDLES = 1;
+static const unsigned OVERLAY_PIECES = 2;
+
+PolygonOverlay::PolygonOverlay(Context* context, Node* root, float handleSize) :
+    root_(root),
+    handleSize_(handleSize)
+{
+    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+    Technique* technique = cache->GetResource<Technique>("Techniques/NoTextureUnlitVCol.xml");
+
+    // Vertex colours carry the line colour, the selected material tints the handles
+    lineMaterial_ = new Material(context);
+    lineMaterial_->SetTechnique(0, technique);
+    lineMaterial_->SetCullMode(CULL_NONE);
+
+    selectedMaterial_ = lineMaterial_->Clone();
+    selectedMaterial_->SetShaderParameter("MatDiffColor", Color::YELLOW);
+}
+
+void PolygonOverlay::Update(PolygonData* polygon, bool selected)
+{
+    if(!polygon->overlayDirty || !root_)
+        return;
+    Rebuild(polygon, selected);
+    polygon->overlayDirty = false;
+}
+
+void PolygonOverlay::SetSelected(PolygonData* polygon, bool selected)
+{
+    if(!polygon || !polygon->overlayNode)
+        return;
+    CustomGeometry* geometry = polygon->overlayNode->GetComponent<CustomGeometry>();
+    geometry->SetMaterial(OVERLAY_HANDLES, selected ? selectedMaterial_ : lineMaterial_);
+}
+
+void PolygonOverlay::Rebuild(PolygonData* polygon, bool selected)
+{
+    CustomGeometry* geometry;
+    if(!polygon->overlayNode)
+    {
+        polygon->overlayNode = root_->CreateChild("PolygonOverlay");
+        geometry = polygon->overlayNode->CreateComponent<CustomGeometry>();
+        geometry->SetNumGeometries(3);
+        geometry->SetMaterial(lineMaterial_);
+        geometry->SetMaterial(OVERLAY_HANDLES, selected ? selectedMaterial_ : lineMaterial_);
+    }
+    else
+        geometry = polygon->overlayNode->GetComponent<CustomGeometry>();
+
+    const PODVector<Vector2>& vertices = polygon->vertices;
+
+    geometry->BeginGeometry(OVERLAY_OUTLINE, LINE_LIST);
+    for(unsigned i = 0; i < vertices.Size(); i++)
+    {
+        const Vector2& p1 = vertices[i];
+        const Vector2& p2 = vertices[(i + 1) % vertices.Size()];
+        geometry->DefineVertex(Vector3(p1.x_, p1.y_, 0));
+        geometry->DefineColor(Color::RED);
+        geometry->DefineVertex(Vector3(p2.x_, p2.y_, 0));
+        geometry->DefineColor(Color::RED);
+    }
+
+    geometry->BeginGeometry(OVERLAY_HANDLES, LINE_LIST);
+    for(unsigned i = 0; i < vertices.Size(); i++)
+    {
+        const Vector2& v = vertices[i];
+        Vector3 corners[4] = {
+            Vector3(v.x_ - handleSize_, v.y_ - handleSize_, 0),
+            Vector3(v.x_ + handleSize_, v.y_ - handleSize_, 0),
+            Vector3(v.x_ + handleSize_, v.y_ + handleSize_, 0),
+            Vector3(v.x_ - handleSize_, v.y_ + handleSize_, 0)
+        };
+        for(unsigned j = 0; j < 4; j++)
+        {
+            geometry->DefineVertex(corners[j]);
+            geometry->DefineColor(Color::WHITE);
+            geometry->DefineVertex(corners[(j + 1) % 4]);
+            geometry->DefineColor(Color::WHITE);
+        }
+    }
+
+    geometry->BeginGeometry(OVERLAY_PIECES, LINE_LIST);
+    const ConvexPieces& pieces = polygon->pieces;
+    for(unsigned i = 0; i < pieces.Size(); i++)
+    {
+        const Vector2* piece = pieces.GetVertices(i);
+        unsigned count = pieces.GetNumVertices(i);
+        for(unsigned k = 0; k < count; k++)
+        {
+            const Vector2& p1 = piece[k];
+            const Vector2& p2 = piece[(k + 1) % count];
+            geometry->DefineVertex(Vector3(p1.x_, p1.y_, 0));
+            geometry->DefineColor(Color::GREEN);
+            geometry->DefineVertex(Vector3(p2.x_, p2.y_, 0));
+            geometry->DefineColor(Color::GREEN);
+        }
+    }
+
+    geometry->Commit();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Urho3D/Container/Ptr.h"
+#include "Urho3D/Graphics/Material.h"
+#include "Urho3D/Scene/Node.h"
+#include "PolygonData.h"
+
+using namespace Urho3D;
+
+/// Draws polygon outlines, vertex handles and convex pieces as one CustomGeometry per polygon. Geometry is only
+/// rebuilt for polygons flagged overlayDirty; the octree culls it to the view like any other drawable.
+class PolygonOverlay
+{
+public:
+    PolygonOverlay(Context* context, Node* root, float handleSize);
+
+    /// Rebuild the geometry of a polygon if it changed since the last call. selected picks the handle material of
+    /// a newly created overlay.
+    void Update(PolygonData* polygon, bool selected);
+    /// Switch the handle material of a polygon without touching its geometry.
+    void SetSelected(PolygonData* polygon, bool selected);
+
+private:
+    void Rebuild(PolygonData* polygon, bool selected);
+
+    WeakPtr<Node> root_;
+    /// Half size of the vertex handle squares.
+    float handleSize_;
+    SharedPtr<Material> lineMaterial_;
+    SharedPtr<Material> selectedMaterial_;
+};
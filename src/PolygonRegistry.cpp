@@ -0,0 +1,105 @@
+#include "PolygonRegistry.h"
+#include "PolygonData.h"
+#include "Urho3D/Math/MathDefs.h"
+
+static const unsigned SLOT_MASK = (1 << POLYGON_SLOT_BITS) - 1;
+static const unsigned MAX_GENERATION = M_MAX_UNSIGNED >> POLYGON_SLOT_BITS;
+
+unsigned PolygonRegistry::Add(PolygonData* polygon)
+{
+    unsigned slot;
+    if(!freeSlots_.Empty())
+    {
+        slot = freeSlots_.Back();
+        freeSlots_.Pop();
+    }
+    else
+    {
+        slot = slots_.Size();
+        Grow(slot);
+        freeSlots_.Pop();
+    }
+    Place(slot, polygon);
+    return polygon->id;
+}
+
+bool PolygonRegistry::Insert(unsigned id, PolygonData* polygon)
+{
+    unsigned slot = id & SLOT_MASK;
+    unsigned generation = id >> POLYGON_SLOT_BITS;
+    if(!generation)
+        return false;
+    if(slot >= slots_.Size())
+        Grow(slot);
+    else if(slots_[slot].polygon_ != M_MAX_UNSIGNED)
+        return false;
+
+    // Only snapshot and journal loads pick their slot, the free list is short then
+    PODVector<unsigned>::Iterator i = freeSlots_.Find(slot);
+    *i = freeSlots_.Back();
+    freeSlots_.Pop();
+    slots_[slot].generation_ = generation;
+    Place(slot, polygon);
+    return true;
+}
+
+PolygonData* PolygonRegistry::Remove(unsigned id)
+{
+    PolygonData* polygon = Get(id);
+    if(!polygon)
+        return 0;
+
+    Slot& slot = slots_[id & SLOT_MASK];
+    unsigned last = polygons_.Size() - 1;
+    polygons_[slot.polygon_] = polygons_[last];
+    polygonSlots_[slot.polygon_] = polygonSlots_[last];
+    slots_[polygonSlots_[last]].polygon_ = slot.polygon_;
+    polygons_.Pop();
+    polygonSlots_.Pop();
+
+    slot.polygon_ = M_MAX_UNSIGNED;
+    slot.generation_ = slot.generation_ < MAX_GENERATION ? slot.generation_ + 1 : 1;
+    freeSlots_.Push(id & SLOT_MASK);
+    return polygon;
+}
+
+void PolygonRegistry::Clear()
+{
+    slots_.Clear();
+    freeSlots_.Clear();
+    polygons_.Clear();
+    polygonSlots_.Clear();
+}
+
+PolygonData* PolygonRegistry::Get(unsigned id) const
+{
+    unsigned slot = id & SLOT_MASK;
+    if(slot >= slots_.Size() || slots_[slot].generation_ != id >> POLYGON_SLOT_BITS || slots_[slot].polygon_ == M_MAX_UNSIGNED)
+        return 0;
+    return polygons_[slots_[slot].polygon_];
+}
+
+String PolygonRegistry::GetName(unsigned id)
+{
+    return "Polygon" + String(id & SLOT_MASK);
+}
+
+void PolygonRegistry::Grow(unsigned index)
+{
+    Slot slot;
+    slot.generation_ = 1;
+    slot.polygon_ = M_MAX_UNSIGNED;
+    while(slots_.Size() <= index)
+    {
+        freeSlots_.Push(slots_.Size());
+        slots_.Push(slot);
+    }
+}
+
+void PolygonRegistry::Place(unsigned slot, PolygonData* polygon)
+{
+    slots_[slot].polygon_ = polygons_.Size();
+    polygons_.Push(polygon);
+    polygonSlots_.Push(slot);
+    polygon->id = slots_[slot].generation_ << POLYGON_SLOT_BITS | slot;
+}
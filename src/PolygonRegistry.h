@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+
+using namespace Urho3D;
+
+class PolygonData;
+
+/// Slot map of the editor polygons. An id is a slot index in the low POLYGON_SLOT_BITS and the slot generation
+/// above, so an id of a removed polygon never finds the one reusing its slot. 0 is never a valid id.
+static const unsigned POLYGON_SLOT_BITS = 20;
+
+class PolygonRegistry
+{
+public:
+    /// Register a polygon under a new id and store the id in it.
+    unsigned Add(PolygonData* polygon);
+    /// Register a polygon under a given id, one read back from a snapshot or the journal. Returns false if the id
+    /// is malformed or its slot is taken.
+    bool Insert(unsigned id, PolygonData* polygon);
+    /// Unregister a polygon, its id goes stale. Returns the polygon, null for a stale id.
+    PolygonData* Remove(unsigned id);
+    /// Forget every polygon without deleting them.
+    void Clear();
+
+    /// Polygon with an id, null if the id is stale.
+    PolygonData* Get(unsigned id) const;
+    /// Live polygons, contiguous. Removing one moves the last one into its place.
+    const PODVector<PolygonData*>& GetPolygons() const { return polygons_; }
+    unsigned Size() const { return polygons_.Size(); }
+
+    /// Name shown in the polygon list. Nothing else refers to polygons by name.
+    static String GetName(unsigned id);
+
+private:
+    struct Slot
+    {
+        unsigned generation_;
+        /// Index in polygons_, M_MAX_UNSIGNED while free.
+        unsigned polygon_;
+    };
+
+    /// Add empty slots up to and including index.
+    void Grow(unsigned index);
+    void Place(unsigned slot, PolygonData* polygon);
+
+    PODVector<Slot> slots_;
+    PODVector<unsigned> freeSlots_;
+    PODVector<PolygonData*> polygons_;
+    /// Slot of each entry in polygons_.
+    PODVector<unsigned> polygonSlots_;
+};
@@ -0,0 +1,261 @@
+#include "PolygonTriangulator.h"
+#include "Urho3D/Math/MathDefs.h"
+
+PolygonTriangulator::PolygonTriangulator() :
+    points_(0),
+    reflexCount_(0),
+    remaining_(0),
+    orientation_(1.0f),
+    epsilon_(0.0f),
+    gridWidth_(0),
+    gridHeight_(0)
+{
+}
+
+bool PolygonTriangulator::Triangulate(const PODVector<Vector2>& vertices, PODVector<EarTriangle>& triangles)
+{
+    unsigned n = vertices.Size();
+    if(n < 3)
+        return false;
+
+    points_ = &vertices[0];
+    next_.Resize(n);
+    prev_.Resize(n);
+    reflex_.Resize(n);
+    removed_.Resize(n);
+
+    float area = 0.0f;
+    Vector2 minPoint = vertices[0];
+    Vector2 maxPoint = vertices[0];
+    for(unsigned i = 0; i < n; i++)
+    {
+        next_[i] = i + 1 < n ? i + 1 : 0;
+        prev_[i] = i > 0 ? i - 1 : n - 1;
+        removed_[i] = 0;
+
+        const Vector2& p = vertices[i];
+        const Vector2& q = vertices[next_[i]];
+        area += p.x_ * q.y_ - q.x_ * p.y_;
+        minPoint.x_ = Min(minPoint.x_, p.x_);
+        minPoint.y_ = Min(minPoint.y_, p.y_);
+        maxPoint.x_ = Max(maxPoint.x_, p.x_);
+        maxPoint.y_ = Max(maxPoint.y_, p.y_);
+    }
+    if(area == 0.0f)
+        return false;
+
+    orientation_ = area > 0.0f ? 1.0f : -1.0f;
+    float extent = Max(maxPoint.x_ - minPoint.x_, maxPoint.y_ - minPoint.y_);
+    epsilon_ = Max(extent * extent * 1e-7f, 1e-9f);
+    gridMin_ = minPoint;
+
+    reflexCount_ = 0;
+    for(unsigned i = 0; i < n; i++)
+    {
+        reflex_[i] = Corner(prev_[i], i, next_[i]) <= epsilon_;
+        if(reflex_[i])
+            reflexCount_++;
+    }
+    remaining_ = n;
+    BuildGrid();
+
+    triangles.Reserve(triangles.Size() + n - 2);
+
+    bool valid = true;
+    unsigned ear = 0;
+    unsigned stop = ear;
+    while(remaining_ > 3)
+    {
+        unsigned next = next_[ear];
+        if(!reflex_[ear] && IsEar(ear))
+        {
+            ClipEar(ear, triangles);
+            ear = next_[next];
+            stop = ear;
+            continue;
+        }
+
+        ear = next;
+        if(ear != stop)
+            continue;
+
+        // A full turn without ears. Drop a collinear vertex first, the outline may only be degenerate there.
+        unsigned v = ear;
+        bool dropped = false;
+        do
+        {
+            if(Abs(Corner(prev_[v], v, next_[v])) <= epsilon_)
+            {
+                unsigned p = prev_[v];
+                unsigned q = next_[v];
+                if(reflex_[v])
+                    reflexCount_--;
+                Unlink(v);
+                UpdateReflex(p);
+                UpdateReflex(q);
+                ear = q;
+                dropped = true;
+                break;
+            }
+            v = next_[v];
+        }
+        while(v != stop);
+
+        // Self touching or self intersecting outline, force the first convex corner out.
+        if(!dropped)
+        {
+            valid = false;
+            v = ear;
+            while(reflex_[v] && next_[v] != ear)
+                v = next_[v];
+            if(reflex_[v])
+            {
+                reflex_[v] = 0;
+                reflexCount_--;
+            }
+            unsigned q = next_[v];
+            ClipEar(v, triangles);
+            ear = q;
+        }
+        stop = ear;
+    }
+
+    if(remaining_ == 3 && Abs(Corner(prev_[ear], ear, next_[ear])) > epsilon_)
+        triangles.Push(EarTriangle(points_[prev_[ear]], points_[ear], points_[next_[ear]]));
+
+    points_ = 0;
+    return valid;
+}
+
+float PolygonTriangulator::Corner(unsigned a, unsigned b, unsigned c) const
+{
+    const Vector2& p1 = points_[a];
+    const Vector2& p2 = points_[b];
+    const Vector2& p3 = points_[c];
+    return ((p2.x_ - p1.x_) * (p3.y_ - p2.y_) - (p2.y_ - p1.y_) * (p3.x_ - p2.x_)) * orientation_;
+}
+
+bool PolygonTriangulator::IsEar(unsigned i) const
+{
+    unsigned a = prev_[i];
+    unsigned c = next_[i];
+    if(Corner(a, i, c) <= epsilon_)
+        return false;
+    if(!reflexCount_)
+        return true;
+
+    const Vector2& pa = points_[a];
+    const Vector2& pb = points_[i];
+    const Vector2& pc = points_[c];
+
+    int minX, minY, maxX, maxY;
+    GetCell(Vector2(Min(pa.x_, Min(pb.x_, pc.x_)), Min(pa.y_, Min(pb.y_, pc.y_))), minX, minY);
+    GetCell(Vector2(Max(pa.x_, Max(pb.x_, pc.x_)), Max(pa.y_, Max(pb.y_, pc.y_))), maxX, maxY);
+
+    for(int y = minY; y <= maxY; y++)
+    {
+        for(int x = minX; x <= maxX; x++)
+        {
+            unsigned cell = y * gridWidth_ + x;
+            for(unsigned k = cellStart_[cell]; k < cellStart_[cell + 1]; k++)
+            {
+                unsigned r = cellItems_[k];
+                if(!reflex_[r] || removed_[r] || r == a || r == i || r == c)
+                    continue;
+                const Vector2& pt = points_[r];
+                if(pt == pa || pt == pb || pt == pc)
+                    continue;
+                if(PointInTriangle(pt, pa, pb, pc))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+void PolygonTriangulator::ClipEar(unsigned i, PODVector<EarTriangle>& triangles)
+{
+    unsigned a = prev_[i];
+    unsigned c = next_[i];
+    triangles.Push(EarTriangle(points_[a], points_[i], points_[c]));
+    Unlink(i);
+    UpdateReflex(a);
+    UpdateReflex(c);
+}
+
+void PolygonTriangulator::Unlink(unsigned i)
+{
+    next_[prev_[i]] = next_[i];
+    prev_[next_[i]] = prev_[i];
+    removed_[i] = 1;
+    remaining_--;
+}
+
+void PolygonTriangulator::UpdateReflex(unsigned i)
+{
+    if(reflex_[i] && Corner(prev_[i], i, next_[i]) > epsilon_)
+    {
+        reflex_[i] = 0;
+        reflexCount_--;
+    }
+}
+
+void PolygonTriangulator::BuildGrid()
+{
+    Vector2 gridMax = gridMin_;
+    for(unsigned i = 0; i < next_.Size(); i++)
+    {
+        gridMax.x_ = Max(gridMax.x_, points_[i].x_);
+        gridMax.y_ = Max(gridMax.y_, points_[i].y_);
+    }
+
+    // Roughly one reflex vertex per cell, cells kept close to square for long thin outlines
+    float width = Max(gridMax.x_ - gridMin_.x_, M_EPSILON);
+    float height = Max(gridMax.y_ - gridMin_.y_, M_EPSILON);
+    float count = (float)Max(reflexCount_, 1U);
+    gridWidth_ = Clamp((int)Sqrt(count * width / height), 1, 1024);
+    gridHeight_ = Clamp((int)(count / gridWidth_), 1, 1024);
+    cellSize_.x_ = Max((gridMax.x_ - gridMin_.x_) / gridWidth_, M_EPSILON);
+    cellSize_.y_ = Max((gridMax.y_ - gridMin_.y_) / gridHeight_, M_EPSILON);
+
+    unsigned numCells = gridWidth_ * gridHeight_;
+    cellStart_.Resize(numCells + 1);
+    for(unsigned i = 0; i <= numCells; i++)
+        cellStart_[i] = 0;
+
+    // Count, prefix sum, then fill so every cell is a contiguous run in cellItems_
+    int x, y;
+    for(unsigned i = 0; i < reflex_.Size(); i++)
+    {
+        if(!reflex_[i])
+            continue;
+        GetCell(points_[i], x, y);
+        cellStart_[y * gridWidth_ + x + 1]++;
+    }
+    for(unsigned i = 0; i < numCells; i++)
+        cellStart_[i + 1] += cellStart_[i];
+
+    cellItems_.Resize(reflexCount_);
+    PODVector<unsigned> fill(cellStart_);
+    for(unsigned i = 0; i < reflex_.Size(); i++)
+    {
+        if(!reflex_[i])
+            continue;
+        GetCell(points_[i], x, y);
+        cellItems_[fill[y * gridWidth_ + x]++] = i;
+    }
+}
+
+void PolygonTriangulator::GetCell(const Vector2& point, int& x, int& y) const
+{
+    x = Clamp((int)((point.x_ - gridMin_.x_) / cellSize_.x_), 0, gridWidth_ - 1);
+    y = Clamp((int)((point.y_ - gridMin_.y_) / cellSize_.y_), 0, gridHeight_ - 1);
+}
+
+bool PolygonTriangulator::PointInTriangle(const Vector2& pt, const Vector2& a, const Vector2& b, const Vector2& c) const
+{
+    float d1 = ((b.x_ - a.x_) * (pt.y_ - a.y_) - (b.y_ - a.y_) * (pt.x_ - a.x_)) * orientation_;
+    float d2 = ((c.x_ - b.x_) * (pt.y_ - b.y_) - (c.y_ - b.y_) * (pt.x_ - b.x_)) * orientation_;
+    float d3 = ((a.x_ - c.x_) * (pt.y_ - c.y_) - (a.y_ - c.y_) * (pt.x_ - c.x_)) * orientation_;
+    return d1 >= -epsilon_ && d2 >= -epsilon_ && d3 >= -epsilon_;
+}
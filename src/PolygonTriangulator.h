@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Math/Vector2.h"
+
+using namespace Urho3D;
+
+struct EarTriangle
+{
+    EarTriangle()
+    {
+    }
+    EarTriangle(Vector2 p1,Vector2 p2,Vector2 p3)
+    {
+        p1_ = p1;
+        p2_ = p2;
+        p3_ = p3;
+    }
+    Vector2 p1_,p2_,p3_;
+};
+
+/// Ear clipping triangulator. Works on a circular linked list of vertex indices, keeps the reflex vertices in a
+/// uniform grid and only tests those for containment, so neighbours are O(1) and ear tests stay local.
+class PolygonTriangulator
+{
+public:
+    PolygonTriangulator();
+
+    /// Triangulate a simple polygon of any winding, appending the triangles with the same winding as the outline.
+    /// Returns false if the outline was degenerate and had to be clipped without a valid ear.
+    bool Triangulate(const PODVector<Vector2>& vertices, PODVector<EarTriangle>& triangles);
+
+private:
+    /// Signed area of the corner a-b-c, positive when it turns like the polygon.
+    float Corner(unsigned a, unsigned b, unsigned c) const;
+    /// Return whether vertex i can be clipped as an ear.
+    bool IsEar(unsigned i) const;
+    /// Emit the ear at i and unlink it from the ring.
+    void ClipEar(unsigned i, PODVector<EarTriangle>& triangles);
+    /// Unlink i from the ring without emitting a triangle.
+    void Unlink(unsigned i);
+    /// Refresh the reflex flag of i after one of its neighbours changed.
+    void UpdateReflex(unsigned i);
+    /// Bucket the reflex vertices into the containment grid.
+    void BuildGrid();
+    /// Grid cell of a point, clamped to the grid.
+    void GetCell(const Vector2& point, int& x, int& y) const;
+    /// Return whether pt is inside or on the border of the triangle a-b-c.
+    bool PointInTriangle(const Vector2& pt, const Vector2& a, const Vector2& b, const Vector2& c) const;
+
+    /// Outline being triangulated.
+    const Vector2* points_;
+    /// Circular linked list of the remaining vertices.
+    PODVector<unsigned> next_;
+    PODVector<unsigned> prev_;
+    /// Reflex flag per vertex. Vertices only ever go from reflex to convex while clipping.
+    PODVector<unsigned char> reflex_;
+    PODVector<unsigned char> removed_;
+    unsigned reflexCount_;
+    unsigned remaining_;
+    /// +1 for counter clockwise outlines, -1 for clockwise.
+    float orientation_;
+    /// Tolerance for collinear corners, scaled to the polygon extents.
+    float epsilon_;
+
+    /// Containment grid, reflex vertex indices stored per cell.
+    Vector2 gridMin_;
+    Vector2 cellSize_;
+    int gridWidth_;
+    int gridHeight_;
+    PODVector<unsigned> cellStart_;
+    PODVector<unsigned> cellItems_;
+};
@@ -0,0 +1,37 @@
+#include "PrefabData.h"
+#include "PolygonData.h"
+#include "PolygonTriangulator.h"
+#include "Urho3D/IO/Log.h"
+
+void PrefabDefinition::Bake()
+{
+    PolygonTriangulator triangulator;
+    PODVector<EarTriangle> triangles;
+    for(unsigned i = 0; i < polygons_.Size(); i++)
+    {
+        PrefabPolygon& polygon = polygons_[i];
+        polygon.pieces_.Clear();
+        if(polygon.mode_ == CHAINBODY)
+            continue;
+        triangles.Clear();
+        if(!triangulator.Triangulate(polygon.outline_, triangles))
+            URHO3D_LOGWARNING(name_ + " polygon with " + String(polygon.outline_.Size()) + " vertices is degenerate or self intersecting");
+        MergeConvexPieces(triangles, polygon.pieces_);
+    }
+    baked_ = true;
+}
+
+PrefabInstance::PrefabInstance(Context* context): Component(context),
+    prefab(0),
+    offset(Vector2::ZERO),
+    index(M_MAX_UNSIGNED),
+    handle(M_MAX_UNSIGNED),
+    resident(false)
+{
+
+}
+
+void PrefabInstance::RegisterObject(Context* context)
+{
+	context->RegisterFactory<PrefabInstance>();
+}
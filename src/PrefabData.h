@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/Math/Vector2.h"
+#include "Urho3D/Scene/Component.h"
+#include "ConvexDecomposition.h"
+#include "MapFormat.h"
+
+using namespace Urho3D;
+
+/// Polygon of a prefab, relative to the prefab origin.
+struct PrefabPolygon
+{
+    PODVector<Vector2> outline_;
+    /// PolygonBodyMode.
+    unsigned mode_;
+    /// Baked from the outline, every instance builds its fixtures from the same pieces.
+    ConvexPieces pieces_;
+};
+
+/// Platforms, objects and polygons captured from a region of the map, relative to its origin. Instances only keep
+/// an offset, the contents and their baked pieces are shared by all of them.
+struct PrefabDefinition
+{
+    PrefabDefinition() :
+        baked_(false)
+    {
+    }
+
+    /// Triangulate the solid polygons and merge them into convex pieces.
+    void Bake();
+
+    String name_;
+    PODVector<MapPlatform> platforms_;
+    /// Objects, type_ is their EntityType name.
+    PODVector<MapObject> objects_;
+    Vector<PrefabPolygon> polygons_;
+    /// The pieces match the outlines. Cleared whenever a polygon is added or grows.
+    bool baked_;
+};
+
+/// Placed copy of a prefab. A resident instance is attached to a node at the offset, with the bodies and sprites as
+/// its children.
+class PrefabInstance : public Component
+{
+    URHO3D_OBJECT(PrefabInstance, Component);
+public:
+    PrefabInstance(Context* context);
+    static void RegisterObject(Context* context);
+    /// Index of the definition in the editor prefab list.
+    unsigned prefab;
+    /// Position of the prefab origin.
+    Vector2 offset;
+    /// Position in the EntityRegistry instance list.
+    unsigned index;
+    /// Handle in the editor spatial index.
+    unsigned handle;
+    /// The instance is in a resident chunk and attached to its node.
+    bool resident;
+};
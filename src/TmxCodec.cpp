@@ -0,0 +1,767 @@
+#include "TmxCodec.h"
+#include "MapFormat.h"
+#include "Urho3D/IO/File.h"
+#include "Urho3D/IO/Log.h"
+#include "Urho3D/Math/MathDefs.h"
+#include "Urho3D/Resource/XMLFile.h"
+
+#include <cstring>
+
+static const char* encodingNames[] = { "xml", "csv", "base64", "zlib" };
+
+/// Deflate length and distance code tables, RFC 1951 section 3.2.5.
+static const unsigned short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+    67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+    5, 5, 5, 5, 0 };
+static const unsigned short distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+    10, 11, 11, 12, 12, 13, 13 };
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+bool ParseTmxEncoding(const String& name, TmxEncoding& encoding)
+{
+    for(unsigned i = 0; i < sizeof(encodingNames) / sizeof(encodingNames[0]); i++)
+    {
+        if(name == encodingNames[i])
+        {
+            encoding = (TmxEncoding)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetTmxEncodingName(TmxEncoding encoding)
+{
+    return encodingNames[encoding];
+}
+
+static void EncodeBase64Data(const unsigned char* data, unsigned size, String& dest)
+{
+    unsigned start = dest.Length();
+    dest.Resize(start + (size + 2) / 3 * 4);
+    char* out = &dest[start];
+    unsigned i = 0;
+    for(; i + 3 <= size; i += 3)
+    {
+        unsigned value = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+        *out++ = base64Chars[value >> 18];
+        *out++ = base64Chars[(value >> 12) & 63];
+        *out++ = base64Chars[(value >> 6) & 63];
+        *out++ = base64Chars[value & 63];
+    }
+    if(i < size)
+    {
+        unsigned value = data[i] << 16 | (i + 1 < size ? data[i + 1] << 8 : 0);
+        *out++ = base64Chars[value >> 18];
+        *out++ = base64Chars[(value >> 12) & 63];
+        *out++ = i + 1 < size ? base64Chars[(value >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+}
+
+static bool DecodeBase64Data(const char* text, unsigned length, PODVector<unsigned char>& dest)
+{
+    dest.Clear();
+    dest.Reserve(length / 4 * 3);
+    unsigned value = 0;
+    unsigned count = 0;
+    for(unsigned i = 0; i < length; i++)
+    {
+        char c = text[i];
+        unsigned digit;
+        if(c >= 'A' && c <= 'Z')
+            digit = c - 'A';
+        else if(c >= 'a' && c <= 'z')
+            digit = c - 'a' + 26;
+        else if(c >= '0' && c <= '9')
+            digit = c - '0' + 52;
+        else if(c == '+')
+            digit = 62;
+        else if(c == '/')
+            digit = 63;
+        else if(c == '=')
+            break;
+        else if(c == ' ' || c == '\n' || c == '\r' || c == '\t')
+            continue;
+        else
+            return false;
+
+        value = value << 6 | digit;
+        if(++count == 4)
+        {
+            dest.Push((unsigned char)(value >> 16));
+            dest.Push((unsigned char)(value >> 8));
+            dest.Push((unsigned char)value);
+            value = 0;
+            count = 0;
+        }
+    }
+    if(count == 1)
+        return false;
+    if(count == 2)
+        dest.Push((unsigned char)(value >> 4));
+    else if(count == 3)
+    {
+        dest.Push((unsigned char)(value >> 10));
+        dest.Push((unsigned char)(value >> 2));
+    }
+    return true;
+}
+
+static bool DecodeCSV(const char* text, const char* end, unsigned* gids, unsigned count)
+{
+    unsigned i = 0;
+    while(text < end)
+    {
+        char c = *text;
+        if(c >= '0' && c <= '9')
+        {
+            if(i == count)
+                return false;
+            unsigned value = 0;
+            while(text < end && *text >= '0' && *text <= '9')
+                value = value * 10 + (*text++ - '0');
+            gids[i++] = value;
+        }
+        else if(c == ',' || c == ' ' || c == '\n' || c == '\r' || c == '\t')
+            text++;
+        else
+            return false;
+    }
+    return i == count;
+}
+
+/// Rows of width gids, one per line the way Tiled writes them.
+static void EncodeCSV(const PODVector<unsigned>& gids, unsigned width, String& dest)
+{
+    dest.Reserve(dest.Length() + gids.Size() * 4 + 2);
+    dest += '\n';
+    char digits[12];
+    for(unsigned i = 0; i < gids.Size(); i++)
+    {
+        char* first = digits + sizeof(digits);
+        unsigned value = gids[i];
+        do
+        {
+            *--first = (char)('0' + value % 10);
+            value /= 10;
+        }
+        while(value);
+        dest.Append(first, (unsigned)(digits + sizeof(digits) - first));
+        if(i + 1 < gids.Size())
+            dest += ',';
+        if(width && (i + 1) % width == 0)
+            dest += '\n';
+    }
+    if(!width || gids.Size() % width)
+        dest += '\n';
+}
+
+bool DecodeTileData(const XMLElement& data, unsigned count, PODVector<unsigned>& gids)
+{
+    if(!data)
+        return false;
+    gids.Resize(count);
+
+    String encoding = data.GetAttribute("encoding");
+    if(encoding.Empty() || encoding == "xml")
+    {
+        unsigned i = 0;
+        for(XMLElement tile = data.GetChild("tile"); tile; tile = tile.GetNext("tile"))
+        {
+            if(i == count)
+                return false;
+            gids[i++] = tile.GetUInt("gid");
+        }
+        return i == count;
+    }
+
+    String value = data.GetValue();
+    if(encoding == "csv")
+        return count ? DecodeCSV(value.CString(), value.CString() + value.Length(), &gids[0], count) : true;
+    if(encoding != "base64")
+        return false;
+
+    PODVector<unsigned char> bytes;
+    if(!DecodeBase64Data(value.CString(), value.Length(), bytes))
+        return false;
+    String compression = data.GetAttribute("compression");
+    if(compression == "zlib" || compression == "gzip")
+    {
+        PODVector<unsigned char> raw;
+        if(bytes.Empty() || !InflateZlib(&bytes[0], bytes.Size(), raw, count * 4, compression == "gzip"))
+            return false;
+        bytes.Swap(raw);
+    }
+    else if(!compression.Empty())
+        return false;
+
+    if(bytes.Size() != count * 4)
+        return false;
+    for(unsigned i = 0; i < count; i++)
+    {
+        const unsigned char* gid = &bytes[i * 4];
+        gids[i] = gid[0] | gid[1] << 8 | gid[2] << 16 | (unsigned)gid[3] << 24;
+    }
+    return true;
+}
+
+void EncodeTileData(XMLElement& layer, const PODVector<unsigned>& gids, unsigned width, TmxEncoding encoding)
+{
+    // A fresh element drops whatever tile children or text the old encoding left behind
+    layer.RemoveChild(layer.GetChild("data"));
+    XMLElement data = layer.CreateChild("data");
+    if(encoding == TMX_XML)
+    {
+        for(unsigned i = 0; i < gids.Size(); i++)
+            data.CreateChild("tile").SetUInt("gid", gids[i]);
+        return;
+    }
+
+    String text;
+    if(encoding == TMX_CSV)
+    {
+        data.SetAttribute("encoding", "csv");
+        EncodeCSV(gids, width, text);
+    }
+    else
+    {
+        data.SetAttribute("encoding", "base64");
+        PODVector<unsigned char> bytes(gids.Size() * 4);
+        for(unsigned i = 0; i < gids.Size(); i++)
+        {
+            unsigned char* gid = &bytes[i * 4];
+            gid[0] = (unsigned char)gids[i];
+            gid[1] = (unsigned char)(gids[i] >> 8);
+            gid[2] = (unsigned char)(gids[i] >> 16);
+            gid[3] = (unsigned char)(gids[i] >> 24);
+        }
+        if(encoding == TMX_ZLIB)
+        {
+            data.SetAttribute("compression", "zlib");
+            PODVector<unsigned char> compressed;
+            DeflateZlib(bytes.Empty() ? 0 : &bytes[0], bytes.Size(), compressed);
+            bytes.Swap(compressed);
+        }
+        text = "\n   ";
+        EncodeBase64Data(bytes.Empty() ? 0 : &bytes[0], bytes.Size(), text);
+        text += "\n  ";
+    }
+    data.SetValue(text);
+}
+
+bool ReencodeTmx(Context* context, const String& fileName, TmxEncoding encoding, unsigned& numLayers)
+{
+    numLayers = 0;
+    XMLFile tmx(context);
+    {
+        File file(context, fileName);
+        if(!file.IsOpen() || !tmx.Load(file))
+            return false;
+    }
+    XMLElement map = tmx.GetRoot("map");
+    if(!map)
+        return false;
+
+    PODVector<unsigned> gids;
+    for(XMLElement layer = map.GetChild("layer"); layer; layer = layer.GetNext("layer"))
+    {
+        unsigned width = layer.GetUInt("width");
+        if(!DecodeTileData(layer.GetChild("data"), width * layer.GetUInt("height"), gids))
+        {
+            URHO3D_LOGWARNING(fileName + ": could not decode layer " + layer.GetAttribute("name"));
+            return false;
+        }
+        EncodeTileData(layer, gids, width, encoding);
+        numLayers++;
+    }
+
+    File file(context, fileName + ".tmp", FILE_WRITE);
+    bool ok = file.IsOpen() && tmx.Save(file, " ");
+    file.Close();
+    if(ok && CommitMapFile(fileName + ".tmp", fileName))
+        return true;
+    DiscardMapFile(fileName + ".tmp");
+    return false;
+}
+
+bool ExpandTmx(XMLFile& tmx)
+{
+    bool expanded = false;
+    PODVector<unsigned> gids;
+    XMLElement map = tmx.GetRoot("map");
+    for(XMLElement layer = map.GetChild("layer"); layer; layer = layer.GetNext("layer"))
+    {
+        XMLElement data = layer.GetChild("data");
+        unsigned width = layer.GetUInt("width");
+        if(!data.HasAttribute("compression") || !DecodeTileData(data, width * layer.GetUInt("height"), gids))
+            continue;
+        EncodeTileData(layer, gids, width, TMX_BASE64);
+        expanded = true;
+    }
+    return expanded;
+}
+
+bool IsTmxCompressed(Deserializer& source)
+{
+    while(!source.IsEof())
+    {
+        String line = source.ReadLine();
+        unsigned pos = line.Find("<data");
+        if(pos != String::NPOS)
+            return line.Find("compression=", pos) != String::NPOS;
+    }
+    return false;
+}
+
+static unsigned Adler32(const unsigned char* data, unsigned size)
+{
+    unsigned a = 1;
+    unsigned b = 0;
+    while(size)
+    {
+        // The most bytes that can be summed before b overflows
+        unsigned block = Min(size, 5552U);
+        size -= block;
+        while(block--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+/// Deflate bit stream writer, least significant bit first.
+struct DeflateWriter
+{
+    DeflateWriter(PODVector<unsigned char>& dest) :
+        dest_(dest),
+        bits_(0),
+        count_(0)
+    {
+    }
+
+    void Write(unsigned value, unsigned count)
+    {
+        bits_ |= value << count_;
+        count_ += count;
+        while(count_ >= 8)
+        {
+            dest_.Push((unsigned char)bits_);
+            bits_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    /// Huffman codes go most significant bit first.
+    void WriteCode(unsigned code, unsigned count)
+    {
+        unsigned reversed = 0;
+        for(unsigned i = 0; i < count; i++, code >>= 1)
+            reversed = reversed << 1 | (code & 1);
+        Write(reversed, count);
+    }
+
+    void Flush()
+    {
+        if(count_)
+            dest_.Push((unsigned char)bits_);
+        bits_ = 0;
+        count_ = 0;
+    }
+
+    PODVector<unsigned char>& dest_;
+    unsigned bits_;
+    unsigned count_;
+};
+
+/// Literal or length symbol with the fixed Huffman codes.
+static void WriteSymbol(DeflateWriter& writer, unsigned symbol)
+{
+    if(symbol < 144)
+        writer.WriteCode(0x30 + symbol, 8);
+    else if(symbol < 256)
+        writer.WriteCode(0x190 + symbol - 144, 9);
+    else if(symbol < 280)
+        writer.WriteCode(symbol - 256, 7);
+    else
+        writer.WriteCode(0xc0 + symbol - 280, 8);
+}
+
+static void WriteMatch(DeflateWriter& writer, unsigned length, unsigned distance)
+{
+    unsigned code = 28;
+    while(lengthBase[code] > length)
+        code--;
+    WriteSymbol(writer, 257 + code);
+    writer.Write(length - lengthBase[code], lengthExtra[code]);
+
+    code = 29;
+    while(distanceBase[code] > distance)
+        code--;
+    writer.WriteCode(code, 5);
+    writer.Write(distance - distanceBase[code], distanceExtra[code]);
+}
+
+void DeflateZlib(const unsigned char* data, unsigned size, PODVector<unsigned char>& dest)
+{
+    static const unsigned HASH_BITS = 14;
+    static const unsigned WINDOW_SIZE = 32768;
+    static const unsigned MIN_MATCH = 3;
+    static const unsigned MAX_MATCH = 258;
+
+    dest.Clear();
+    dest.Reserve(size / 8 + 64);
+    // Deflate with a 32 KB window, fastest compression level
+    dest.Push(0x78);
+    dest.Push(0x01);
+
+    DeflateWriter writer(dest);
+    // Single final block with fixed codes
+    writer.Write(1, 1);
+    writer.Write(1, 2);
+
+    // Last position + 1 of each 3 byte hash, one candidate per match is plenty for runs of equal gids
+    PODVector<unsigned> heads(1 << HASH_BITS);
+    memset(&heads[0], 0, heads.Size() * sizeof(unsigned));
+    unsigned i = 0;
+    while(i < size)
+    {
+        unsigned length = 0;
+        unsigned distance = 0;
+        if(i + MIN_MATCH <= size)
+        {
+            unsigned hash = ((data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761U) >> (32 - HASH_BITS);
+            unsigned candidate = heads[hash];
+            heads[hash] = i + 1;
+            if(candidate && i - (candidate - 1) <= WINDOW_SIZE)
+            {
+                unsigned from = candidate - 1;
+                unsigned maxLength = Min(size - i, MAX_MATCH);
+                while(length < maxLength && data[from + length] == data[i + length])
+                    length++;
+                distance = i - from;
+            }
+        }
+
+        if(length >= MIN_MATCH)
+        {
+            WriteMatch(writer, length, distance);
+            i += length;
+        }
+        else
+            WriteSymbol(writer, data[i++]);
+    }
+    WriteSymbol(writer, 256);
+    writer.Flush();
+
+    unsigned adler = Adler32(data, size);
+    dest.Push((unsigned char)(adler >> 24));
+    dest.Push((unsigned char)(adler >> 16));
+    dest.Push((unsigned char)(adler >> 8));
+    dest.Push((unsigned char)adler);
+}
+
+/// Deflate bit stream reader. Reading past the end yields zeros and sets overrun_.
+struct InflateReader
+{
+    unsigned Read(unsigned count)
+    {
+        while(count_ < count)
+        {
+            if(next_ < end_)
+                bits_ |= (unsigned)*next_++ << count_;
+            else
+                overrun_ = true;
+            count_ += 8;
+        }
+        unsigned value = bits_ & ((1U << count) - 1);
+        bits_ >>= count;
+        count_ -= count;
+        return value;
+    }
+
+    const unsigned char* next_;
+    const unsigned char* end_;
+    unsigned bits_;
+    unsigned count_;
+    bool overrun_;
+};
+
+/// Canonical Huffman code as the number of codes per length and the symbols in code order.
+struct InflateHuffman
+{
+    unsigned short counts_[16];
+    unsigned short symbols_[288];
+};
+
+static bool BuildHuffman(InflateHuffman& huffman, const unsigned char* lengths, unsigned count)
+{
+    memset(huffman.counts_, 0, sizeof(huffman.counts_));
+    for(unsigned i = 0; i < count; i++)
+        huffman.counts_[lengths[i]]++;
+    huffman.counts_[0] = 0;
+
+    // More codes of a length than the shorter ones leave room for
+    int left = 1;
+    for(unsigned length = 1; length < 16; length++)
+    {
+        left = (left << 1) - huffman.counts_[length];
+        if(left < 0)
+            return false;
+    }
+
+    unsigned short offsets[16];
+    offsets[1] = 0;
+    for(unsigned length = 1; length < 15; length++)
+        offsets[length + 1] = offsets[length] + huffman.counts_[length];
+    for(unsigned i = 0; i < count; i++)
+    {
+        if(lengths[i])
+            huffman.symbols_[offsets[lengths[i]]++] = (unsigned short)i;
+    }
+    return true;
+}
+
+static int DecodeSymbol(InflateReader& reader, const InflateHuffman& huffman)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for(unsigned length = 1; length < 16; length++)
+    {
+        code |= reader.Read(1);
+        int count = huffman.counts_[length];
+        if(code - first < count)
+            return huffman.symbols_[index + code - first];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static bool InflateCodes(InflateReader& reader, PODVector<unsigned char>& dest, unsigned maxSize,
+    const InflateHuffman& literals, const InflateHuffman& distances)
+{
+    for(;;)
+    {
+        int symbol = DecodeSymbol(reader, literals);
+        if(symbol < 0 || reader.overrun_)
+            return false;
+        if(symbol < 256)
+        {
+            if(dest.Size() == maxSize)
+                return false;
+            dest.Push((unsigned char)symbol);
+        }
+        else if(symbol == 256)
+            return true;
+        else
+        {
+            symbol -= 257;
+            if(symbol >= 29)
+                return false;
+            unsigned length = lengthBase[symbol] + reader.Read(lengthExtra[symbol]);
+            int code = DecodeSymbol(reader, distances);
+            if(code < 0 || code >= 30)
+                return false;
+            unsigned distance = distanceBase[code] + reader.Read(distanceExtra[code]);
+            if(distance > dest.Size() || length > maxSize - dest.Size())
+                return false;
+
+            // Byte by byte, a distance shorter than the length repeats the run
+            unsigned start = dest.Size();
+            dest.Resize(start + length);
+            unsigned char* out = &dest[start];
+            const unsigned char* from = out - distance;
+            for(unsigned i = 0; i < length; i++)
+                out[i] = from[i];
+        }
+    }
+}
+
+static bool InflateFixed(InflateReader& reader, PODVector<unsigned char>& dest, unsigned maxSize)
+{
+    unsigned char lengths[288 + 30];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    memset(lengths + 288, 5, 30);
+    InflateHuffman literals;
+    InflateHuffman distances;
+    BuildHuffman(literals, lengths, 288);
+    BuildHuffman(distances, lengths + 288, 30);
+    return InflateCodes(reader, dest, maxSize, literals, distances);
+}
+
+static bool InflateDynamic(InflateReader& reader, PODVector<unsigned char>& dest, unsigned maxSize)
+{
+    static const unsigned char order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    unsigned numLiterals = reader.Read(5) + 257;
+    unsigned numDistances = reader.Read(5) + 1;
+    unsigned numCodes = reader.Read(4) + 4;
+    if(numLiterals > 286 || numDistances > 30)
+        return false;
+
+    unsigned char lengths[288 + 30];
+    memset(lengths, 0, sizeof(lengths));
+    for(unsigned i = 0; i < numCodes; i++)
+        lengths[order[i]] = (unsigned char)reader.Read(3);
+    InflateHuffman codes;
+    if(!BuildHuffman(codes, lengths, 19))
+        return false;
+
+    // Literal and distance code lengths, run length coded
+    unsigned total = numLiterals + numDistances;
+    unsigned i = 0;
+    while(i < total)
+    {
+        int symbol = DecodeSymbol(reader, codes);
+        if(symbol < 0 || reader.overrun_)
+            return false;
+        if(symbol < 16)
+        {
+            lengths[i++] = (unsigned char)symbol;
+            continue;
+        }
+
+        unsigned char length = 0;
+        unsigned repeat;
+        if(symbol == 16)
+        {
+            if(!i)
+                return false;
+            length = lengths[i - 1];
+            repeat = 3 + reader.Read(2);
+        }
+        else if(symbol == 17)
+            repeat = 3 + reader.Read(3);
+        else
+            repeat = 11 + reader.Read(7);
+        if(i + repeat > total)
+            return false;
+        while(repeat--)
+            lengths[i++] = length;
+    }
+
+    InflateHuffman literals;
+    InflateHuffman distances;
+    return BuildHuffman(literals, lengths, numLiterals) && BuildHuffman(distances, lengths + numLiterals, numDistances) &&
+        InflateCodes(reader, dest, maxSize, literals, distances);
+}
+
+/// Step over a zero terminated gzip header field. Returns false if it runs into the end.
+static bool SkipGzipString(const unsigned char* data, unsigned end, unsigned& pos)
+{
+    while(pos < end && data[pos])
+        pos++;
+    if(pos == end)
+        return false;
+    pos++;
+    return true;
+}
+
+bool InflateZlib(const unsigned char* data, unsigned size, PODVector<unsigned char>& dest, unsigned maxSize, bool gzip)
+{
+    dest.Clear();
+    const unsigned char* end = data + size;
+    if(gzip)
+    {
+        // RFC 1952 header with its optional fields, CRC-32 and length trailer. The fields are checked against the
+        // bytes left before the trailer, their lengths come from the file
+        if(size < 18 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8)
+            return false;
+        unsigned char flags = data[3];
+        unsigned available = size - 8;
+        unsigned pos = 10;
+        if(flags & 4)
+        {
+            if(available - pos < 2)
+                return false;
+            unsigned extra = data[pos] | data[pos + 1] << 8;
+            pos += 2;
+            if(available - pos < extra)
+                return false;
+            pos += extra;
+        }
+        if((flags & 8) && !SkipGzipString(data, available, pos))
+            return false;
+        if((flags & 16) && !SkipGzipString(data, available, pos))
+            return false;
+        if(flags & 2)
+        {
+            if(available - pos < 2)
+                return false;
+            pos += 2;
+        }
+        if(pos == available)
+            return false;
+        end = data + available;
+        data += pos;
+    }
+    else
+    {
+        // Deflate, no preset dictionary
+        if(size < 6 || (data[0] & 0x0f) != 8 || (data[0] << 8 | data[1]) % 31 || (data[1] & 0x20))
+            return false;
+        data += 2;
+        end -= 4;
+    }
+
+    InflateReader reader = { data, end, 0, 0, false };
+    unsigned last;
+    do
+    {
+        last = reader.Read(1);
+        unsigned type = reader.Read(2);
+        if(type == 0)
+        {
+            // Stored block, starts at the next byte
+            reader.bits_ = 0;
+            reader.count_ = 0;
+            if(reader.end_ - reader.next_ < 4)
+                return false;
+            unsigned length = reader.next_[0] | reader.next_[1] << 8;
+            unsigned inverse = reader.next_[2] | reader.next_[3] << 8;
+            reader.next_ += 4;
+            if(length != (~inverse & 0xffff) || (unsigned)(reader.end_ - reader.next_) < length ||
+                length > maxSize - dest.Size())
+                return false;
+            unsigned start = dest.Size();
+            dest.Resize(start + length);
+            if(length)
+                memcpy(&dest[start], reader.next_, length);
+            reader.next_ += length;
+        }
+        else if(type == 1)
+        {
+            if(!InflateFixed(reader, dest, maxSize))
+                return false;
+        }
+        else if(type == 2)
+        {
+            if(!InflateDynamic(reader, dest, maxSize))
+                return false;
+        }
+        else
+            return false;
+        if(reader.overrun_)
+            return false;
+    }
+    while(!last);
+
+    if(gzip)
+        return (unsigned)(end[4] | end[5] << 8 | end[6] << 16 | (unsigned)end[7] << 24) == dest.Size();
+    unsigned adler = (unsigned)end[0] << 24 | end[1] << 16 | end[2] << 8 | end[3];
+    return adler == Adler32(dest.Empty() ? 0 : &dest[0], dest.Size());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/IO/Deserializer.h"
+#include "Urho3D/IO/Serializer.h"
+#include "Urho3D/Resource/XMLElement.h"
+
+namespace Urho3D
+{
+
+class XMLFile;
+}
+
+using namespace Urho3D;
+
+/// Tile layer encodings Tiled writes. Base64 gids are 32-bit little endian.
+enum TmxEncoding
+{
+    /// One <tile gid=""/> element per cell.
+    TMX_XML = 0,
+    TMX_CSV,
+    TMX_BASE64,
+    /// Base64 of the zlib compressed gids.
+    TMX_ZLIB
+};
+
+/// Parse xml, csv, base64 or zlib.
+bool ParseTmxEncoding(const String& name, TmxEncoding& encoding);
+const char* GetTmxEncodingName(TmxEncoding encoding);
+
+/// Decode the count gids of a layer <data> element in any encoding, gzip compression included. Returns false on
+/// malformed data or a count mismatch.
+bool DecodeTileData(const XMLElement& data, unsigned count, PODVector<unsigned>& gids);
+/// Replace the <data> element of a layer with gids in another encoding. CSV rows are width gids long.
+void EncodeTileData(XMLElement& layer, const PODVector<unsigned>& gids, unsigned width, TmxEncoding encoding);
+
+/// Re-encode every tile layer of a tmx file in place. Returns false and leaves the file alone if a layer can't be
+/// decoded or the file can't be written.
+bool ReencodeTmx(Context* context, const String& fileName, TmxEncoding encoding, unsigned& numLayers);
+/// Rewrite compressed layers as plain base64, the most TmxFile2D reads. Returns false if there were none.
+bool ExpandTmx(XMLFile& tmx);
+/// Whether the first tile layer of a tmx file is compressed. Reads only up to its <data> tag.
+bool IsTmxCompressed(Deserializer& source);
+
+/// zlib stream of data, fixed Huffman codes over a greedy LZ77 pass. Tile rows repeat so much that dynamic codes
+/// would buy little.
+void DeflateZlib(const unsigned char* data, unsigned size, PODVector<unsigned char>& dest);
+/// Decompress a zlib stream, or a gzip one if gzip is set. Returns false on corrupt data or once the output would grow
+/// past maxSize bytes.
+bool InflateZlib(const unsigned char* data, unsigned size, PODVector<unsigned char>& dest, unsigned maxSize, bool gzip = false);
@@ -0,0 +1,284 @@
+#include "VirtualList.h"
+#include "Urho3D/Container/Sort.h"
+#include "Urho3D/Core/CoreEvents.h"
+#include "Urho3D/UI/UIEvents.h"
+
+VirtualList::VirtualList(Context* context) :
+    Object(context),
+    filtering_(false),
+    rowHeight_(1),
+    first_(0),
+    selected_(M_MAX_UNSIGNED),
+    dirty_(false),
+    binding_(false)
+{
+}
+
+void VirtualList::SetView(ListView* view, LineEdit* filter, const String& rowStyle)
+{
+    view_ = view;
+    rowStyle_ = rowStyle;
+    rows_.Clear();
+    view->RemoveAllItems();
+
+    topSpacer_ = new UIElement(context_);
+    bottomSpacer_ = new UIElement(context_);
+    view->AddItem(topSpacer_);
+    view->AddItem(bottomSpacer_);
+
+    // Every row has the height of one line of the row style
+    SharedPtr<Text> row(new Text(context_));
+    view->InsertItem(1, row);
+    row->SetStyle(rowStyle_);
+    row->SetText("Ag");
+    rowHeight_ = Max(row->GetHeight(), 1);
+    rows_.Push(row);
+
+    SubscribeToEvent(view, E_VIEWCHANGED, URHO3D_HANDLER(VirtualList, HandleViewChanged));
+    SubscribeToEvent(view, E_RESIZED, URHO3D_HANDLER(VirtualList, HandleResized));
+    SubscribeToEvent(view, E_ITEMSELECTED, URHO3D_HANDLER(VirtualList, HandleItemSelected));
+    if(filter)
+    {
+        SubscribeToEvent(filter, E_TEXTCHANGED, URHO3D_HANDLER(VirtualList, HandleFilterChanged));
+        SubscribeToEvent(filter, E_TEXTFINISHED, URHO3D_HANDLER(VirtualList, HandleFilterFinished));
+    }
+    SubscribeToEvent(E_POSTUPDATE, URHO3D_HANDLER(VirtualList, HandlePostUpdate));
+
+    UpdateRows();
+    Bind();
+}
+
+void VirtualList::SetEntries(const Vector<String>& names, const PODVector<unsigned>& values)
+{
+    entries_.Resize(names.Size());
+    sorted_.Resize(names.Size());
+    valueEntries_.Clear();
+    for(unsigned i = 0; i < names.Size(); i++)
+    {
+        Entry& entry = entries_[i];
+        entry.name_ = names[i];
+        entry.key_ = names[i].ToLower();
+        entry.value_ = i < values.Size() ? values[i] : i;
+        valueEntries_[entry.value_] = i;
+        sorted_[i] = i;
+    }
+    Sort(sorted_.Begin(), sorted_.End(), KeyLess(entries_));
+    selected_ = M_MAX_UNSIGNED;
+    UpdateFilter();
+    if(view_)
+        view_->SetViewPosition(IntVector2::ZERO);
+    dirty_ = true;
+}
+
+void VirtualList::Clear()
+{
+    SetEntries(Vector<String>());
+}
+
+void VirtualList::Add(const String& name, unsigned value)
+{
+    Entry entry;
+    entry.name_ = name;
+    entry.key_ = name.ToLower();
+    entry.value_ = value;
+
+    unsigned index = entries_.Size();
+    unsigned position = LowerBound(entry.key_);
+    entries_.Push(entry);
+    sorted_.Insert(position, index);
+    valueEntries_[value] = index;
+    if(filtering_)
+        UpdateFilter();
+    dirty_ = true;
+}
+
+bool VirtualList::Remove(unsigned value)
+{
+    HashMap<unsigned, unsigned>::Iterator i = valueEntries_.Find(value);
+    if(i == valueEntries_.End())
+        return false;
+    unsigned entry = i->second_;
+    valueEntries_.Erase(i);
+    sorted_.Erase(FindSorted(entry));
+
+    unsigned last = entries_.Size() - 1;
+    if(entry != last)
+    {
+        sorted_[FindSorted(last)] = entry;
+        entries_[entry] = entries_[last];
+        valueEntries_[entries_[entry].value_] = entry;
+    }
+    entries_.Pop();
+
+    if(selected_ == entry)
+        selected_ = M_MAX_UNSIGNED;
+    else if(selected_ == last)
+        selected_ = entry;
+    if(filtering_)
+        UpdateFilter();
+    dirty_ = true;
+    return true;
+}
+
+void VirtualList::SetFilter(const String& prefix)
+{
+    String filter = prefix.Trimmed().ToLower();
+    if(filter == filter_)
+        return;
+    filter_ = filter;
+    UpdateFilter();
+    if(view_)
+        view_->SetViewPosition(IntVector2::ZERO);
+    dirty_ = true;
+}
+
+unsigned VirtualList::LowerBound(const String& key) const
+{
+    unsigned low = 0;
+    unsigned high = sorted_.Size();
+    while(low < high)
+    {
+        unsigned middle = (low + high) / 2;
+        if(entries_[sorted_[middle]].key_ < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+unsigned VirtualList::FindSorted(unsigned entry) const
+{
+    // Equal names sit next to each other, the run is searched for the entry itself
+    unsigned i = LowerBound(entries_[entry].key_);
+    while(i < sorted_.Size() && sorted_[i] != entry)
+        i++;
+    return i;
+}
+
+void VirtualList::UpdateFilter()
+{
+    filtered_.Clear();
+    filtering_ = !filter_.Empty();
+    if(!filtering_)
+        return;
+    for(unsigned i = LowerBound(filter_); i < sorted_.Size() && entries_[sorted_[i]].key_.StartsWith(filter_); i++)
+        filtered_.Push(sorted_[i]);
+}
+
+void VirtualList::UpdateRows()
+{
+    // Two more rows than fit, a partly scrolled view shows parts of both ends
+    unsigned numRows = Max(view_->GetScrollPanel()->GetHeight(), 0) / rowHeight_ + 2;
+    while(rows_.Size() < numRows)
+    {
+        SharedPtr<Text> row(new Text(context_));
+        view_->InsertItem(rows_.Size() + 1, row);
+        row->SetStyle(rowStyle_);
+        rows_.Push(row);
+    }
+    while(rows_.Size() > numRows)
+    {
+        view_->RemoveItem(rows_.Back());
+        rows_.Pop();
+    }
+    dirty_ = true;
+}
+
+void VirtualList::Bind()
+{
+    dirty_ = false;
+    if(!view_)
+        return;
+
+    binding_ = true;
+    unsigned numShown = GetNumShown();
+    unsigned numRows = rows_.Size();
+    unsigned first = (unsigned)Max(view_->GetViewPosition().y_, 0) / rowHeight_;
+    // Past the end the rows stay on the last entries, the spacers keep them at their true position anyway
+    if(first + numRows > numShown)
+        first = numShown > numRows ? numShown - numRows : 0;
+    unsigned numBound = Min(numRows, numShown - first);
+
+    topSpacer_->SetFixedHeight(first * rowHeight_);
+    bottomSpacer_->SetFixedHeight((numShown - first - numBound) * rowHeight_);
+    // The list view selects rows, the highlight has to follow the entry instead
+    view_->ClearSelection();
+    for(unsigned i = 0; i < numRows; i++)
+    {
+        Text* row = rows_[i];
+        if(i < numBound)
+        {
+            unsigned entry = GetShownEntry(first + i);
+            row->SetText(entries_[entry].name_);
+            row->SetSelected(entry == selected_);
+            row->SetVisible(true);
+        }
+        else
+            row->SetVisible(false);
+    }
+    first_ = first;
+    binding_ = false;
+}
+
+void VirtualList::Select(unsigned shown)
+{
+    if(shown >= GetNumShown())
+        return;
+    selected_ = GetShownEntry(shown);
+    // Copied, a handler may change the entries
+    String name = entries_[selected_].name_;
+    unsigned value = entries_[selected_].value_;
+
+    using namespace VirtualListSelected;
+    VariantMap& eventData = GetEventDataMap();
+    eventData[P_LIST] = this;
+    eventData[P_NAME] = name;
+    eventData[P_VALUE] = value;
+    SendEvent(E_VIRTUALLISTSELECTED, eventData);
+}
+
+void VirtualList::HandleViewChanged(StringHash eventType, VariantMap& eventData)
+{
+    // Resizing the spacers may clamp the view, that is picked up after the frame
+    if(binding_)
+        dirty_ = true;
+    else
+        Bind();
+}
+
+void VirtualList::HandleResized(StringHash eventType, VariantMap& eventData)
+{
+    UpdateRows();
+    Bind();
+}
+
+void VirtualList::HandleItemSelected(StringHash eventType, VariantMap& eventData)
+{
+    if(binding_)
+        return;
+    // Item 0 is the top spacer, the rows follow it
+    unsigned index = eventData[ItemSelected::P_SELECTION].GetUInt();
+    if(index == 0 || index > rows_.Size() || !rows_[index - 1]->IsVisible())
+        return;
+    Select(first_ + index - 1);
+}
+
+void VirtualList::HandleFilterChanged(StringHash eventType, VariantMap& eventData)
+{
+    SetFilter(eventData[TextChanged::P_TEXT].GetString());
+}
+
+void VirtualList::HandleFilterFinished(StringHash eventType, VariantMap& eventData)
+{
+    // Enter picks the first match
+    SetFilter(eventData[TextFinished::P_TEXT].GetString());
+    Select(0);
+    dirty_ = true;
+}
+
+void VirtualList::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
+{
+    if(dirty_)
+        Bind();
+}
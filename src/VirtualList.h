@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Urho3D/Container/HashMap.h"
+#include "Urho3D/Container/Ptr.h"
+#include "Urho3D/Container/Str.h"
+#include "Urho3D/Container/Vector.h"
+#include "Urho3D/Core/Object.h"
+#include "Urho3D/UI/LineEdit.h"
+#include "Urho3D/UI/ListView.h"
+#include "Urho3D/UI/Text.h"
+
+using namespace Urho3D;
+
+/// Entry of a VirtualList picked by the user.
+URHO3D_EVENT(E_VIRTUALLISTSELECTED, VirtualListSelected)
+{
+    URHO3D_PARAM(P_LIST, List);                 // VirtualList pointer
+    URHO3D_PARAM(P_NAME, Name);                 // String
+    URHO3D_PARAM(P_VALUE, Value);               // unsigned
+}
+
+/// Named entries shown in a ListView that only ever holds the rows in view. Spacers above and below the rows stand in
+/// for the rest so the scroll bar still covers the whole list, and scrolling rebinds the row texts instead of creating
+/// elements. An optional LineEdit filters the entries by name prefix through an index sorted by lowercase name, Enter in
+/// it picks the first match.
+class VirtualList : public Object
+{
+    URHO3D_OBJECT(VirtualList, Object);
+public:
+    VirtualList(Context* context);
+
+    /// Take over a list view and the line edit filtering it, which may be null. Items already in the view are removed.
+    void SetView(ListView* view, LineEdit* filter, const String& rowStyle);
+    /// Replace every entry. Values default to the entry index.
+    void SetEntries(const Vector<String>& names, const PODVector<unsigned>& values = PODVector<unsigned>());
+    void Clear();
+    /// Add an entry at the end.
+    void Add(const String& name, unsigned value);
+    /// Remove the entry with a value, the last entry moves into its place. Returns false if there is none.
+    bool Remove(unsigned value);
+    /// Show only the entries whose name starts with prefix, case insensitive. Empty shows all.
+    void SetFilter(const String& prefix);
+
+    unsigned GetNumEntries() const { return entries_.Size(); }
+    /// Number of entries passing the filter.
+    unsigned GetNumShown() const { return filtering_ ? filtered_.Size() : entries_.Size(); }
+    /// Number of row elements in the view.
+    unsigned GetNumRows() const { return rows_.Size(); }
+
+private:
+    struct Entry
+    {
+        String name_;
+        /// Lowercase name the sorted index and the filter compare.
+        String key_;
+        unsigned value_;
+    };
+
+    /// Orders entry indices by key.
+    struct KeyLess
+    {
+        KeyLess(const Vector<Entry>& entries) : entries_(entries) {}
+        bool operator () (unsigned lhs, unsigned rhs) const { return entries_[lhs].key_ < entries_[rhs].key_; }
+        const Vector<Entry>& entries_;
+    };
+
+    /// First position in sorted_ whose key isn't less than key.
+    unsigned LowerBound(const String& key) const;
+    /// Position of an entry in sorted_.
+    unsigned FindSorted(unsigned entry) const;
+    /// Recollect the entries passing the filter from the sorted index.
+    void UpdateFilter();
+    /// Create or drop rows so they fill the view height.
+    void UpdateRows();
+    /// Point the rows at the entries under the current scroll position and size the spacers.
+    void Bind();
+    unsigned GetShownEntry(unsigned index) const { return filtering_ ? filtered_[index] : index; }
+    /// Select the entry at a shown position and send E_VIRTUALLISTSELECTED.
+    void Select(unsigned shown);
+
+    void HandleViewChanged(StringHash eventType, VariantMap& eventData);
+    void HandleResized(StringHash eventType, VariantMap& eventData);
+    void HandleItemSelected(StringHash eventType, VariantMap& eventData);
+    void HandleFilterChanged(StringHash eventType, VariantMap& eventData);
+    void HandleFilterFinished(StringHash eventType, VariantMap& eventData);
+    void HandlePostUpdate(StringHash eventType, VariantMap& eventData);
+
+    Vector<Entry> entries_;
+    /// Entry indices sorted by key.
+    PODVector<unsigned> sorted_;
+    /// Entries passing the filter, in key order.
+    PODVector<unsigned> filtered_;
+    /// Entry index of each value.
+    HashMap<unsigned, unsigned> valueEntries_;
+    String filter_;
+    bool filtering_;
+
+    WeakPtr<ListView> view_;
+    SharedPtr<UIElement> topSpacer_;
+    SharedPtr<UIElement> bottomSpacer_;
+    Vector<SharedPtr<Text> > rows_;
+    String rowStyle_;
+    int rowHeight_;
+    /// Shown position bound to the first row.
+    unsigned first_;
+    /// Selected entry index, M_MAX_UNSIGNED for none.
+    unsigned selected_;
+    /// Entries changed since the last bind.
+    bool dirty_;
+    /// Set while Bind moves the view, so its own events are ignored.
+    bool binding_;
+};
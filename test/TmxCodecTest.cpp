@@ -0,0 +1,179 @@
+#include "TmxCodec.h"
+#include "Urho3D/Core/Context.h"
+#include "Urho3D/Resource/XMLFile.h"
+
+#include <cstdio>
+
+/// Layer size of the embedded streams below.
+static const unsigned WIDTH = 24;
+static const unsigned HEIGHT = 16;
+
+/// zlib level 9 compression of the test layer, one dynamic Huffman block.
+static const char* dynamicZlib =
+    "eNrtVEEOgCAMU+ADuIH6/48KyQ6LQdZFj5I0DawX2sKy/Gu2UsMKcAZ1nYvad4QB08P5iHky74gNh3AA+AR1UZAM3kFdEh/1fuQf"
+    "OXKpxlxnh/hdHLkUwL/tZS53/yrocxStpSNHr7MjFzL6rzWI32z0P8h90V7zh/3Xbx7RZ6P/3v+GJ/MLCOAE+g==";
+
+/// gzip of the test layer with an extra field, file name, comment and header CRC, one dynamic Huffman block.
+static const char* gzipLayer =
+    "H4sIHgAAAAAA/wQAVFgAAGxheWVyLmJpbgB0aWxlcwAnaO1UQQ6AIAxT4AO4gfr/jwrJDotB1kWPkjQNrBfawrL8a7ZSwwpwBnWd"
+    "i9p3hAHTw/mIeTLviA2HcAD4BHVRkAzeQV0SH/V+5B85cqnGXGeH+F0cuRTAv+1lLnf/KuhzFK2lI0evsyMXMvqvNYjfbPQ/yH3R"
+    "XvOH/ddvHtFno//e/4Yn8wt6TwTsAAYAAA==";
+
+static unsigned numFailed = 0;
+
+static void Check(bool ok, const char* name)
+{
+    printf("%s %s\n", ok ? "ok  " : "FAIL", name);
+    if(!ok)
+        numFailed++;
+}
+
+/// Empty rows on top, then runs of ground tiles broken by scattered decoration, like a Tiled layer.
+static unsigned TestGid(unsigned i)
+{
+    unsigned x = i % WIDTH;
+    unsigned y = i / WIDTH;
+    if(y < 3)
+        return 0;
+    if((x * 3 + y) % 11 == 0)
+        return 17 + (x ^ y) % 9;
+    return 1 + (x * x + y) % 4;
+}
+
+static void GetTestLayer(PODVector<unsigned>& gids)
+{
+    gids.Resize(WIDTH * HEIGHT);
+    for(unsigned i = 0; i < gids.Size(); i++)
+        gids[i] = TestGid(i);
+}
+
+static void GetTestBytes(PODVector<unsigned char>& bytes)
+{
+    bytes.Resize(WIDTH * HEIGHT * 4);
+    for(unsigned i = 0; i < WIDTH * HEIGHT; i++)
+    {
+        unsigned gid = TestGid(i);
+        bytes[i * 4] = (unsigned char)gid;
+        bytes[i * 4 + 1] = (unsigned char)(gid >> 8);
+        bytes[i * 4 + 2] = (unsigned char)(gid >> 16);
+        bytes[i * 4 + 3] = (unsigned char)(gid >> 24);
+    }
+}
+
+static bool RoundTrip(XMLElement& layer, TmxEncoding encoding)
+{
+    PODVector<unsigned> gids;
+    GetTestLayer(gids);
+    EncodeTileData(layer, gids, WIDTH, encoding);
+    PODVector<unsigned> decoded;
+    return DecodeTileData(layer.GetChild("data"), gids.Size(), decoded) && decoded == gids;
+}
+
+/// Decode base64 text as a layer with the given compression.
+static bool DecodeText(XMLElement& layer, const String& text, const char* compression, unsigned count)
+{
+    layer.RemoveChild(layer.GetChild("data"));
+    XMLElement data = layer.CreateChild("data");
+    data.SetAttribute("encoding", "base64");
+    data.SetAttribute("compression", compression);
+    data.SetValue(text);
+
+    PODVector<unsigned> gids;
+    GetTestLayer(gids);
+    PODVector<unsigned> decoded;
+    return DecodeTileData(data, count, decoded) && decoded == gids;
+}
+
+static unsigned Adler32(const PODVector<unsigned char>& bytes)
+{
+    unsigned a = 1;
+    unsigned b = 0;
+    for(unsigned i = 0; i < bytes.Size(); i++)
+    {
+        a = (a + bytes[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+/// zlib stream of the test layer in two stored blocks.
+static void GetStoredZlib(PODVector<unsigned char>& stream)
+{
+    PODVector<unsigned char> bytes;
+    GetTestBytes(bytes);
+    stream.Clear();
+    stream.Push(0x78);
+    stream.Push(0x01);
+    unsigned half = bytes.Size() / 2;
+    for(unsigned block = 0; block < 2; block++)
+    {
+        unsigned start = block ? half : 0;
+        unsigned length = block ? bytes.Size() - half : half;
+        stream.Push((unsigned char)block);
+        stream.Push((unsigned char)length);
+        stream.Push((unsigned char)(length >> 8));
+        stream.Push((unsigned char)~length);
+        stream.Push((unsigned char)(~length >> 8));
+        for(unsigned i = 0; i < length; i++)
+            stream.Push(bytes[start + i]);
+    }
+    unsigned adler = Adler32(bytes);
+    stream.Push((unsigned char)(adler >> 24));
+    stream.Push((unsigned char)(adler >> 16));
+    stream.Push((unsigned char)(adler >> 8));
+    stream.Push((unsigned char)adler);
+}
+
+static String EncodeBase64(const PODVector<unsigned char>& bytes)
+{
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    String text;
+    for(unsigned i = 0; i < bytes.Size(); i += 3)
+    {
+        unsigned value = bytes[i] << 16 | (i + 1 < bytes.Size() ? bytes[i + 1] << 8 : 0) |
+            (i + 2 < bytes.Size() ? bytes[i + 2] : 0);
+        text += chars[value >> 18];
+        text += chars[(value >> 12) & 63];
+        text += i + 1 < bytes.Size() ? chars[(value >> 6) & 63] : '=';
+        text += i + 2 < bytes.Size() ? chars[value & 63] : '=';
+    }
+    return text;
+}
+
+int main()
+{
+    SharedPtr<Context> context(new Context());
+    XMLFile xml(context);
+    XMLElement layer = xml.CreateRoot("layer");
+
+    Check(RoundTrip(layer, TMX_XML), "xml round trip");
+    Check(RoundTrip(layer, TMX_CSV), "csv round trip");
+    Check(RoundTrip(layer, TMX_BASE64), "base64 round trip");
+    // DeflateZlib writes one block with the fixed Huffman codes
+    Check(RoundTrip(layer, TMX_ZLIB), "zlib fixed block round trip");
+
+    PODVector<unsigned char> stored;
+    GetStoredZlib(stored);
+    Check(DecodeText(layer, EncodeBase64(stored), "zlib", WIDTH * HEIGHT), "zlib stored blocks");
+    Check(DecodeText(layer, dynamicZlib, "zlib", WIDTH * HEIGHT), "zlib dynamic block");
+    Check(DecodeText(layer, gzipLayer, "gzip", WIDTH * HEIGHT), "gzip with optional header fields");
+
+    // A stream that inflates past the layer size is rejected before it is written out
+    PODVector<unsigned char> bytes;
+    PODVector<unsigned char> inflated;
+    GetTestBytes(bytes);
+    Check(InflateZlib(&stored[0], stored.Size(), inflated, bytes.Size()) && inflated == bytes, "stored inflate at limit");
+    Check(!InflateZlib(&stored[0], stored.Size(), inflated, bytes.Size() - 1), "stored inflate over limit");
+    PODVector<unsigned char> compressed;
+    DeflateZlib(&bytes[0], bytes.Size(), compressed);
+    Check(!InflateZlib(&compressed[0], compressed.Size(), inflated, bytes.Size() - 1), "fixed inflate over limit");
+
+    // Header fields whose lengths run past the data fail instead of reading beyond it
+    unsigned char extra[20] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff };
+    Check(!InflateZlib(extra, sizeof(extra), inflated, bytes.Size(), true), "gzip extra field past the end");
+    unsigned char name[24] = { 0x1f, 0x8b, 8, 8, 0, 0, 0, 0, 0, 0xff, 'a', 'b', 'c', 'd', 'e', 'f' };
+    Check(!InflateZlib(name, sizeof(name), inflated, bytes.Size(), true), "gzip name running into the trailer");
+
+    printf("%u failed\n", numFailed);
+    return numFailed ? 1 : 0;
+}